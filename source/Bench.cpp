@@ -0,0 +1,387 @@
+#include "gwTGA.h"
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Synthetic images of every TGA image type are generated in memory, saved and loaded again from memory and from file.
+// Results are written to stdout as CSV or JSON, one record per image kind, flip option, content and operation. With --files,
+// given TGA files are saved with greedy and optimal RLE packets instead, one record per file compares sizes and times.
+
+struct BenchConfig {
+	unsigned int width;
+	unsigned int height;
+	unsigned int iterations;
+	bool json;
+	std::string tempFileName;
+	std::vector<std::string> files;
+};
+
+struct ImageKind {
+	unsigned char imageType;
+	unsigned char bitsPerPixel;
+	unsigned char attributeBitsPerPixel;
+	unsigned char colorMapBitsPerPixel; //< 0 for images without color map
+	gw::tga::TGAColorType colorType;
+};
+
+// Type 1/2/3 are uncompressed color mapped, RGB and greyscale images, 9/10/11 are their RLE compressed versions
+const ImageKind imageKinds[] = {
+	{ 1, 8, 0, 24, gw::tga::GWTGA_RGB },
+	{ 1, 8, 8, 32, gw::tga::GWTGA_RGB },
+	{ 2, 16, 1, 0, gw::tga::GWTGA_RGB },
+	{ 2, 24, 0, 0, gw::tga::GWTGA_RGB },
+	{ 2, 32, 8, 0, gw::tga::GWTGA_RGB },
+	{ 3, 8, 0, 0, gw::tga::GWTGA_GREYSCALE },
+	{ 3, 16, 8, 0, gw::tga::GWTGA_GREYSCALE },
+	{ 9, 8, 0, 24, gw::tga::GWTGA_RGB },
+	{ 9, 8, 8, 32, gw::tga::GWTGA_RGB },
+	{ 10, 16, 1, 0, gw::tga::GWTGA_RGB },
+	{ 10, 24, 0, 0, gw::tga::GWTGA_RGB },
+	{ 10, 32, 8, 0, gw::tga::GWTGA_RGB },
+	{ 11, 8, 0, 0, gw::tga::GWTGA_GREYSCALE },
+	{ 11, 16, 8, 0, gw::tga::GWTGA_GREYSCALE }
+};
+
+enum Content {
+	CONTENT_FLAT,  //< Single color
+	CONTENT_RUNS,  //< Runs of 1 to 64 pixels of random color
+	CONTENT_NOISE  //< Random pixels
+};
+
+const char* contentNames[] = { "flat", "runs", "noise" };
+
+enum Operation {
+	LOAD_MEMORY,
+	LOAD_FILE,
+	SAVE_MEMORY,
+	SAVE_FILE
+};
+
+const char* operationNames[] = { "load", "load", "save", "save" };
+const char* sourceNames[] = { "memory", "file", "memory", "file" };
+
+const gw::tga::TGAOptions flipOptions[] = {
+	gw::tga::GWTGA_OPTIONS_NONE,
+	gw::tga::GWTGA_FLIP_HORIZONTALLY,
+	gw::tga::GWTGA_FLIP_VERTICALLY,
+	(gw::tga::TGAOptions) (gw::tga::GWTGA_FLIP_HORIZONTALLY | gw::tga::GWTGA_FLIP_VERTICALLY)
+};
+
+const char* flipNames[] = { "none", "horizontal", "vertical", "both" };
+
+// Generated content does not depend on platform
+struct Random {
+	Random(uint32_t seed) : state(seed) {}
+
+	uint32_t next() {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	uint32_t state;
+};
+
+void fillPixels(char* pixels, size_t pixelCount, size_t pixelSize, Content content) {
+
+	Random random(2463534242u);
+	char color[4] = { 0x12, 0x34, 0x56, 0x78 };
+	size_t runLeft = 0;
+
+	for (size_t i = 0; i < pixelCount; i++) {
+		if (content == CONTENT_NOISE || (content == CONTENT_RUNS && runLeft == 0)) {
+			uint32_t value = random.next();
+			memcpy(color, &value, sizeof(color));
+			runLeft = 1 + random.next() % 64;
+		}
+
+		memcpy(&pixels[i * pixelSize], color, pixelSize);
+		runLeft--;
+	}
+}
+
+gw::tga::TGAImage createImage(const BenchConfig &config, const ImageKind &kind, Content content) {
+
+	gw::tga::TGAImage image;
+	image.width = config.width;
+	image.height = config.height;
+	image.bitsPerPixel = kind.bitsPerPixel;
+	image.attributeBitsPerPixel = kind.attributeBitsPerPixel;
+	image.colorType = kind.colorType;
+	image.origin = gw::tga::GWTGA_TOP_LEFT;
+
+	size_t pixelCount = (size_t) image.width * image.height;
+	image.bytes = new char[pixelCount * (kind.bitsPerPixel / 8)];
+	fillPixels(image.bytes, pixelCount, kind.bitsPerPixel / 8, content);
+
+	if (kind.colorMapBitsPerPixel > 0) {
+		image.colorMap.length = 256;
+		image.colorMap.bitsPerPixel = kind.colorMapBitsPerPixel;
+		image.colorMap.bytes = new char[image.colorMap.length * (kind.colorMapBitsPerPixel / 8)];
+		fillPixels(image.colorMap.bytes, image.colorMap.length, kind.colorMapBitsPerPixel / 8, CONTENT_NOISE);
+	}
+
+	return image;
+}
+
+bool runOperation(Operation operation, const BenchConfig &config, const gw::tga::TGAImage &image, const std::string &file, gw::tga::TGAOptions loadOptions, gw::tga::TGAOptions saveOptions) {
+
+	switch (operation) {
+	case LOAD_MEMORY:
+	case LOAD_FILE: {
+		gw::tga::TGAImagePtr loaded(operation == LOAD_MEMORY ? gw::tga::LoadTga(file.data(), file.size(), loadOptions) : gw::tga::LoadTga((char*) config.tempFileName.c_str(), loadOptions));
+		return !loaded->hasError();
+	}
+	case SAVE_MEMORY: {
+		std::ostringstream stream;
+		return gw::tga::SaveTga(stream, image, saveOptions) == gw::tga::GWTGA_NONE;
+	}
+	case SAVE_FILE:
+		return gw::tga::SaveTga((char*) config.tempFileName.c_str(), image, saveOptions) == gw::tga::GWTGA_NONE;
+	}
+
+	return false;
+}
+
+// Returns the best time of all iterations in seconds, negative on error
+double measure(Operation operation, const BenchConfig &config, const gw::tga::TGAImage &image, const std::string &file, gw::tga::TGAOptions loadOptions, gw::tga::TGAOptions saveOptions) {
+
+	double best = -1.0;
+
+	for (unsigned int i = 0; i < config.iterations; i++) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		if (!runOperation(operation, config, image, file, loadOptions, saveOptions)) {
+			return -1.0;
+		}
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		if (best < 0.0 || seconds < best) {
+			best = seconds;
+		}
+	}
+
+	return best;
+}
+
+void printRecord(const BenchConfig &config, bool first, const ImageKind &kind, const char* flip, Content content, Operation operation, size_t fileSize, size_t imageSize, double seconds) {
+
+	double pixels = (double) config.width * config.height;
+	double megabytesPerSecond = seconds > 0.0 ? imageSize / seconds / (1024.0 * 1024.0) : 0.0;
+	double pixelsPerSecond = seconds > 0.0 ? pixels / seconds : 0.0;
+
+	char line[512];
+
+	if (config.json) {
+		snprintf(line, sizeof(line), "%s\n  {\"type\": %d, \"bpp\": %d, \"colorMapBpp\": %d, \"flip\": \"%s\", \"content\": \"%s\", \"operation\": \"%s\", \"source\": \"%s\", "
+			"\"width\": %u, \"height\": %u, \"fileBytes\": %lu, \"imageBytes\": %lu, \"seconds\": %.9f, \"MBps\": %.2f, \"pixelsPerSecond\": %.0f}",
+			first ? "" : ",", kind.imageType, kind.bitsPerPixel, kind.colorMapBitsPerPixel, flip, contentNames[content], operationNames[operation], sourceNames[operation],
+			config.width, config.height, (unsigned long) fileSize, (unsigned long) imageSize, seconds, megabytesPerSecond, pixelsPerSecond);
+	} else {
+		snprintf(line, sizeof(line), "%d,%d,%d,%s,%s,%s,%s,%u,%u,%lu,%lu,%.9f,%.2f,%.0f\n",
+			kind.imageType, kind.bitsPerPixel, kind.colorMapBitsPerPixel, flip, contentNames[content], operationNames[operation], sourceNames[operation],
+			config.width, config.height, (unsigned long) fileSize, (unsigned long) imageSize, seconds, megabytesPerSecond, pixelsPerSecond);
+	}
+
+	std::cout << line;
+}
+
+// Returns the best time of all iterations in seconds and size of saved file, negative time on error
+double measureSave(const BenchConfig &config, const gw::tga::TGAImage &image, gw::tga::TGAOptions options, size_t &fileSize) {
+
+	double best = -1.0;
+
+	for (unsigned int i = 0; i < config.iterations; i++) {
+		std::ostringstream stream;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		if (gw::tga::SaveTga(stream, image, options) != gw::tga::GWTGA_NONE) {
+			return -1.0;
+		}
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		if (best < 0.0 || seconds < best) {
+			best = seconds;
+		}
+
+		fileSize = stream.str().size();
+	}
+
+	return best;
+}
+
+// Saves every file of config with GWTGA_COMPRESS_RLE and GWTGA_COMPRESS_RLE_OPTIMAL, color mapped files keep their indices
+bool compareRLE(const BenchConfig &config) {
+
+	if (config.json) {
+		std::cout << "[";
+	} else {
+		std::cout << "file,bpp,colorMapBpp,width,height,fileBytes,greedyBytes,optimalBytes,savedPercent,greedySeconds,optimalSeconds" << std::endl;
+	}
+
+	bool first = true;
+	bool failed = false;
+
+	for (size_t i = 0; i < config.files.size(); i++) {
+		const std::string &fileName = config.files[i];
+		gw::tga::TGAImagePtr image(gw::tga::LoadTga((char*) fileName.c_str(), gw::tga::GWTGA_RETURN_COLOR_MAP));
+
+		if (image->hasError()) {
+			std::cerr << "Cannot load " << fileName << std::endl;
+			failed = true;
+			continue;
+		}
+
+		std::ifstream file(fileName.c_str(), std::ifstream::in | std::ifstream::binary | std::ifstream::ate);
+		size_t fileSize = (size_t) file.tellg();
+
+		size_t greedySize = 0;
+		size_t optimalSize = 0;
+		double greedySeconds = measureSave(config, *image, gw::tga::GWTGA_COMPRESS_RLE, greedySize);
+		double optimalSeconds = measureSave(config, *image, gw::tga::GWTGA_COMPRESS_RLE_OPTIMAL, optimalSize);
+
+		if (greedySeconds < 0.0 || optimalSeconds < 0.0) {
+			std::cerr << "Cannot save " << fileName << std::endl;
+			failed = true;
+			continue;
+		}
+
+		double savedPercent = greedySize > 0 ? 100.0 * ((double) greedySize - (double) optimalSize) / greedySize : 0.0;
+		char line[1024];
+
+		if (config.json) {
+			snprintf(line, sizeof(line), "%s\n  {\"file\": \"%s\", \"bpp\": %d, \"colorMapBpp\": %d, \"width\": %u, \"height\": %u, \"fileBytes\": %lu, "
+				"\"greedyBytes\": %lu, \"optimalBytes\": %lu, \"savedPercent\": %.3f, \"greedySeconds\": %.9f, \"optimalSeconds\": %.9f}",
+				first ? "" : ",", fileName.c_str(), image->bitsPerPixel, image->colorMap.bitsPerPixel, image->width, image->height, (unsigned long) fileSize,
+				(unsigned long) greedySize, (unsigned long) optimalSize, savedPercent, greedySeconds, optimalSeconds);
+		} else {
+			snprintf(line, sizeof(line), "%s,%d,%d,%u,%u,%lu,%lu,%lu,%.3f,%.9f,%.9f\n",
+				fileName.c_str(), image->bitsPerPixel, image->colorMap.bitsPerPixel, image->width, image->height, (unsigned long) fileSize,
+				(unsigned long) greedySize, (unsigned long) optimalSize, savedPercent, greedySeconds, optimalSeconds);
+		}
+
+		std::cout << line;
+		first = false;
+	}
+
+	if (config.json) {
+		std::cout << "\n]" << std::endl;
+	}
+
+	return !failed;
+}
+
+bool parseArguments(int argc, char *argv[], BenchConfig &config) {
+
+	for (int i = 1; i < argc; i++) {
+		std::string argument = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (argument == "--size" && hasValue) {
+			if (sscanf(argv[++i], "%ux%u", &config.width, &config.height) != 2 || config.width == 0 || config.height == 0 || config.width > 0xFFFF || config.height > 0xFFFF) {
+				return false;
+			}
+		} else if (argument == "--iterations" && hasValue) {
+			config.iterations = (unsigned int) atoi(argv[++i]);
+		} else if (argument == "--format" && hasValue) {
+			std::string format = argv[++i];
+
+			if (format != "csv" && format != "json") {
+				return false;
+			}
+
+			config.json = format == "json";
+		} else if (argument == "--temp" && hasValue) {
+			config.tempFileName = argv[++i];
+		} else if (argument == "--files" && hasValue) {
+			// Files are the rest of arguments
+			for (i++; i < argc; i++) {
+				config.files.push_back(argv[i]);
+			}
+		} else {
+			return false;
+		}
+	}
+
+	return config.iterations > 0;
+}
+
+int main(int argc, char *argv[]) {
+
+	BenchConfig config;
+	config.width = 1024;
+	config.height = 1024;
+	config.iterations = 5;
+	config.json = false;
+	config.tempFileName = "gwTGABench.tga";
+
+	if (!parseArguments(argc, argv, config)) {
+		std::cerr << "Usage: gwTGABench [--size WIDTHxHEIGHT] [--iterations N] [--format csv|json] [--temp FILE] [--files FILE...]" << std::endl;
+		return 1;
+	}
+
+	if (!config.files.empty()) {
+		return compareRLE(config) ? 0 : 1;
+	}
+
+	if (config.json) {
+		std::cout << "[";
+	} else {
+		std::cout << "type,bpp,colorMapBpp,flip,content,operation,source,width,height,fileBytes,imageBytes,seconds,MBps,pixelsPerSecond" << std::endl;
+	}
+
+	bool first = true;
+	bool failed = false;
+
+	for (size_t k = 0; k < sizeof(imageKinds) / sizeof(imageKinds[0]); k++) {
+		const ImageKind &kind = imageKinds[k];
+		bool compressed = kind.imageType >= 9;
+
+		for (int content = CONTENT_FLAT; content <= CONTENT_NOISE; content++) {
+			gw::tga::TGAImagePtr image(createImage(config, kind, (Content) content));
+			size_t imageSize = (size_t) image->width * image->height * (image->bitsPerPixel / 8);
+
+			for (size_t f = 0; f < sizeof(flipOptions) / sizeof(flipOptions[0]); f++) {
+				gw::tga::TGAOptions saveOptions = (gw::tga::TGAOptions) (flipOptions[f] | (compressed ? gw::tga::GWTGA_COMPRESS_RLE : 0));
+
+				// Loaded file is saved without flipping, so that only the loader flips
+				std::ostringstream stream;
+				gw::tga::SaveTga(stream, *image, compressed ? gw::tga::GWTGA_COMPRESS_RLE : gw::tga::GWTGA_OPTIONS_NONE);
+				std::string file = stream.str();
+
+				std::ofstream fileStream(config.tempFileName.c_str(), std::ofstream::out | std::ofstream::binary);
+				fileStream.write(file.data(), file.size());
+				fileStream.close();
+
+				for (int operation = LOAD_MEMORY; operation <= SAVE_FILE; operation++) {
+					double seconds = measure((Operation) operation, config, *image, file, flipOptions[f], saveOptions);
+
+					if (seconds < 0.0) {
+						std::cerr << "Type " << (int) kind.imageType << ", " << (int) kind.bitsPerPixel << " bpp, " << operationNames[operation] << " from " << sourceNames[operation] << " failed" << std::endl;
+						failed = true;
+						continue;
+					}
+
+					printRecord(config, first, kind, flipNames[f], (Content) content, (Operation) operation, file.size(), imageSize, seconds);
+					first = false;
+				}
+			}
+		}
+	}
+
+	if (config.json) {
+		std::cout << "\n]" << std::endl;
+	}
+
+	remove(config.tempFileName.c_str());
+
+	return failed ? 1 : 0;
+}
@@ -1,5 +1,8 @@
 #include "gwTGA.h"
 #include <fstream>  
+#include <sstream>
+#include <cstring>
+#include <cmath>
 
 void printImageInfo(gw::tga::TGAImage img) {
 
@@ -59,17 +62,21 @@ bool cmpArrays(char* a1, size_t n1, char* a2, size_t n2){
 	return true;
 }
 
-bool test(char* testName, char* tgaFileName, char* testFileName) {
+bool printResult(char* testName, bool result) {
 
-	// load tga image
-	gw::tga::TGAImage img = gw::tga::LoadTga(tgaFileName);
+	std::cout << testName;
 
-	if (img.error != gw::tga::GWTGA_NONE) {
-		std::cout << testName << "error! Cannot load image" << std::endl;
-		return false;
+	if (result) {
+		std::cout << "OK" << std::endl;
+	} else {
+		std::cout << "fail!" << std::endl;
 	}
 
-	// load reference file
+	return result;
+}
+
+bool loadReference(char* testName, char* testFileName, std::vector<char> &reference) {
+
 	std::ifstream ifs;
 
 	ifs.open(testFileName, std::ifstream::in | std::ifstream::ate | std::ifstream::binary);
@@ -81,81 +88,839 @@ bool test(char* testName, char* tgaFileName, char* testFileName) {
 
 	size_t testFileSize = ifs.tellg(); 
 
-	char* testImg = new char[testFileSize];
+	reference.resize(testFileSize);
 	ifs.seekg(0, std::ios::beg);
 
-	ifs.read(testImg, testFileSize);
+	ifs.read(&reference[0], testFileSize);
 
 	ifs.close();
 
-	// compare loaded image to reference
-	bool result = cmpArrays(img.bytes, img.width * img.height * (img.bitsPerPixel / 8), testImg, testFileSize);
+	return true;
+}
 
-	delete[] testImg;
+bool cmpToReference(char* testName, const gw::tga::TGAImage &img, char* testFileName) {
+
+	if (img.error != gw::tga::GWTGA_NONE) {
+		std::cout << testName << "error! Cannot load image" << std::endl;
+		return false;
+	}
+
+	// load reference file
+	std::vector<char> testImg;
+
+	if (!loadReference(testName, testFileName, testImg)) {
+		return false;
+	}
+
+	// compare loaded image to reference
+	bool result = cmpArrays(img.bytes, img.width * img.height * (img.bitsPerPixel / 8), &testImg[0], testImg.size());
 
 	// print result
-	std::cout << testName;
+	return printResult(testName, result);
+}
 
-	if (result) {
-		std::cout << "OK" << std::endl;
+bool sameImages(const gw::tga::TGAImage &img, const gw::tga::TGAImage &reference) {
+
+	if (img.hasError() || reference.hasError() || img.width != reference.width || img.height != reference.height || img.bitsPerPixel != reference.bitsPerPixel) {
+		return false;
+	}
+
+	return memcmp(img.bytes, reference.bytes, (size_t) img.width * img.height * (img.bitsPerPixel / 8)) == 0;
+}
+
+// Repeats image columns x rows times, pixels of returned image are allocated with new[]
+gw::tga::TGAImage tileImage(const gw::tga::TGAImage &img, unsigned int columns, unsigned int rows) {
+
+	gw::tga::TGAImage tiled;
+	tiled.width = img.width * columns;
+	tiled.height = img.height * rows;
+	tiled.bitsPerPixel = img.bitsPerPixel;
+	tiled.attributeBitsPerPixel = img.attributeBitsPerPixel;
+	tiled.colorType = img.colorType;
+	tiled.origin = gw::tga::GWTGA_TOP_LEFT;
+
+	size_t rowSize = (size_t) img.width * (img.bitsPerPixel / 8);
+	tiled.bytes = new char[rowSize * columns * tiled.height];
+
+	for (size_t y = 0; y < tiled.height; y++) {
+		for (size_t x = 0; x < columns; x++) {
+			memcpy(&tiled.bytes[(y * columns + x) * rowSize], &img.bytes[(y % img.height) * rowSize], rowSize);
+		}
+	}
+
+	return tiled;
+}
+
+bool test(char* testName, char* tgaFileName, char* testFileName) {
+
+	// load tga image
+	gw::tga::TGAImagePtr img(gw::tga::LoadTga(tgaFileName));
+
+	return cmpToReference(testName, *img, testFileName);
+}
+
+bool testMapped(char* testName, char* tgaFileName, char* testFileName) {
+
+	// load tga image from memory mapped file, mapping has to stay open while image is used
+	gw::tga::TGAFileMapping mapping;
+	mapping.open(tgaFileName);
+
+	gw::tga::TGAImage img = gw::tga::LoadTga(mapping);
+
+	bool result = cmpToReference(testName, img, testFileName);
+
+	// only pixels which were decoded are owned by the image
+	if (!mapping.contains(img.bytes)) {
+		delete[] img.bytes;
+	}
+
+	return result;
+}
+
+bool testConverted(char* testName, char* tgaFileName, char* testFileName, gw::tga::TGAOptions options) {
+
+	// reference pixels (greyscale, BGR or BGRA) are swizzled to requested layout, alpha of pixels without it is opaque
+	std::vector<char> reference;
+
+	if (!loadReference(testName, testFileName, reference)) {
+		return false;
+	}
+
+	size_t inputSize = gw::tga::ProbeTga(tgaFileName).decodedBitsPerPixel(gw::tga::GWTGA_OPTIONS_NONE) / 8;
+	size_t outputSize = (options & gw::tga::GWTGA_OUTPUT_RGB8) ? 3 : 4;
+	bool swapRedBlue = (options & gw::tga::GWTGA_OUTPUT_BGRA8) == 0;
+
+	std::vector<char> expected(reference.size() / inputSize * outputSize);
+
+	for (size_t i = 0; i < reference.size() / inputSize; i++) {
+		const char* pixel = &reference[i * inputSize];
+		char* target = &expected[i * outputSize];
+
+		char b = pixel[0];
+		char g = inputSize >= 3 ? pixel[1] : pixel[0];
+		char r = inputSize >= 3 ? pixel[2] : pixel[0];
+
+		target[0] = swapRedBlue ? r : b;
+		target[1] = g;
+		target[2] = swapRedBlue ? b : r;
+
+		if (outputSize == 4) {
+			target[3] = inputSize == 4 ? pixel[3] : (char) 255;
+		}
+	}
+
+	gw::tga::TGAImagePtr img(gw::tga::LoadTga(tgaFileName, options));
+
+	if (img->hasError()) {
+		std::cout << testName << "error! Cannot load image" << std::endl;
+		return false;
+	}
+
+	return printResult(testName, cmpArrays(img->bytes, img->width * img->height * (img->bitsPerPixel / 8), &expected[0], expected.size()));
+}
+
+double sRGBToLinear(double value) {
+	return value <= 0.04045 ? value / 12.92 : pow((value + 0.055) / 1.055, 2.4);
+}
+
+double linearToSRGB(double value) {
+	return value <= 0.0031308 ? value * 12.92 : 1.055 * pow(value, 1.0 / 2.4) - 0.055;
+}
+
+bool testMipmaps(char* testName, char* tgaFileName, char* testFileName, gw::tga::TGAOptions options) {
+
+	// mip levels are stored behind the image, so the largest level matches the reference. Every next level is 2x2 box 
+	// filter of previous one (image is 512x512, sizes of all levels are even).
+	gw::tga::TGAImagePtr img(gw::tga::LoadTga(tgaFileName, options));
+	std::vector<char> reference;
+
+	if (img->hasError()) {
+		std::cout << testName << "error! Cannot load image" << std::endl;
+		return false;
+	}
+
+	if (!loadReference(testName, testFileName, reference)) {
+		return false;
+	}
+
+	// color channels of sRGB mipmaps are averaged in linear space, loader uses fixed point tables which may round differently
+	bool sRGB = (options & gw::tga::GWTGA_MIPMAPS_SRGB) != 0;
+	int tolerance = sRGB ? 1 : 0;
+
+	size_t pixelSize = img->bitsPerPixel / 8;
+	size_t alphaChannel = pixelSize == 2 || pixelSize == 4 ? pixelSize - 1 : pixelSize;
+
+	bool result = img->mipLevels == 10 && cmpArrays(img->bytes, img->width * img->height * pixelSize, &reference[0], reference.size());
+
+	const unsigned char* source = (const unsigned char*) &reference[0];
+
+	for (unsigned int level = 1; level < img->mipLevels && result; level++) {
+		size_t sourceRowSize = img->mipWidth(level - 1) * pixelSize;
+		const unsigned char* target = (const unsigned char*) &img->bytes[img->mipOffset(level)];
+
+		for (size_t y = 0; y < img->mipHeight(level); y++) {
+			for (size_t x = 0; x < img->mipWidth(level) * pixelSize; x++) {
+				size_t channel = x % pixelSize;
+				const unsigned char* block = &source[2 * y * sourceRowSize + 2 * (x - channel) + channel];
+				unsigned int values[] = { block[0], block[pixelSize], block[sourceRowSize], block[sourceRowSize + pixelSize] };
+
+				int expected = (values[0] + values[1] + values[2] + values[3] + 2) >> 2;
+
+				if (sRGB && channel != alphaChannel) {
+					double linear = 0.0;
+
+					for (size_t i = 0; i < 4; i++) {
+						linear += sRGBToLinear(values[i] / 255.0) / 4.0;
+					}
+
+					expected = (int) (linearToSRGB(linear) * 255.0 + 0.5);
+				}
+
+				int difference = target[y * img->mipWidth(level) * pixelSize + x] - expected;
+				result = result && difference <= tolerance && difference >= -tolerance;
+			}
+		}
+
+		source = target;
+	}
+
+	return printResult(testName, result);
+}
+
+bool cmpRegionToReference(const gw::tga::TGAImage &img, const std::vector<char> &reference, unsigned int x, unsigned int y, unsigned int width, unsigned int height, gw::tga::TGAOptions options) {
+
+	if (img.hasError() || img.width != width || img.height != height) {
+		return false;
+	}
+
+	// region is given in coordinates of flipped image, reference is stored as loaded without options
+	unsigned int imgWidth = 512;
+	unsigned int imgHeight = 512;
+	size_t pixelSize = img.bitsPerPixel / 8;
+
+	for (unsigned int row = 0; row < height; row++) {
+		for (unsigned int column = 0; column < width; column++) {
+			size_t referenceX = (options & gw::tga::GWTGA_FLIP_HORIZONTALLY) ? imgWidth - 1 - (x + column) : x + column;
+			size_t referenceY = (options & gw::tga::GWTGA_FLIP_VERTICALLY) ? imgHeight - 1 - (y + row) : y + row;
+
+			if (memcmp(&img.bytes[((size_t) row * width + column) * pixelSize], &reference[(referenceY * imgWidth + referenceX) * pixelSize], pixelSize) != 0) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool testRegion(char* testName, char* tgaFileName, char* testFileName) {
+
+	// crops of 512x512 reference, image is loaded from file and from memory with scan line table
+	std::vector<char> reference;
+
+	if (!loadReference(testName, testFileName, reference)) {
+		return false;
+	}
+
+	gw::tga::TGAImagePtr img(gw::tga::LoadTga(tgaFileName));
+	std::ostringstream stream;
+	gw::tga::SaveTga(stream, *img, (gw::tga::TGAOptions) (gw::tga::GWTGA_COMPRESS_RLE | gw::tga::GWTGA_SCAN_LINE_TABLE));
+	std::string file = stream.str();
+
+	gw::tga::TGAOptions flips = (gw::tga::TGAOptions) (gw::tga::GWTGA_FLIP_HORIZONTALLY | gw::tga::GWTGA_FLIP_VERTICALLY);
+
+	gw::tga::TGAImagePtr region(gw::tga::LoadTgaRegion(tgaFileName, 37, 101, 200, 150));
+	bool result = cmpRegionToReference(*region, reference, 37, 101, 200, 150, gw::tga::GWTGA_OPTIONS_NONE);
+
+	region = gw::tga::TGAImagePtr(gw::tga::LoadTgaRegion(tgaFileName, 300, 5, 212, 64, flips));
+	result = result && cmpRegionToReference(*region, reference, 300, 5, 212, 64, flips);
+
+	region = gw::tga::TGAImagePtr(gw::tga::LoadTgaRegion(file.data(), file.size(), 0, 250, 512, 200));
+	result = result && cmpRegionToReference(*region, reference, 0, 250, 512, 200, gw::tga::GWTGA_OPTIONS_NONE);
+
+	region = gw::tga::TGAImagePtr(gw::tga::LoadTgaRegion(file.data(), file.size(), 411, 311, 101, 201, gw::tga::GWTGA_FLIP_VERTICALLY));
+	result = result && cmpRegionToReference(*region, reference, 411, 311, 101, 201, gw::tga::GWTGA_FLIP_VERTICALLY);
+
+	// empty regions and regions reaching outside of image are rejected
+	region = gw::tga::TGAImagePtr(gw::tga::LoadTgaRegion(tgaFileName, 10, 10, 0, 10));
+	result = result && region->error == gw::tga::GWTGA_INVALID_DATA;
+
+	region = gw::tga::TGAImagePtr(gw::tga::LoadTgaRegion(tgaFileName, 10, 10, 10, 0));
+	result = result && region->error == gw::tga::GWTGA_INVALID_DATA;
+
+	region = gw::tga::TGAImagePtr(gw::tga::LoadTgaRegion(tgaFileName, 500, 10, 13, 10));
+	result = result && region->error == gw::tga::GWTGA_INVALID_DATA;
+
+	region = gw::tga::TGAImagePtr(gw::tga::LoadTgaRegion(file.data(), file.size(), 0, 0xFFFFFFFF, 10, 2));
+	result = result && region->error == gw::tga::GWTGA_INVALID_DATA;
+
+	return printResult(testName, result);
+}
+
+bool testFlipped(char* testName, char* tgaFileName, char* testFileName, gw::tga::TGAOptions options) {
+
+	// whole flipped image is compared as region of mirrored reference
+	std::vector<char> reference;
+
+	if (!loadReference(testName, testFileName, reference)) {
+		return false;
+	}
+
+	gw::tga::TGAImagePtr img(gw::tga::LoadTga(tgaFileName, options));
+
+	return printResult(testName, cmpRegionToReference(*img, reference, 0, 0, 512, 512, options));
+}
+
+bool testReader(char* testName, char* tgaFileName, char* testFileName) {
+
+	// decode image few rows at a time, rows are collected to compare them with reference
+	gw::tga::TGAReader reader;
+
+	if (reader.open(tgaFileName, gw::tga::GWTGA_OPTIONS_NONE) != gw::tga::GWTGA_NONE) {
+		std::cout << testName << "error! Cannot open image" << std::endl;
+		return false;
+	}
+
+	gw::tga::TGAImage img;
+	img.width = reader.info().width;
+	img.height = reader.info().height;
+	img.bitsPerPixel = reader.bitsPerPixel();
+	img.bytes = new char[reader.rowSize() * img.height];
+
+	while (reader.readRows(&img.bytes[reader.rowsRead() * reader.rowSize()], 16) > 0);
+
+	img.error = reader.error();
+
+	bool result = cmpToReference(testName, img, testFileName);
+
+	delete[] img.bytes;
+
+	return result;
+}
+
+bool testWriter(char* testName, char* tgaFileName, char* testFileName) {
+
+	// encode image few rows at a time, written file is loaded again to compare it with reference
+	gw::tga::TGAImage img = gw::tga::LoadTga(tgaFileName);
+	gw::tga::TGAWriter writer;
+
+	// rows cannot be written bottom up, rejected writer stays closed and does not leave file behind
+	gw::tga::TGAError rejected = writer.open("test_writer_rejected.tga", img, gw::tga::GWTGA_FLIP_VERTICALLY);
+
+	if (rejected != gw::tga::GWTGA_INVALID_DATA || writer.error() != rejected || writer.isOpen() || writer.finished() || writer.close() != gw::tga::GWTGA_NONE 
+		|| std::ifstream("test_writer_rejected.tga").good()) {
+		std::cout << testName << "error! Invalid writer was opened" << std::endl;
+		delete[] img.bytes;
+		return false;
+	}
+
+	if (writer.open("test_writer.tga", img, gw::tga::GWTGA_COMPRESS_RLE) != gw::tga::GWTGA_NONE) {
+		std::cout << testName << "error! Cannot open file" << std::endl;
+		delete[] img.bytes;
+		return false;
+	}
+
+	while (!writer.finished()) {
+		unsigned int rowCount = img.height - writer.rowsWritten() < 16 ? img.height - writer.rowsWritten() : 16;
+
+		if (writer.writeRows(&img.bytes[writer.rowsWritten() * writer.rowSize()], rowCount) != gw::tga::GWTGA_NONE) {
+			break;
+		}
+	}
+
+	gw::tga::TGAError err = writer.close();
+
+	delete[] img.bytes;
+
+	img = gw::tga::LoadTga("test_writer.tga");
+
+	if (err != gw::tga::GWTGA_NONE) {
+		img.error = err;
+	}
+
+	bool result = cmpToReference(testName, img, testFileName);
+
+	delete[] img.bytes;
+
+	return result;
+}
+
+bool testBatch(char* testName, char** tgaFileNames, char** testFileNames, size_t count) {
+
+	// load all images at once on thread pool, results are in order of file names
+	std::vector<gw::tga::TGAImage> images(count);
+	gw::tga::LoadTgaBatch(tgaFileNames, count, &images[0], gw::tga::GWTGA_OPTIONS_NONE);
+
+	bool result = true;
+
+	for (size_t i = 0; i < count; i++) {
+		result = cmpToReference(testName, images[i], testFileNames[i]) && result;
+		delete[] images[i].bytes;
+	}
+
+	return result;
+}
+
+bool testParallelEncode(char* testName, char* tgaFileName) {
+
+	// tiled image is large enough to be compressed in parallel, saved files have to be valid and decode to the same image
+	gw::tga::TGAImagePtr img(gw::tga::LoadTga(tgaFileName));
+	gw::tga::TGAImagePtr large(tileImage(*img, 3, 2));
+
+	gw::tga::TGAOptions options[] = { gw::tga::GWTGA_PARALLEL_ENCODE, gw::tga::GWTGA_SCAN_LINE_TABLE,
+		(gw::tga::TGAOptions) (gw::tga::GWTGA_PARALLEL_ENCODE | gw::tga::GWTGA_SCAN_LINE_TABLE),
+		(gw::tga::TGAOptions) (gw::tga::GWTGA_PARALLEL_ENCODE | gw::tga::GWTGA_SCAN_LINE_TABLE | gw::tga::GWTGA_COMPRESS_RLE_OPTIMAL) };
+
+	// several threads are needed even on single core machine
+	gw::tga::SetTgaThreadCount(4);
+
+	bool result = true;
+
+	for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+		std::ostringstream stream;
+		gw::tga::TGAError err = gw::tga::SaveTga(stream, *large, (gw::tga::TGAOptions) (options[i] | gw::tga::GWTGA_COMPRESS_RLE));
+
+		std::string file = stream.str();
+		gw::tga::TGAImagePtr saved(gw::tga::LoadTga(file.data(), file.size()));
+
+		// scan line table is referenced from extension area and checked by validation
+		bool hasTable = gw::tga::ProbeTga(file.data(), file.size()).extensionOffset != 0;
+
+		result = result && err == gw::tga::GWTGA_NONE && hasTable == ((options[i] & gw::tga::GWTGA_SCAN_LINE_TABLE) != 0)
+			&& !gw::tga::ValidateTga(file.data(), file.size()).hasError() && sameImages(*saved, *large);
+	}
+
+	gw::tga::SetTgaThreadCount(0);
+
+	return printResult(testName, result);
+}
+
+#ifdef GWTGA_STATS
+bool cmpStatsToImage(const gw::tga::TGAStats &stats, const gw::tga::TGAImageInfo &info) {
+
+	// pixels of image are covered by packets whose size adds up to pixel data behind header and color map
+	uint64_t pixelSize = info.bitsPerPixel / 8;
+	uint64_t packetsSize = stats.rlePackets * (1 + pixelSize) + stats.rawPackets + stats.rawPixels * pixelSize;
+
+	return stats.images == 1 && stats.rlePixels + stats.rawPixels == (uint64_t) info.width * info.height && stats.rlePackets > 0 && stats.rawPackets > 0
+		&& stats.bytesRead + stats.bytesWritten == info.pixelDataOffset + packetsSize && stats.pixelSeconds > 0.0;
+}
+
+bool testStats(char* testName, char* tgaFileName, char* testFileName) {
+
+	// counters of load from file, save and loads of saved file from memory and stream have to describe the same packets
+	gw::tga::TGAStats loadStats;
+	gw::tga::SetTgaStats(&loadStats);
+	gw::tga::TGAImagePtr img(gw::tga::LoadTga(tgaFileName));
+	gw::tga::SetTgaStats(NULL);
+
+	gw::tga::TGAStats saveStats;
+	std::ostringstream stream;
+	gw::tga::SetTgaStats(&saveStats);
+	gw::tga::SaveTga(stream, *img, gw::tga::GWTGA_COMPRESS_RLE);
+	gw::tga::SetTgaStats(NULL);
+
+	std::string file = stream.str();
+	std::istringstream input(file);
+
+	gw::tga::TGAStats memoryStats;
+	gw::tga::TGAStats streamStats;
+	gw::tga::SetTgaStats(&memoryStats);
+	gw::tga::TGAImagePtr saved(gw::tga::LoadTga(file.data(), file.size()));
+	gw::tga::SetTgaStats(&streamStats);
+	gw::tga::TGAImagePtr streamed(gw::tga::LoadTga(input));
+	gw::tga::SetTgaStats(NULL);
+
+	gw::tga::TGAImageInfo info = gw::tga::ProbeTga(file.data(), file.size());
+
+	bool result = cmpStatsToImage(loadStats, gw::tga::ProbeTga(tgaFileName)) && cmpStatsToImage(saveStats, info) && cmpStatsToImage(memoryStats, info) 
+		&& cmpStatsToImage(streamStats, info) && saveStats.bytesWritten == file.size() && memoryStats.bytesWritten == 0
+		&& memoryStats.rlePackets == saveStats.rlePackets && memoryStats.rawPackets == saveStats.rawPackets && memoryStats.rlePixels == saveStats.rlePixels
+		&& streamStats.rlePackets == saveStats.rlePackets && streamStats.rawPackets == saveStats.rawPackets && streamStats.rlePixels == saveStats.rlePixels;
+
+	if (!result) {
+		std::cout << testName << "fail!" << std::endl;
+		return false;
+	}
+
+	return cmpToReference(testName, *saved, testFileName);
+}
+#endif
+
+bool testFlippedRLE(char* testName, char* tgaFileName, char* testFileName) {
+
+	// image is saved flipped both ways, loading with the same flips gives the original back. Pixels are compared 
+	// backwards when compressing flipped rows. Images without reference file (16-bit) are compared with original only.
+	gw::tga::TGAOptions flips = (gw::tga::TGAOptions) (gw::tga::GWTGA_FLIP_HORIZONTALLY | gw::tga::GWTGA_FLIP_VERTICALLY);
+
+	gw::tga::TGAImagePtr img(gw::tga::LoadTga(tgaFileName));
+	std::ostringstream stream;
+	gw::tga::TGAError err = gw::tga::SaveTga(stream, *img, (gw::tga::TGAOptions) (flips | gw::tga::GWTGA_COMPRESS_RLE));
+
+	std::string file = stream.str();
+	gw::tga::TGAImage saved = gw::tga::LoadTga(file.data(), file.size(), flips);
+
+	if (err != gw::tga::GWTGA_NONE) {
+		saved.error = err;
+	}
+
+	bool result = sameImages(saved, *img);
+
+	if (!result || testFileName == NULL) {
+		printResult(testName, result);
 	} else {
-		std::cout << "fail!" << std::endl;
+		result = cmpToReference(testName, saved, testFileName);
 	}
 
+	delete[] saved.bytes;
+
 	return result;
 }
 
+bool testPool(char* testName, char* tgaFileName, char* testFileName) {
+
+	// load image twice with pooled memory, second load has to reuse memory released by the first image
+	gw::tga::TGAPoolListener pool;
+
+	gw::tga::TGAImagePtr img(gw::tga::LoadTga(tgaFileName, &pool), &pool);
+	char* firstBytes = img->bytes;
+	img.reset();
+
+	img = gw::tga::TGAImagePtr(gw::tga::LoadTga(tgaFileName, &pool), &pool);
+
+	if (img->bytes != firstBytes || ((size_t) img->bytes % gw::tga::TGAPoolListener::alignment) != 0) {
+		std::cout << testName << "error! Memory was not reused" << std::endl;
+		return false;
+	}
+
+	return cmpToReference(testName, *img, testFileName);
+}
+
+bool testValidate(char* testName, char* tgaFileName, char* testFileName) {
+
+	// validate whole file, then its first half
+	gw::tga::TGAFileMapping mapping;
+	mapping.open(tgaFileName);
+
+	gw::tga::TGAValidation validation = gw::tga::ValidateTga(mapping);
+	gw::tga::TGAValidation truncated = gw::tga::ValidateTga(mapping.data(), mapping.size() / 2);
+
+	if (validation.hasError() || truncated.issue != gw::tga::GWTGA_TRUNCATED_PIXEL_DATA) {
+		std::cout << testName << "error! Validation failed" << std::endl;
+		return false;
+	}
+
+	gw::tga::TGAImagePtr img(gw::tga::LoadTga(mapping, gw::tga::GWTGA_PARALLEL_DECODE));
+
+	return cmpToReference(testName, *img, testFileName);
+}
+
+bool testOptimalRLE(char* testName, char* tgaFileName, char* testFileName) {
+
+	// size optimal packets must not be larger than greedy ones and decode to the same image
+	gw::tga::TGAImage img = gw::tga::LoadTga(tgaFileName);
+	std::ostringstream greedy;
+	std::ostringstream optimal;
+
+	gw::tga::SaveTga(greedy, img, gw::tga::GWTGA_COMPRESS_RLE);
+	gw::tga::TGAError err = gw::tga::SaveTga(optimal, img, gw::tga::GWTGA_COMPRESS_RLE_OPTIMAL);
+
+	delete[] img.bytes;
+
+	std::string file = optimal.str();
+	img = gw::tga::LoadTga(file.data(), file.size());
+
+	if (err != gw::tga::GWTGA_NONE) {
+		img.error = err;
+	} else if (file.size() > greedy.str().size()) {
+		img.error = gw::tga::GWTGA_INVALID_DATA;
+	}
+
+	bool result = cmpToReference(testName, img, testFileName);
+
+	delete[] img.bytes;
+
+	return result;
+}
+
+bool testMemory(char* testName, char* tgaFileName, char* testFileName) {
+
+	// read whole tga file to memory and decode image from there
+	std::ifstream ifs;
+
+	ifs.open(tgaFileName, std::ifstream::in | std::ifstream::ate | std::ifstream::binary);
+
+	if (ifs.fail()) {
+		std::cout << testName << "error! Cannot load image" << std::endl;
+		return false;
+	}
+
+	size_t tgaFileSize = ifs.tellg(); 
+
+	char* tgaFile = new char[tgaFileSize];
+	ifs.seekg(0, std::ios::beg);
+
+	ifs.read(tgaFile, tgaFileSize);
+
+	ifs.close();
+
+	gw::tga::TGAImagePtr img(gw::tga::LoadTga((const void*) tgaFile, tgaFileSize));
+
+	delete[] tgaFile;
+
+	return cmpToReference(testName, *img, testFileName);
+}
+
+// Stream buffer which cannot seek, like pipe or socket
+class PipeBuffer : public std::streambuf {
+public:
+	PipeBuffer(const std::string &data) : data(data) {
+		char* begin = const_cast<char*>(this->data.data());
+		setg(begin, begin, begin + this->data.size());
+	}
+
+private:
+	std::string data;
+};
+
+bool testPipe(char* testName, char* tgaFileName, char* rleFileName, char* testFileName) {
+
+	// two uncompressed files follow each other in non-seekable stream, stream stays right behind pixel data of the first one
+	std::ifstream ifs(tgaFileName, std::ifstream::in | std::ifstream::binary);
+	std::ifstream rleIfs(rleFileName, std::ifstream::in | std::ifstream::binary);
+	std::ostringstream file;
+	std::ostringstream rleFile;
+	file << ifs.rdbuf();
+	rleFile << rleIfs.rdbuf();
+
+	PipeBuffer buffer(file.str() + file.str());
+	std::istream stream(&buffer);
+
+	gw::tga::TGAImagePtr first(gw::tga::LoadTga(stream));
+
+	// footer of the first file is not read by loader
+	char footer[gw::tga::details::TGA_FOOTER_SIZE];
+	stream.read(footer, sizeof(footer));
+	bool footerFound = stream.good() && file.str().compare(file.str().size() - sizeof(footer), sizeof(footer), footer, sizeof(footer)) == 0;
+
+	gw::tga::TGAImagePtr second(gw::tga::LoadTga(stream));
+
+	// RLE packets are read ahead, lost position has to be visible
+	PipeBuffer rleBuffer(rleFile.str() + file.str());
+	std::istream rleStream(&rleBuffer);
+
+	gw::tga::TGAImagePtr rle(gw::tga::LoadTga(rleStream));
+
+	if (!footerFound || !sameImages(*first, *second) || rle->hasError() || !rleStream.fail()) {
+		std::cout << testName << "fail!" << std::endl;
+		return false;
+	}
+
+	return cmpToReference(testName, *second, testFileName);
+}
+
+bool testProbe(char* testName, char** tgaFileNames, size_t count) {
+
+	// metadata of probed files has to describe images returned by LoadTga, files are probed one by one and as a batch
+	std::vector<gw::tga::TGAImageInfo> batchInfos(count);
+	gw::tga::ProbeTga(tgaFileNames, count, &batchInfos[0], 0);
+
+	gw::tga::TGAOptions options[] = { gw::tga::GWTGA_OPTIONS_NONE, gw::tga::GWTGA_RETURN_COLOR_MAP, gw::tga::GWTGA_OUTPUT_RGBA8,
+		(gw::tga::TGAOptions) (gw::tga::GWTGA_OUTPUT_RGB8 | gw::tga::GWTGA_GENERATE_MIPMAPS) };
+
+	bool result = true;
+
+	for (size_t i = 0; i < count; i++) {
+		gw::tga::TGAImageInfo info = gw::tga::ProbeTga(tgaFileNames[i]);
+		const gw::tga::TGAImageInfo &batchInfo = batchInfos[i];
+
+		result = result && !info.hasError() && !batchInfo.hasError() && info.width == batchInfo.width && info.height == batchInfo.height
+			&& info.bitsPerPixel == batchInfo.bitsPerPixel && info.pixelDataOffset == batchInfo.pixelDataOffset;
+
+		for (size_t j = 0; j < sizeof(options) / sizeof(options[0]); j++) {
+			gw::tga::TGAImagePtr img(gw::tga::LoadTga(tgaFileNames[i], options[j]));
+
+			// size of image and its mip levels, mipLevels is 1 without mipmaps
+			size_t size = img->mipOffset(img->mipLevels);
+
+			result = result && !img->hasError() && info.width == img->width && info.height == img->height
+				&& info.decodedBitsPerPixel(options[j]) == img->bitsPerPixel && info.decodedSize(options[j]) == size;
+		}
+	}
+
+	return printResult(testName, result);
+}
+
+bool testParallelDecode(char* testName, char* tgaFileName) {
+
+	// tiled image is large enough to be decoded in parallel, bands decoded on threads have to match sequential decoding
+	gw::tga::TGAImagePtr img(gw::tga::LoadTga(tgaFileName));
+	gw::tga::TGAImagePtr large(tileImage(*img, 3, 2));
+
+	// flat part of image is compressed to packets which cross rows and borders of bands
+	size_t rowSize = (size_t) large->width * (large->bitsPerPixel / 8);
+	memset(&large->bytes[rowSize * 300 + 7], 0x40, rowSize * 100);
+
+	std::ostringstream plain;
+	std::ostringstream table;
+	gw::tga::SaveTga(plain, *large, gw::tga::GWTGA_COMPRESS_RLE);
+	gw::tga::SaveTga(table, *large, (gw::tga::TGAOptions) (gw::tga::GWTGA_COMPRESS_RLE | gw::tga::GWTGA_SCAN_LINE_TABLE));
+
+	// damaged copies of scan line table, rows pointing behind their beginning and rows outside of file
+	std::string files[] = { plain.str(), table.str(), table.str(), table.str() };
+
+	gw::tga::TGAImageInfo info = gw::tga::ProbeTga(files[1].data(), files[1].size());
+	size_t tableOffset = gw::tga::details::readUInt32(&files[1][info.extensionOffset + gw::tga::details::TGA_EXTENSION_SCAN_LINE_OFFSET]);
+
+	for (size_t y = 1; y < large->height; y++) {
+		char* row = &files[2][tableOffset + 4 * y];
+		gw::tga::details::writeUInt32(row, gw::tga::details::readUInt32(row) + 1);
+		gw::tga::details::writeUInt32(&files[3][tableOffset + 4 * y], 0xFFFFFFFF);
+	}
+
+	gw::tga::TGAOptions flips[] = { gw::tga::GWTGA_OPTIONS_NONE, gw::tga::GWTGA_FLIP_HORIZONTALLY, gw::tga::GWTGA_FLIP_VERTICALLY,
+		(gw::tga::TGAOptions) (gw::tga::GWTGA_FLIP_HORIZONTALLY | gw::tga::GWTGA_FLIP_VERTICALLY) };
+
+	// several threads are needed even on single core machine
+	gw::tga::SetTgaThreadCount(4);
+
+	bool result = tableOffset != 0;
+
+	for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+		for (size_t j = 0; j < sizeof(flips) / sizeof(flips[0]); j++) {
+			gw::tga::TGAImagePtr sequential(gw::tga::LoadTga(files[i].data(), files[i].size(), flips[j]));
+			gw::tga::TGAImagePtr parallel(gw::tga::LoadTga(files[i].data(), files[i].size(), (gw::tga::TGAOptions) (flips[j] | gw::tga::GWTGA_PARALLEL_DECODE)));
+
+			result = result && sameImages(*parallel, *sequential) && (flips[j] != gw::tga::GWTGA_OPTIONS_NONE || sameImages(*sequential, *large));
+		}
+	}
+
+	gw::tga::SetTgaThreadCount(0);
+
+	return printResult(testName, result);
+}
+
 int main(int argc, char *argv[]) {
 
-	test("Testing 8-bit greyscale image uncompressed...", "test_images\\mandrill_8.tga", "test_images\\mandrill_8.tga.test");
-	test("Testing 8-bit greyscale RLE compressed image...", "test_images\\mandrill_8rle.tga", "test_images\\mandrill_8rle.tga.test");
-	test("Testing 8-bit greyscale image with 8 bit palette...", "test_images\\mandrill_8_palette8.tga", "test_images\\mandrill_8_palette8.tga.test");
-	test("Testing 8-bit greyscale image with 8 bit palette RLE compressed...", "test_images\\mandrill_8rle_palette8.tga", "test_images\\mandrill_8rle_palette8.tga.test");
+	test("Testing 8-bit greyscale image uncompressed...", "test_images/mandrill_8.tga", "test_images/mandrill_8.tga.test");
+	test("Testing 8-bit greyscale RLE compressed image...", "test_images/mandrill_8rle.tga", "test_images/mandrill_8rle.tga.test");
+	test("Testing 8-bit greyscale image with 8 bit palette...", "test_images/mandrill_8_palette8.tga", "test_images/mandrill_8_palette8.tga.test");
+	test("Testing 8-bit greyscale image with 8 bit palette RLE compressed...", "test_images/mandrill_8rle_palette8.tga", "test_images/mandrill_8rle_palette8.tga.test");
+
+	test("Testing 16-bit RGB image uncompressed...", "test_images/mandrill_16.tga", "test_images/mandrill_16.tga.test");
+	test("Testing 16-bit RGB RLE compressed image...", "test_images/mandrill_16rle.tga", "test_images/mandrill_16rle.tga.test");
+	test("Testing 16-bit RGB image with 8 bit palette...", "test_images/mandrill_16_palette8.tga", "test_images/mandrill_16_palette8.tga.test");
+	test("Testing 16-bit RGB image with 8 bit palette RLE compressed...", "test_images/mandrill_16rle_palette8.tga", "test_images/mandrill_16rle_palette8.tga.test");
+
+	test("Testing 24-bit RGB image uncompressed...", "test_images/mandrill_24.tga", "test_images/mandrill_24.tga.test");
+	test("Testing 24-bit RGB RLE compressed image...", "test_images/mandrill_24rle.tga", "test_images/mandrill_24rle.tga.test");
+	test("Testing 24-bit RGB image with 8 bit palette...", "test_images/mandrill_24_palette8.tga", "test_images/mandrill_24_palette8.tga.test");
+	test("Testing 24-bit RGB image with 8 bit palette RLE compressed...", "test_images/mandrill_24rle_palette8.tga", "test_images/mandrill_24rle_palette8.tga.test");
+
+	test("Testing 32-bit RGB image uncompressed...", "test_images/mandrill_32.tga", "test_images/mandrill_32.tga.test");
+	test("Testing 32-bit RGB RLE compressed image...", "test_images/mandrill_32rle.tga", "test_images/mandrill_32rle.tga.test");
+	test("Testing 32-bit RGB image with 8 bit palette...", "test_images/mandrill_32_palette8.tga", "test_images/mandrill_32_palette8.tga.test");
+	test("Testing 32-bit RGB image with 8 bit palette RLE compressed...", "test_images/mandrill_32rle_palette8.tga", "test_images/mandrill_32rle_palette8.tga.test");
+
+	testMapped("Testing 24-bit RGB image uncompressed, memory mapped...", "test_images/mandrill_24.tga", "test_images/mandrill_24.tga.test");
+	testMapped("Testing 24-bit RGB RLE compressed image, memory mapped...", "test_images/mandrill_24rle.tga", "test_images/mandrill_24rle.tga.test");
+	testMapped("Testing 32-bit RGB image with 8 bit palette RLE compressed, memory mapped...", "test_images/mandrill_32rle_palette8.tga", "test_images/mandrill_32rle_palette8.tga.test");
+
+	testMemory("Testing 8-bit greyscale RLE compressed image, from memory...", "test_images/mandrill_8rle.tga", "test_images/mandrill_8rle.tga.test");
+	testMemory("Testing 32-bit RGB image with 8 bit palette, from memory...", "test_images/mandrill_32_palette8.tga", "test_images/mandrill_32_palette8.tga.test");
+
+	testPipe("Testing 24-bit RGB images uncompressed, one after another in pipe...", "test_images/mandrill_24.tga", "test_images/mandrill_24rle.tga", "test_images/mandrill_24.tga.test");
+
+	testConverted("Testing 32-bit RGB RLE compressed image, converted to BGRA8...", "test_images/mandrill_32rle.tga", "test_images/mandrill_32rle.tga.test", gw::tga::GWTGA_OUTPUT_BGRA8);
+	testConverted("Testing 32-bit RGB image uncompressed, converted to BGRA8...", "test_images/mandrill_32.tga", "test_images/mandrill_32.tga.test", gw::tga::GWTGA_OUTPUT_BGRA8);
+	testConverted("Testing 32-bit RGB image uncompressed, converted to RGBA8...", "test_images/mandrill_32.tga", "test_images/mandrill_32.tga.test", gw::tga::GWTGA_OUTPUT_RGBA8);
+	testConverted("Testing 32-bit RGB RLE compressed image, converted to RGB8...", "test_images/mandrill_32rle.tga", "test_images/mandrill_32rle.tga.test", gw::tga::GWTGA_OUTPUT_RGB8);
+	testConverted("Testing 24-bit RGB image uncompressed, converted to RGBA8...", "test_images/mandrill_24.tga", "test_images/mandrill_24.tga.test", gw::tga::GWTGA_OUTPUT_RGBA8);
+	testConverted("Testing 24-bit RGB RLE compressed image, converted to BGRA8...", "test_images/mandrill_24rle.tga", "test_images/mandrill_24rle.tga.test", gw::tga::GWTGA_OUTPUT_BGRA8);
+	testConverted("Testing 8-bit greyscale image uncompressed, converted to RGB8...", "test_images/mandrill_8.tga", "test_images/mandrill_8.tga.test", gw::tga::GWTGA_OUTPUT_RGB8);
+	testConverted("Testing 8-bit greyscale RLE compressed image, converted to RGBA8...", "test_images/mandrill_8rle.tga", "test_images/mandrill_8rle.tga.test", gw::tga::GWTGA_OUTPUT_RGBA8);
+	testConverted("Testing 24-bit RGB image with 8 bit palette, converted to RGBA8...", "test_images/mandrill_24_palette8.tga", "test_images/mandrill_24_palette8.tga.test", gw::tga::GWTGA_OUTPUT_RGBA8);
+	testConverted("Testing 32-bit RGB image with 8 bit palette RLE compressed, converted to RGB8...", "test_images/mandrill_32rle_palette8.tga", "test_images/mandrill_32rle_palette8.tga.test", gw::tga::GWTGA_OUTPUT_RGB8);
+	testConverted("Testing 8-bit greyscale image with 8 bit palette, converted to RGBA8...", "test_images/mandrill_8_palette8.tga", "test_images/mandrill_8_palette8.tga.test", gw::tga::GWTGA_OUTPUT_RGBA8);
+
+	testRegion("Testing region of 24-bit RGB image uncompressed...", "test_images/mandrill_24.tga", "test_images/mandrill_24.tga.test");
+	testRegion("Testing region of 24-bit RGB RLE compressed image...", "test_images/mandrill_24rle.tga", "test_images/mandrill_24rle.tga.test");
+	testRegion("Testing region of 8-bit greyscale image with 8 bit palette RLE compressed...", "test_images/mandrill_8rle_palette8.tga", "test_images/mandrill_8rle_palette8.tga.test");
+
+	testFlipped("Testing 8-bit greyscale image uncompressed, flipped horizontally...", "test_images/mandrill_8.tga", "test_images/mandrill_8.tga.test", gw::tga::GWTGA_FLIP_HORIZONTALLY);
+	testFlipped("Testing 24-bit RGB image uncompressed, flipped horizontally...", "test_images/mandrill_24.tga", "test_images/mandrill_24.tga.test", gw::tga::GWTGA_FLIP_HORIZONTALLY);
+	testFlipped("Testing 32-bit RGB image uncompressed, flipped horizontally...", "test_images/mandrill_32.tga", "test_images/mandrill_32.tga.test", gw::tga::GWTGA_FLIP_HORIZONTALLY);
+	testFlipped("Testing 8-bit greyscale RLE compressed image, flipped horizontally...", "test_images/mandrill_8rle.tga", "test_images/mandrill_8rle.tga.test", gw::tga::GWTGA_FLIP_HORIZONTALLY);
+	testFlipped("Testing 24-bit RGB RLE compressed image, flipped horizontally...", "test_images/mandrill_24rle.tga", "test_images/mandrill_24rle.tga.test", gw::tga::GWTGA_FLIP_HORIZONTALLY);
+	testFlipped("Testing 32-bit RGB RLE compressed image, flipped both ways...", "test_images/mandrill_32rle.tga", "test_images/mandrill_32rle.tga.test", (gw::tga::TGAOptions) (gw::tga::GWTGA_FLIP_HORIZONTALLY | gw::tga::GWTGA_FLIP_VERTICALLY));
+	testFlipped("Testing 24-bit RGB image with 8 bit palette, flipped horizontally...", "test_images/mandrill_24_palette8.tga", "test_images/mandrill_24_palette8.tga.test", gw::tga::GWTGA_FLIP_HORIZONTALLY);
+	testFlipped("Testing 32-bit RGB image with 8 bit palette RLE compressed, flipped vertically...", "test_images/mandrill_32rle_palette8.tga", "test_images/mandrill_32rle_palette8.tga.test", gw::tga::GWTGA_FLIP_VERTICALLY);
 
-	test("Testing 16-bit RGB image uncompressed...", "test_images\\mandrill_16.tga", "test_images\\mandrill_16.tga.test");
-	test("Testing 16-bit RGB RLE compressed image...", "test_images\\mandrill_16rle.tga", "test_images\\mandrill_16rle.tga.test");
-	test("Testing 16-bit RGB image with 8 bit palette...", "test_images\\mandrill_16_palette8.tga", "test_images\\mandrill_16_palette8.tga.test");
-	test("Testing 16-bit RGB image with 8 bit palette RLE compressed...", "test_images\\mandrill_16rle_palette8.tga", "test_images\\mandrill_16rle_palette8.tga.test");
+	testReader("Testing 24-bit RGB RLE compressed image, read 16 rows at a time...", "test_images/mandrill_24rle.tga", "test_images/mandrill_24rle.tga.test");
+	testReader("Testing 8-bit greyscale image with 8 bit palette, read 16 rows at a time...", "test_images/mandrill_8_palette8.tga", "test_images/mandrill_8_palette8.tga.test");
 
-	test("Testing 24-bit RGB image uncompressed...", "test_images\\mandrill_24.tga", "test_images\\mandrill_24.tga.test");
-	test("Testing 24-bit RGB RLE compressed image...", "test_images\\mandrill_24rle.tga", "test_images\\mandrill_24rle.tga.test");
-	test("Testing 24-bit RGB image with 8 bit palette...", "test_images\\mandrill_24_palette8.tga", "test_images\\mandrill_24_palette8.tga.test");
-	test("Testing 24-bit RGB image with 8 bit palette RLE compressed...", "test_images\\mandrill_24rle_palette8.tga", "test_images\\mandrill_24rle_palette8.tga.test");
+	testWriter("Testing 32-bit RGB image, RLE compressed 16 rows at a time...", "test_images/mandrill_32.tga", "test_images/mandrill_32.tga.test");
 
-	test("Testing 32-bit RGB image uncompressed...", "test_images\\mandrill_32.tga", "test_images\\mandrill_32.tga.test");
-	test("Testing 32-bit RGB RLE compressed image...", "test_images\\mandrill_32rle.tga", "test_images\\mandrill_32rle.tga.test");
-	test("Testing 32-bit RGB image with 8 bit palette...", "test_images\\mandrill_32_palette8.tga", "test_images\\mandrill_32_palette8.tga.test");
-	test("Testing 32-bit RGB image with 8 bit palette RLE compressed...", "test_images\\mandrill_32rle_palette8.tga", "test_images\\mandrill_32rle_palette8.tga.test");
+	char* batchFiles[] = { "test_images/mandrill_8rle.tga", "test_images/mandrill_24_palette8.tga", "test_images/mandrill_32rle.tga" };
+	char* batchTestFiles[] = { "test_images/mandrill_8rle.tga.test", "test_images/mandrill_24_palette8.tga.test", "test_images/mandrill_32rle.tga.test" };
+	testBatch("Testing batch of 8, 24 and 32-bit images...", batchFiles, batchTestFiles, 3);
+
+	char* probeFiles[] = { "test_images/mandrill_8rle.tga", "test_images/mandrill_16.tga", "test_images/mandrill_24_palette8.tga", "test_images/mandrill_32rle_palette8.tga" };
+	testProbe("Testing probe of 8, 16, 24 and 32-bit images...", probeFiles, 4);
+
+	testParallelDecode("Testing 24-bit RGB RLE compressed image tiled to 1536x1024, decoded in parallel...", "test_images/mandrill_24.tga");
+
+	testParallelEncode("Testing 32-bit RGB image tiled to 1536x1024, RLE compressed in parallel...", "test_images/mandrill_32.tga");
+
+#ifdef GWTGA_STATS
+	testStats("Testing 24-bit RGB RLE compressed image, load and save stats...", "test_images/mandrill_24rle.tga", "test_images/mandrill_24rle.tga.test");
+#endif
+
+	testFlippedRLE("Testing 8-bit greyscale image, saved flipped and RLE compressed...", "test_images/mandrill_8.tga", "test_images/mandrill_8.tga.test");
+	testFlippedRLE("Testing 16-bit RGB image, saved flipped and RLE compressed...", "test_images/mandrill_16.tga", NULL);
+	testFlippedRLE("Testing 24-bit RGB image, saved flipped and RLE compressed...", "test_images/mandrill_24.tga", "test_images/mandrill_24.tga.test");
+	testFlippedRLE("Testing 32-bit RGB image, saved flipped and RLE compressed...", "test_images/mandrill_32.tga", "test_images/mandrill_32.tga.test");
+
+	testPool("Testing 24-bit RGB image with 8 bit palette, pooled memory...", "test_images/mandrill_24_palette8.tga", "test_images/mandrill_24_palette8.tga.test");
+
+	testValidate("Testing 8-bit greyscale image with 8 bit palette RLE compressed, validated...", "test_images/mandrill_8rle_palette8.tga", "test_images/mandrill_8rle_palette8.tga.test");
+
+	testOptimalRLE("Testing 8-bit greyscale image, RLE compressed to optimal size...", "test_images/mandrill_8.tga", "test_images/mandrill_8.tga.test");
+
+	testMipmaps("Testing 24-bit RGB RLE compressed image with mipmaps...", "test_images/mandrill_24rle.tga", "test_images/mandrill_24rle.tga.test", gw::tga::GWTGA_GENERATE_MIPMAPS);
+	testMipmaps("Testing 8-bit greyscale image with 8 bit palette with mipmaps...", "test_images/mandrill_8_palette8.tga", "test_images/mandrill_8_palette8.tga.test", gw::tga::GWTGA_GENERATE_MIPMAPS);
+	testMipmaps("Testing 32-bit RGB image uncompressed with sRGB mipmaps...", "test_images/mandrill_32.tga", "test_images/mandrill_32.tga.test", (gw::tga::TGAOptions) (gw::tga::GWTGA_GENERATE_MIPMAPS | gw::tga::GWTGA_MIPMAPS_SRGB));
+	testMipmaps("Testing 24-bit RGB RLE compressed image with sRGB mipmaps...", "test_images/mandrill_24rle.tga", "test_images/mandrill_24rle.tga.test", (gw::tga::TGAOptions) (gw::tga::GWTGA_GENERATE_MIPMAPS | gw::tga::GWTGA_MIPMAPS_SRGB));
 
 	std::cout << std::endl;
 
-	printImageInfo(gw::tga::LoadTga("test_images\\guitar.tga"));
+	gw::tga::TGAImagePtr img(gw::tga::LoadTga("test_images/guitar.tga"));
+
+	printImageInfo(*img);
 
-	gw::tga::TGAImage img = gw::tga::LoadTga("test_images\\guitar.tga");
-	if (gw::tga::SaveTga("test_flipped.tga", img, (gw::tga::TGAOptions)(gw::tga::GWTGA_FLIP_HORIZONTALLY | gw::tga::GWTGA_FLIP_VERTICALLY)) != gw::tga::GWTGA_NONE) {
+	if (gw::tga::SaveTga("test_flipped.tga", *img, (gw::tga::TGAOptions)(gw::tga::GWTGA_FLIP_HORIZONTALLY | gw::tga::GWTGA_FLIP_VERTICALLY)) != gw::tga::GWTGA_NONE) {
 		std::cout << "Error while saving TGA" << std::endl;
 	} else {
 		std::cout << "Image saved successfully" << std::endl;
 	}
 
-	img = gw::tga::LoadTga("test_images\\guitar_palette_rle.tga", (gw::tga::TGAOptions)(gw::tga::GWTGA_FLIP_HORIZONTALLY | gw::tga::GWTGA_FLIP_VERTICALLY));
-	if (gw::tga::SaveTga("test_flipped.tga", img) != gw::tga::GWTGA_NONE) {
+	img = gw::tga::TGAImagePtr(gw::tga::LoadTga("test_images/guitar_palette_rle.tga", (gw::tga::TGAOptions)(gw::tga::GWTGA_FLIP_HORIZONTALLY | gw::tga::GWTGA_FLIP_VERTICALLY)));
+	if (gw::tga::SaveTga("test_flipped.tga", *img) != gw::tga::GWTGA_NONE) {
 		std::cout << "Error while saving TGA" << std::endl;
 	} else {
 		std::cout << "Image saved successfully" << std::endl;
 	}
 
-	img = gw::tga::LoadTga("test_images\\guitar_palette_rle.tga", (gw::tga::TGAOptions)(gw::tga::GWTGA_RETURN_COLOR_MAP));
+	img = gw::tga::TGAImagePtr(gw::tga::LoadTga("test_images/guitar_palette_rle.tga", (gw::tga::TGAOptions)(gw::tga::GWTGA_RETURN_COLOR_MAP)));
 
-	if (gw::tga::SaveTga("test_clr_map.tga", img) != gw::tga::GWTGA_NONE) {
+	if (gw::tga::SaveTga("test_clr_map.tga", *img) != gw::tga::GWTGA_NONE) {
 		std::cout << "Error while saving TGA" << std::endl;
 	} else {
 		std::cout << "Image saved successfully" << std::endl;
 	}
 
-	img = gw::tga::LoadTga("test_images\\guitar.tga");
+	img = gw::tga::TGAImagePtr(gw::tga::LoadTga("test_images/guitar.tga"));
 
-	if (gw::tga::SaveTga("test_rle.tga", img, (gw::tga::TGAOptions) (gw::tga::GWTGA_COMPRESS_RLE | gw::tga::GWTGA_FLIP_HORIZONTALLY /*| gw::tga::GWTGA_FLIP_VERTICALLY*/)) != gw::tga::GWTGA_NONE) {
+	if (gw::tga::SaveTga("test_rle.tga", *img, (gw::tga::TGAOptions) (gw::tga::GWTGA_COMPRESS_RLE | gw::tga::GWTGA_FLIP_HORIZONTALLY /*| gw::tga::GWTGA_FLIP_VERTICALLY*/)) != gw::tga::GWTGA_NONE) {
 		std::cout << "Error while saving TGA" << std::endl;
 	} else {
 		std::cout << "Image saved successfully" << std::endl;
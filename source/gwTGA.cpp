@@ -1,12 +1,217 @@
 #include "gwTGA.h"
 #include <cstring> // memcpy
+#include <cstdio> // remove
 #include <fstream>  
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <cmath> // pow
+#include <algorithm> // reverse
+#include <cstdlib> // posix_memalign
+
+#ifdef GWTGA_STATS
+#include <chrono>
+#endif
+
+#if defined(__AVX2__)
+#define GWTGA_AVX2
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GWTGA_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h> // _BitScanForward
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <malloc.h> // _aligned_malloc
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#define GWTGA_LINUX_IO
+#include <cerrno>
+#include <new> // std::nothrow
+#include <sys/syscall.h>
+#include <sys/uio.h> // preadv
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#define GWTGA_IO_URING
+#include <linux/io_uring.h>
+#endif
+#endif
+#endif
 
 namespace gw {          
 	namespace tga {
 
+		namespace details {
+			// -------------------------------------------------------------------------------------
+			//  Stats
+			// -------------------------------------------------------------------------------------
+
+			// Kept out of gwTGA.h, their layout depends on GWTGA_STATS which code including the header does not have to define
+
+			// Stages of load or save, time between stage changes is added to the stage which was current
+			enum TGAStatsStage {
+				GWTGA_STAGE_HEADER,
+				GWTGA_STAGE_COLOR_MAP,
+				GWTGA_STAGE_PIXELS,
+				GWTGA_STAGE_FOOTER
+			};
+
+			class TGAStatsRecorder;
+
+			// Stats of calling thread, work done for it on other threads runs with its context
+			struct TGAStatsContext {
+#ifdef GWTGA_STATS
+				TGAStatsContext() : stats(NULL), recorder(NULL) {}
+
+				TGAStats* stats;
+				TGAStatsRecorder* recorder;
+#endif
+			};
+
+			// Counts packets in decoding and encoding kernels, packet continued from previous band of image is not counted again
+			struct TGAPacketCounter {
+#ifdef GWTGA_STATS
+				TGAPacketCounter() : rlePackets(0), rawPackets(0), rlePixels(0), rawPixels(0) {}
+
+				void add(bool rlePacket, size_t pixelCount, bool continued) {
+					if (rlePacket) {
+						rlePackets += continued ? 0 : 1;
+						rlePixels += pixelCount;
+					} else {
+						rawPackets += continued ? 0 : 1;
+						rawPixels += pixelCount;
+					}
+				}
+
+				// Size of packets in file
+				size_t size(size_t bytesPerPixel) const { return rlePackets * (1 + bytesPerPixel) + rawPackets + rawPixels * bytesPerPixel; }
+
+				size_t rlePackets;
+				size_t rawPackets;
+				size_t rlePixels;
+				size_t rawPixels;
+#else
+				void add(bool, size_t, bool) {}
+				size_t size(size_t) const { return 0; }
+#endif
+			};
+
+#ifdef GWTGA_STATS
+			// Records one load or save to stats set by SetTgaStats on calling thread, starts with header stage
+			class TGAStatsRecorder {
+			public:
+				TGAStatsRecorder();
+				~TGAStatsRecorder();
+
+				// Called only from thread which owns the recorder, never while workers run
+				void stage(TGAStatsStage stage);
+				void bytesRead(size_t size);
+				void bytesWritten(size_t size);
+				void io(double seconds);
+
+				// Called from any thread working for the recorder
+				void packets(const TGAPacketCounter &packets, size_t size);
+
+			private:
+				TGAStatsRecorder(const TGAStatsRecorder&);
+				TGAStatsRecorder& operator=(const TGAStatsRecorder&);
+
+				TGAStatsContext previous;
+				TGAStats stats;
+				TGAStatsStage currentStage;
+				double stageStart;
+			};
+
+			TGAStatsContext getStatsContext();
+
+			// Seconds from arbitrary point, for measuring stage and I/O times
+			double getStatsTime();
+
+			// Functions below record to recorder of calling thread, they do nothing when there is none
+			void recordStage(TGAStatsStage stage);
+			void recordBytesRead(size_t size);
+			void recordBytesWritten(size_t size);
+			void recordPackets(const TGAPacketCounter &packets, size_t size);
+
+			// Declares recorder of load or save which records until the end of scope
+#define GWTGA_STATS_RECORDER(name) gw::tga::details::TGAStatsRecorder name
+#else
+			// Compiled to nothing, so that no unused recorder is left
+#define GWTGA_STATS_RECORDER(name)
+
+			inline TGAStatsContext getStatsContext() { return TGAStatsContext(); }
+			inline void recordStage(TGAStatsStage) {}
+			inline void recordBytesRead(size_t) {}
+			inline void recordBytesWritten(size_t) {}
+			inline void recordPackets(const TGAPacketCounter&, size_t) {}
+#endif
+
+			// Adds time of its lifetime to I/O time of recorder, wraps reads and writes of std::istream and std::ostream
+			class TGAStatsIoTimer {
+			public:
+#ifdef GWTGA_STATS
+				TGAStatsIoTimer();
+				~TGAStatsIoTimer();
+
+			private:
+				TGAStatsRecorder* recorder;
+				double start;
+#else
+				TGAStatsIoTimer() {}
+#endif
+			};
+
+			// Runs calling thread with stats context of another thread for lifetime of scope
+			class TGAStatsScope {
+			public:
+#ifdef GWTGA_STATS
+				TGAStatsScope(const TGAStatsContext &context);
+				~TGAStatsScope();
+
+			private:
+				TGAStatsContext previous;
+#else
+				TGAStatsScope(const TGAStatsContext&) {}
+#endif
+			};
+		}
+
 		using namespace details;
 
+		// Set by SetTgaThreadCount, 0 means all hardware threads
+		static std::atomic<unsigned int> threadCountSetting(0);
+
+		// Set by SetTgaQueueDepth
+		static std::atomic<unsigned int> queueDepthSetting(16);
+
+		// Set while thread runs tasks of pool, nested batches are then run by that thread alone
+		static thread_local bool insidePoolTask = false;
+
+#ifdef GWTGA_STATS
+		// Set by SetTgaStats on every thread, workers run with context of thread they work for
+		static thread_local TGAStatsContext currentStats;
+
+		// Guards stats shared by threads and packet counts added by workers
+		static std::mutex statsMutex;
+#endif
+
 		TGAImage LoadTga(char* fileName) {
 			return LoadTga(fileName, GWTGA_OPTIONS_NONE);
 		}
@@ -24,6 +229,17 @@ namespace gw {
 		{
 			TGAImage result;
 
+			// Decode directly from mapped file when possible, pixels are always copied because mapping is closed on return
+			TGAFileMapping mapping;
+
+			if (mapping.open(fileName) == GWTGA_NONE) {
+				// Whole file is needed, it is read in background while the beginning is decoded
+				prefetchMapping(mapping);
+
+				TGAMemoryInput input(mapping.data(), mapping.size());
+				return loadTga(input, listener, options, false, NULL);
+			}
+
 			std::ifstream fileStream;
 			fileStream.open(fileName, std::ifstream::in | std::ifstream::binary);
 
@@ -49,873 +265,5583 @@ namespace gw {
 		}
 
 		TGAImage LoadTga(std::istream &stream, ITGALoaderListener* listener, TGAOptions options) {
-			// TODO: TGA is little endian. Make sure reading from stream is little endian
+			TGAStreamInput input(stream);
+			return loadTga(input, listener, options, false, NULL);
+		}
 
-			// Parse options
-			bool flipVertically = ((options & GWTGA_FLIP_VERTICALLY) == GWTGA_FLIP_VERTICALLY);
-			bool flipHorizontally = ((options & GWTGA_FLIP_HORIZONTALLY) == GWTGA_FLIP_HORIZONTALLY);
-			bool returnColorMap = ((options & GWTGA_RETURN_COLOR_MAP) == GWTGA_RETURN_COLOR_MAP);
+		TGAImage LoadTga(const TGAFileMapping &mapping) {
+			return LoadTga(mapping, GWTGA_OPTIONS_NONE);
+		}
 
-			TGAImage resultImage;
+		TGAImage LoadTga(const TGAFileMapping &mapping, TGAOptions options) {
+			TGALoaderListener<> listener(options & GWTGA_RETURN_COLOR_MAP);
+			return LoadTga(mapping, &listener, options);
+		}
 
-			// Read header
-			TGAHeader header;
+		TGAImage LoadTga(const TGAFileMapping &mapping, ITGALoaderListener* listener) {
+			return LoadTga(mapping, listener, GWTGA_OPTIONS_NONE);
+		}
 
-			stream.read((char*)&header.iDLength, sizeof(header.iDLength));
-			stream.read((char*)&header.colorMapType, sizeof(header.colorMapType));
-			stream.read((char*)&header.ImageType, sizeof(header.ImageType));
-			stream.read((char*)&header.colorMapSpec.firstEntryIndex, sizeof(header.colorMapSpec.firstEntryIndex));
-			stream.read((char*)&header.colorMapSpec.colorMapLength, sizeof(header.colorMapSpec.colorMapLength));
-			stream.read((char*)&header.colorMapSpec.colorMapEntrySize, sizeof(header.colorMapSpec.colorMapEntrySize));
-			stream.read((char*)&header.imageSpec.xOrigin, sizeof(header.imageSpec.xOrigin));
-			stream.read((char*)&header.imageSpec.yOrigin, sizeof(header.imageSpec.yOrigin));
-			stream.read((char*)&header.imageSpec.width, sizeof(header.imageSpec.width));
-			stream.read((char*)&header.imageSpec.height, sizeof(header.imageSpec.height));
-			stream.read((char*)&header.imageSpec.bitsPerPixel, sizeof(header.imageSpec.bitsPerPixel));
-			stream.read((char*)&header.imageSpec.imgDescriptor, sizeof(header.imageSpec.imgDescriptor));
+		TGAImage LoadTga(const TGAFileMapping &mapping, ITGALoaderListener* listener, TGAOptions options) {
 
-			if (stream.fail()) {
-				// Reading of header failed
-				resultImage.error = GWTGA_IO_ERROR;
-				return resultImage;
+			if (!mapping.isOpen()) {
+				TGAImage result;
+				result.error = GWTGA_CANNOT_OPEN_FILE;
+				return result;
 			}
 
-			resultImage.width = header.imageSpec.width;
-			resultImage.height = header.imageSpec.height;
-			resultImage.xOrigin = header.imageSpec.xOrigin;
-			resultImage.yOrigin = header.imageSpec.yOrigin;
+			TGAMemoryInput input(mapping.data(), mapping.size());
+			return loadTga(input, listener, options, true, NULL);
+		}
 
-			if (header.colorMapSpec.colorMapLength == 0 || returnColorMap) {
-				resultImage.bitsPerPixel = header.imageSpec.bitsPerPixel;
-			} else {
-				resultImage.bitsPerPixel = header.colorMapSpec.colorMapEntrySize;
-			}
-
-			resultImage.attributeBitsPerPixel = header.imageSpec.imgDescriptor & 0x0F;
-
-			switch (header.imageSpec.imgDescriptor & 0x30) {
-			case 0x00:
-				resultImage.origin = GWTGA_BOTTOM_LEFT;
-				break;
-			case 0x10:
-				resultImage.origin = GWTGA_BOTTOM_RIGHT;
-				break;
-			case 0x20:
-				resultImage.origin = GWTGA_TOP_LEFT;
-				break;
-			case 0x30:
-				resultImage.origin = GWTGA_TOP_RIGHT;
-				break;
-			}
-
-			// TODO: We do not need pixelFormat anymore
-			// Leave this as a check for supported formats
-			//switch (resultImage.bitsPerPixel) {
-			//case 8:
-			//	resultImage.pixelFormat = TGAFormat::LUMINANCE_U8;
-			//	break;
-			//case 16:
-			//	resultImage.pixelFormat = TGAFormat::BGRA5551_U16;
-			//	break;
-			//case 24:
-			//	resultImage.pixelFormat = TGAFormat::BGR_U24;
-			//	break;
-			//case 32:
-			//	resultImage.pixelFormat = TGAFormat::BGRA_U32;
-			//	break;
-			//case 96:
-			//	resultImage.pixelFormat = TGAFormat::BGR_F96;
-			//	break;
-			//default:
-			//	// TODO: Unknown pixel format
-			//	break;
-			//}
-
-			if (resultImage.bitsPerPixel > 16 * 8) {
-				// Too many bits per pixel
-				resultImage.error = GWTGA_UNSUPPORTED_PIXEL_DEPTH;
-				return resultImage;
+		TGAImage LoadTga(const void* data, size_t size) {
+			return LoadTga(data, size, GWTGA_OPTIONS_NONE);
+		}
+
+		TGAImage LoadTga(const void* data, size_t size, TGAOptions options) {
+			TGALoaderListener<> listener(options & GWTGA_RETURN_COLOR_MAP);
+			return LoadTga(data, size, &listener, options);
+		}
+
+		TGAImage LoadTga(const void* data, size_t size, ITGALoaderListener* listener) {
+			return LoadTga(data, size, listener, GWTGA_OPTIONS_NONE);
+		}
+
+		TGAImage LoadTga(const void* data, size_t size, ITGALoaderListener* listener, TGAOptions options) {
+
+			if (data == NULL) {
+				TGAImage result;
+				result.error = GWTGA_INVALID_DATA;
+				return result;
+			}
+
+			TGAMemoryInput input((const char*) data, size);
+			return loadTga(input, listener, options, false, NULL);
+		}
+
+		void SetTgaThreadCount(unsigned int threadCount) {
+			threadCountSetting = threadCount;
+		}
+
+		void SetTgaQueueDepth(unsigned int queueDepth) {
+			queueDepthSetting = queueDepth;
+		}
+
+		void SetTgaStats(TGAStats* stats) {
+#ifdef GWTGA_STATS
+			currentStats.stats = stats;
+#else
+			(void) stats;
+#endif
+		}
+
+		TGAImage LoadTgaRegion(char* fileName, unsigned int x, unsigned int y, unsigned int width, unsigned int height) {
+			return LoadTgaRegion(fileName, x, y, width, height, GWTGA_OPTIONS_NONE);
+		}
+
+		TGAImage LoadTgaRegion(char* fileName, unsigned int x, unsigned int y, unsigned int width, unsigned int height, TGAOptions options) {
+			TGALoaderListener<> listener(options & GWTGA_RETURN_COLOR_MAP);
+			return LoadTgaRegion(fileName, x, y, width, height, &listener, options);
+		}
+
+		TGAImage LoadTgaRegion(char* fileName, unsigned int x, unsigned int y, unsigned int width, unsigned int height, ITGALoaderListener* listener, TGAOptions options) {
+
+			TGARegion region(x, y, width, height);
+
+			// Only pages of mapped file covering the region are read
+			TGAFileMapping mapping;
+
+			if (mapping.open(fileName) == GWTGA_NONE) {
+				TGAMemoryInput input(mapping.data(), mapping.size());
+				return loadTga(input, listener, options, false, &region);
+			}
+
+			std::ifstream fileStream;
+			fileStream.open(fileName, std::ifstream::in | std::ifstream::binary);
+
+			if (fileStream.fail()) {
+				TGAImage result;
+				result.error = GWTGA_CANNOT_OPEN_FILE; 
+				return result;
 			}
 
-			switch (header.ImageType) {
-			case 1:
-			case 2:
-			case 9:
-			case 10:
-				resultImage.colorType = GWTGA_RGB;
-				break;
-			case 3:
-			case 11:
-				resultImage.colorType = GWTGA_GREYSCALE;
-				break;
+			return LoadTgaRegion(fileStream, x, y, width, height, listener, options);
+		}
+
+		TGAImage LoadTgaRegion(std::istream &stream, unsigned int x, unsigned int y, unsigned int width, unsigned int height) {
+			return LoadTgaRegion(stream, x, y, width, height, GWTGA_OPTIONS_NONE);
+		}
+
+		TGAImage LoadTgaRegion(std::istream &stream, unsigned int x, unsigned int y, unsigned int width, unsigned int height, TGAOptions options) {
+			TGALoaderListener<> listener(options & GWTGA_RETURN_COLOR_MAP);
+			return LoadTgaRegion(stream, x, y, width, height, &listener, options);
+		}
+
+		TGAImage LoadTgaRegion(std::istream &stream, unsigned int x, unsigned int y, unsigned int width, unsigned int height, ITGALoaderListener* listener, TGAOptions options) {
+			TGARegion region(x, y, width, height);
+			TGAStreamInput input(stream);
+			return loadTga(input, listener, options, false, &region);
+		}
+
+		TGAImage LoadTgaRegion(const TGAFileMapping &mapping, unsigned int x, unsigned int y, unsigned int width, unsigned int height) {
+			return LoadTgaRegion(mapping, x, y, width, height, GWTGA_OPTIONS_NONE);
+		}
+
+		TGAImage LoadTgaRegion(const TGAFileMapping &mapping, unsigned int x, unsigned int y, unsigned int width, unsigned int height, TGAOptions options) {
+			TGALoaderListener<> listener(options & GWTGA_RETURN_COLOR_MAP);
+			return LoadTgaRegion(mapping, x, y, width, height, &listener, options);
+		}
+
+		TGAImage LoadTgaRegion(const TGAFileMapping &mapping, unsigned int x, unsigned int y, unsigned int width, unsigned int height, ITGALoaderListener* listener, TGAOptions options) {
+
+			if (!mapping.isOpen()) {
+				TGAImage result;
+				result.error = GWTGA_CANNOT_OPEN_FILE;
+				return result;
 			}
 
-			// Read image iD - skip this, we do not use image id now
-			stream.seekg(header.iDLength, std::ios_base::cur);
+			TGARegion region(x, y, width, height);
+			TGAMemoryInput input(mapping.data(), mapping.size());
+			return loadTga(input, listener, options, true, &region);
+		}
 
-			// Read color map
-			char* colorMap = NULL;
-			if (header.colorMapSpec.colorMapLength > 0) {
+		TGAImage LoadTgaRegion(const void* data, size_t size, unsigned int x, unsigned int y, unsigned int width, unsigned int height) {
+			return LoadTgaRegion(data, size, x, y, width, height, GWTGA_OPTIONS_NONE);
+		}
 
-				// Pick temporary memory (possibly from stack or preallocated) when we dont need color palette anymore after loading the image
-				TGAMemoryType colorMapType = returnColorMap ? GWTGA_COLOR_PALETTE : GWTGA_COLOR_PALETTE_TEMPORARY;
+		TGAImage LoadTgaRegion(const void* data, size_t size, unsigned int x, unsigned int y, unsigned int width, unsigned int height, TGAOptions options) {
+			TGALoaderListener<> listener(options & GWTGA_RETURN_COLOR_MAP);
+			return LoadTgaRegion(data, size, x, y, width, height, &listener, options);
+		}
 
-				colorMap = (*listener)(header.colorMapSpec.colorMapEntrySize, header.colorMapSpec.colorMapLength, 1, colorMapType);
+		TGAImage LoadTgaRegion(const void* data, size_t size, unsigned int x, unsigned int y, unsigned int width, unsigned int height, ITGALoaderListener* listener, TGAOptions options) {
 
-				if (!colorMap) {
-					// Could not allocate memory for color map
-					resultImage.error = GWTGA_MALLOC_ERROR;
-					return resultImage;
-				}
+			if (data == NULL) {
+				TGAImage result;
+				result.error = GWTGA_INVALID_DATA;
+				return result;
+			}
+
+			TGARegion region(x, y, width, height);
+			TGAMemoryInput input((const char*) data, size);
+			return loadTga(input, listener, options, false, &region);
+		}
+
+		TGAImageInfo ProbeTga(char* fileName) {
+
+			std::ifstream fileStream;
+			fileStream.open(fileName, std::ifstream::in | std::ifstream::binary);
+
+			if (fileStream.fail()) {
+				TGAImageInfo info;
+				info.error = GWTGA_CANNOT_OPEN_FILE; 
+				return info;
+			}
+
+			return ProbeTga(fileStream);
+		}
+
+		TGAImageInfo ProbeTga(std::istream &stream) {
+
+			TGAImageInfo info;
+
+			std::streampos start = stream.tellg();
+
+			// Read whole header at once
+			char headerBytes[TGA_HEADER_SIZE];
+			stream.read(headerBytes, TGA_HEADER_SIZE);
+
+			if (stream.fail()) {
+				info.error = GWTGA_IO_ERROR;
+				return info;
+			}
+
+			TGAHeader header;
+			parseHeader(headerBytes, header);
+			getImageInfo(header, info);
+
+			// Footer can be found only in seekable streams
+			if (start != std::streampos(-1)) {
 
-				if (returnColorMap) {
-					resultImage.colorMap.bytes = colorMap;
-					resultImage.colorMap.length = header.colorMapSpec.colorMapLength;
-					resultImage.colorMap.bitsPerPixel = header.colorMapSpec.colorMapEntrySize;
+				stream.seekg(0, std::ios_base::end);
+				std::streampos end = stream.tellg();
+
+				if (!stream.fail() && end != std::streampos(-1) && end - start >= (std::streamoff) (TGA_HEADER_SIZE + TGA_FOOTER_SIZE)) {
+
+					char footerBytes[TGA_FOOTER_SIZE];
+
+					stream.seekg(end - (std::streamoff) TGA_FOOTER_SIZE);
+					stream.read(footerBytes, TGA_FOOTER_SIZE);
+
+					if (!stream.fail()) {
+						getFooterInfo(footerBytes, (size_t) (end - start), info);
+					}
 				}
 
-				size_t size = header.colorMapSpec.colorMapLength * (header.colorMapSpec.colorMapEntrySize / 8);
-				stream.read(colorMap, size);
+				stream.clear();
+				stream.seekg(start);
+			}
 
-				if (stream.fail()) {
-					// Could not read color map from stream
-					resultImage.error = GWTGA_IO_ERROR;
-					return resultImage;
+			return info;
+		}
+
+		TGAImageInfo ProbeTga(const void* data, size_t size) {
+
+			TGAImageInfo info;
+
+			if (data == NULL || size < TGA_HEADER_SIZE) {
+				info.error = data == NULL ? GWTGA_INVALID_DATA : GWTGA_IO_ERROR;
+				return info;
+			}
+
+			const char* bytes = (const char*) data;
+
+			TGAHeader header;
+			parseHeader(bytes, header);
+			getImageInfo(header, info);
+
+			if (size >= TGA_HEADER_SIZE + TGA_FOOTER_SIZE) {
+				getFooterInfo(bytes + size - TGA_FOOTER_SIZE, size, info);
+			}
+
+			return info;
+		}
+
+		void ProbeTga(char** fileNames, size_t count, TGAImageInfo* results, unsigned int threadCount) {
+
+			if (threadCount == 0) {
+				threadCount = std::thread::hardware_concurrency();
+			}
+
+			struct Batch {
+				char** fileNames;
+				TGAImageInfo* results;
+
+				static void run(void* context, size_t index) {
+					Batch* batch = (Batch*) context;
+					batch->results[index] = ProbeTga(batch->fileNames[index]);
 				}
+			};
+
+			Batch batch = { fileNames, results };
+			runTasks(Batch::run, &batch, count, threadCount);
+		}
+
+		TGAValidation ValidateTga(char* fileName) {
+
+			// Walk mapped file when possible, packets are then read without copying
+			TGAFileMapping mapping;
+
+			if (mapping.open(fileName) == GWTGA_NONE) {
+				return ValidateTga(mapping);
 			}
 
-			// Read image data
-			size_t pixelsNumber = header.imageSpec.width * header.imageSpec.height;
+			std::ifstream fileStream;
+			fileStream.open(fileName, std::ifstream::in | std::ifstream::binary);
 
-			if ((resultImage.bitsPerPixel & 0x07) != 0) {
-				// Bits per pixel has to be divisible by 8
-				resultImage.error = GWTGA_UNSUPPORTED_PIXEL_DEPTH;
-				return resultImage;
+			if (fileStream.fail()) {
+				TGAValidation result;
+				setValidationIssue(result, GWTGA_UNREADABLE, 0);
+				return result;
 			}
 
-			size_t bytesPerPixel = resultImage.bitsPerPixel / 8;
-			size_t imgDataSize = pixelsNumber * bytesPerPixel;
+			return ValidateTga(fileStream);
+		}
+
+		TGAValidation ValidateTga(const TGAFileMapping &mapping) {
+			return ValidateTga(mapping.data(), mapping.size());
+		}
 
-			// Allocate memory for image data
-			resultImage.bytes = (*listener)(resultImage.bitsPerPixel, header.imageSpec.width, header.imageSpec.height, GWTGA_IMAGE_DATA);
+		TGAValidation ValidateTga(const void* data, size_t size) {
 
-			if (!resultImage.bytes) {
-				resultImage.error = GWTGA_MALLOC_ERROR;
-				return resultImage;
+			if (data == NULL) {
+				TGAValidation result;
+				setValidationIssue(result, GWTGA_UNREADABLE, 0);
+				return result;
 			}
 
-			// Read pixel data
-			if (header.ImageType == 2 || header.ImageType == 3 || 
-				(header.ImageType == 1 && returnColorMap)) { // color mapped, but do not resolve palette is specified
+			TGAMemoryInput input((const char*) data, size);
+			TGAMemoryBlockReader reader((const char*) data, size);
 
-					// 2 - Uncompressed, RGB images
-					// 3 - Uncompressed, black and white images.
+			return validateTga(input, &reader, size);
+		}
 
-					if (!flipVertically && !flipHorizontally) {
-						// NO PROCESSING
-						stream.read(resultImage.bytes, imgDataSize);
+		TGAValidation ValidateTga(std::istream &stream) {
 
-					} else if (flipVertically) {
-						if (!flipHorizontally) {
-							// PROCESSING - Vertical Flip
-							int stride = resultImage.width * bytesPerPixel;
-							processToArray<processPassThrough, fetchXPlusY>(stream, resultImage.bytes, resultImage.width, resultImage.height, 0, 1, 1, (resultImage.height - 1) * stride, -stride, -stride, stride);
+			TGAValidation result;
 
-						} else {
-							// PROCESSING - Vertical and horizontal Flip
-							int strideX = bytesPerPixel;
-							int strideY = resultImage.width * bytesPerPixel;
-							processToArray<processPassThrough, fetchXPlusY>(stream, resultImage.bytes, resultImage.width, resultImage.height, (resultImage.height - 1) * strideY, -strideY, -strideY, (resultImage.width - 1) * strideX, -strideX, -strideX , strideX);
-						}
-					} else if (flipHorizontally) {
-						// PROCESSING - Horizontal Flip
-						int strideX = bytesPerPixel;
-						int strideY = resultImage.width * bytesPerPixel;
-						processToArray<processPassThrough, fetchXPlusY>(stream, resultImage.bytes, resultImage.width, resultImage.height, 0, strideY, (resultImage.height) * strideY, (resultImage.width - 1) * strideX, -strideX, -strideX , strideX);
+			std::streampos start = stream.tellg();
+			size_t fileSize = 0;
+			bool seekable = false;
 
-					} else {
-						// TODO
-					}
+			// Footer can be found only in seekable streams
+			if (start != std::streampos(-1)) {
 
-					if (stream.fail()) {
-						resultImage.error = GWTGA_IO_ERROR;
-						return resultImage;
+				stream.seekg(0, std::ios_base::end);
+				std::streampos end = stream.tellg();
+
+				if (!stream.fail() && end != std::streampos(-1)) {
+					fileSize = (size_t) (end - start);
+					seekable = true;
+				}
+
+				stream.clear();
+				stream.seekg(start);
+			}
+
+			{
+				// Input gives data read ahead back to the stream when it is destroyed
+				TGAStreamInput input(stream);
+				TGAStreamBlockReader reader(stream, start);
+
+				result = validateTga(input, seekable ? &reader : NULL, fileSize);
+			}
+
+			if (seekable) {
+				stream.clear();
+				stream.seekg(start);
+			}
+
+			return result;
+		}
+
+		void LoadTgaBatch(char** fileNames, size_t count, TGAImage* results, TGAOptions options) {
+			LoadTgaBatch(fileNames, count, results, NULL, options);
+		}
+
+		void LoadTgaBatch(char** fileNames, size_t count, TGAImage* results, ITGABatchListener* listener, TGAOptions options) {
+
+			struct Batch {
+				char** fileNames;
+				size_t count;
+				TGAImage* results;
+				ITGABatchListener* listener;
+				TGAOptions options;
+				TGAFileQueue* queue;
+				TGAStatsContext stats;
+
+				static void run(void* context, size_t index) {
+					Batch* batch = (Batch*) context;
+					TGAStatsScope statsScope(batch->stats);
+
+					// Files are mostly taken in order, next one is read while this one is decoded
+					if (!batch->queue && index + 1 < batch->count) {
+						prefetchFile(batch->fileNames[index + 1]);
 					}
 
-			} else if (header.ImageType == 10 || header.ImageType == 11 ||
-				(header.ImageType == 9 && returnColorMap)) {  // color mapped, RLE compressed, but do not resolve palette is specified
+					ITGALoaderListener* imageListener = batch->listener ? batch->listener->createListener(index) : NULL;
+					TGALoaderListener<> defaultListener(batch->options & GWTGA_RETURN_COLOR_MAP);
 
-					// 10 - Runlength encoded RGB images
-					// 11 - Runlength encoded black and white images.
+					if (!imageListener) {
+						imageListener = &defaultListener;
+					}
 
-					bool perPixelProcessing;
-					size_t stride;
-					flipFunc flipFuncType;
+					TGAImage image = batch->queue ? loadQueuedFile(batch->queue, index, imageListener, batch->options) : LoadTga(batch->fileNames[index], imageListener, batch->options);
 
-					getFlipFunction(flipFuncType, stride, flipVertically, flipHorizontally, resultImage.width, resultImage.height);
+					if (batch->listener) {
+						batch->listener->loaded(index, image);
+					}
 
-					if (stride == resultImage.width * resultImage.height) {
-						perPixelProcessing = false;
-					} else {
-						perPixelProcessing = true;
+					if (batch->results) {
+						batch->results[index] = image;
 					}
+				}
+			};
 
-					if (!decompressRLE<fetchPixelUncompressed, fetchPixelsUncompressed>(resultImage.bytes, pixelsNumber, bytesPerPixel, stream, NULL, bytesPerPixel, resultImage.width, resultImage.height, flipFuncType, perPixelProcessing)) {
-						// Error while reading compressed image data
-						resultImage.error = GWTGA_IO_ERROR;
-						return resultImage;
+			Batch batch = { fileNames, count, results, listener, (TGAOptions) (options & ~GWTGA_PARALLEL_DECODE), openFileQueue(fileNames, count, getQueueDepth()), getStatsContext() };
+			runTasks(Batch::run, &batch, count, getThreadCount());
+			closeFileQueue(batch.queue);
+		}
+
+		TGAReader::TGAReader() : fileStream(NULL), streamInput(NULL), memoryInput(NULL), colorTable(NULL) {
+			close();
+		}
+
+		TGAReader::~TGAReader() {
+			close();
+		}
+
+		TGAError TGAReader::open(char* fileName, TGAOptions options) {
+
+			close();
+
+			// Mapped file is read as it is decoded, same as when loading whole image
+			if (mapping.open(fileName) == GWTGA_NONE) {
+				memoryInput = new TGAMemoryInput(mapping.data(), mapping.size());
+			} else {
+				fileStream = new std::ifstream(fileName, std::ifstream::in | std::ifstream::binary);
+
+				if (fileStream->fail()) {
+					close();
+					readError = GWTGA_CANNOT_OPEN_FILE;
+					return readError;
+				}
+
+				streamInput = new TGAStreamInput(*fileStream);
+			}
+
+			readError = memoryInput ? start(*memoryInput, options) : start(*streamInput, options);
+			return readError;
+		}
+
+		TGAError TGAReader::open(std::istream &stream, TGAOptions options) {
+
+			close();
+
+			streamInput = new TGAStreamInput(stream);
+
+			readError = start(*streamInput, options);
+			return readError;
+		}
+
+		TGAError TGAReader::open(const void* data, size_t size, TGAOptions options) {
+
+			close();
+
+			if (data == NULL) {
+				readError = GWTGA_INVALID_DATA;
+				return readError;
+			}
+
+			memoryInput = new TGAMemoryInput((const char*) data, size);
+
+			readError = start(*memoryInput, options);
+			return readError;
+		}
+
+		void TGAReader::close() {
+
+			// Stream input returns data read ahead to the stream
+			delete streamInput;
+			delete memoryInput;
+			delete fileStream;
+			delete colorTable;
+
+			streamInput = NULL;
+			memoryInput = NULL;
+			fileStream = NULL;
+			colorTable = NULL;
+
+			mapping.close();
+
+			imageInfo = TGAImageInfo();
+			readError = GWTGA_NONE;
+			nextRow = 0;
+			outputBitsPerPixel = 0;
+			flipHorizontally = false;
+			returnColorMap = false;
+
+			inputPixelSize = 0;
+			decodedPixelSize = 0;
+			storedFormat = UNKNOWN_FORMAT;
+			outputFormat = UNKNOWN_FORMAT;
+			convert = false;
+
+			std::vector<char>().swap(colorMapBytes);
+			std::vector<char>().swap(rowBuffer);
+
+			fetchPixel = NULL;
+			fetchPixels = NULL;
+			colorMapData = NULL;
+
+			packetRemaining = 0;
+			rlePacket = false;
+		}
+
+		TGAColorMap TGAReader::colorMap() const {
+
+			TGAColorMap result;
+
+			if (returnColorMap && !colorMapBytes.empty()) {
+				result.bytes = const_cast<char*>(&colorMapBytes[0]);
+				result.length = imageInfo.colorMapLength;
+				result.bitsPerPixel = imageInfo.colorMapBitsPerPixel;
+			}
+
+			return result;
+		}
+
+		unsigned int TGAReader::readRows(char* target, unsigned int rowCount) {
+
+			unsigned int rows = 0;
+
+			while (rows < rowCount && isOpen() && readError == GWTGA_NONE && nextRow < imageInfo.height) {
+
+				char* row = &target[rows * rowSize()];
+
+				if (!(memoryInput ? readRow(*memoryInput, row) : readRow(*streamInput, row))) {
+					readError = GWTGA_IO_ERROR;
+					break;
+				}
+
+				if (flipHorizontally) {
+					reversePixels(row, imageInfo.width, outputBitsPerPixel / 8);
+				}
+
+				nextRow++;
+				rows++;
+			}
+
+			return rows;
+		}
+
+		template<class Input>
+		TGAError TGAReader::start(Input &input, TGAOptions options) {
+
+			flipHorizontally = ((options & GWTGA_FLIP_HORIZONTALLY) == GWTGA_FLIP_HORIZONTALLY);
+			returnColorMap = ((options & GWTGA_RETURN_COLOR_MAP) == GWTGA_RETURN_COLOR_MAP);
+
+			char headerBytes[TGA_HEADER_SIZE];
+
+			// Stream is read ahead only within the image
+			input.limit(TGA_HEADER_SIZE);
+			input.read(headerBytes, TGA_HEADER_SIZE);
+
+			if (input.fail()) {
+				return GWTGA_IO_ERROR;
+			}
+
+			TGAHeader header;
+			parseHeader(headerBytes, header);
+			input.limit(getImageDataSize(header));
+			getImageInfo(header, imageInfo);
+
+			if (imageInfo.hasError()) {
+				return imageInfo.error;
+			}
+
+			bool colorMapped = header.ImageType == 1 || header.ImageType == 9;
+
+			if (imageInfo.colorType == GWTGA_UNKNOWN || (colorMapped && (header.colorMapType != 1 || !imageInfo.hasColorMap()))) {
+				// Unknown image type or color map missing
+				return GWTGA_INVALID_DATA;
+			}
+
+			if (colorMapped && imageInfo.bitsPerPixel != 8 && imageInfo.bitsPerPixel != 16 && imageInfo.bitsPerPixel != 24) {
+				// Unsupported color index size
+				return GWTGA_UNSUPPORTED_PIXEL_DEPTH;
+			}
+
+			// Rows are converted after decoding, palette is converted once
+			bool resolveColorMap = colorMapped && !returnColorMap;
+			TGAFormat output = getOutputFormat(options);
+			TGAFormat stored = UNKNOWN_FORMAT;
+
+			if (output != UNKNOWN_FORMAT && !(colorMapped && returnColorMap)) {
+				stored = resolveColorMap ? getStoredFormat(GWTGA_RGB, imageInfo.colorMapBitsPerPixel, imageInfo.attributeBitsPerPixel)
+					: getStoredFormat(imageInfo.colorType, imageInfo.bitsPerPixel, imageInfo.attributeBitsPerPixel);
+
+				if (stored == UNKNOWN_FORMAT) {
+					// Pixels cannot be converted to requested format
+					return GWTGA_UNSUPPORTED_PIXEL_DEPTH;
+				}
+
+				imageInfo.colorType = GWTGA_RGB;
+				imageInfo.attributeBitsPerPixel = output == RGB_U24 ? 0 : 8;
+			}
+
+			outputBitsPerPixel = imageInfo.decodedBitsPerPixel(options);
+
+			if (outputBitsPerPixel == 0 || (outputBitsPerPixel & 0x07) != 0) {
+				return GWTGA_UNSUPPORTED_PIXEL_DEPTH;
+			}
+
+			input.skip(header.iDLength);
+
+			if (imageInfo.hasColorMap()) {
+				colorMapBytes.resize(imageInfo.colorMapSize());
+				input.read(&colorMapBytes[0], colorMapBytes.size());
+
+				if (input.fail()) {
+					return GWTGA_IO_ERROR;
+				}
+			}
+
+			inputPixelSize = imageInfo.bitsPerPixel / 8;
+			decodedPixelSize = resolveColorMap ? outputBitsPerPixel / 8 : inputPixelSize;
+
+			fetchPixel = fetchPixelUncompressed;
+			fetchPixels = fetchPixelsUncompressed;
+
+			if (resolveColorMap) {
+
+				if (stored != UNKNOWN_FORMAT) {
+					std::vector<char> converted(imageInfo.colorMapLength * decodedPixelSize);
+					convertPixels(&converted[0], &colorMapBytes[0], stored, output, imageInfo.colorMapLength);
+					colorMapBytes.swap(converted);
+				}
+
+				if (inputPixelSize == 1 && decodedPixelSize <= 4) {
+					colorTable = new TGAColorTable;
+					buildColorTable(*colorTable, &colorMapBytes[0], imageInfo.colorMapLength, decodedPixelSize);
+
+					fetchPixel = fetchPixelColorTable;
+					fetchPixels = fetchPixelsColorTable;
+					colorMapData = (char*) colorTable->entries;
+				} else {
+					fetchPixel = fetchPixelColorMap;
+					fetchPixels = fetchPixelsColorMap;
+					colorMapData = &colorMapBytes[0];
+				}
+
+			} else if (stored != UNKNOWN_FORMAT) {
+				// Pixels are decoded as stored to row buffer and converted to target
+				convert = true;
+				storedFormat = stored;
+				outputFormat = output;
+				rowBuffer.resize(imageInfo.width * inputPixelSize);
+			}
+
+			return GWTGA_NONE;
+		}
+
+		template<class Input>
+		bool TGAReader::readRow(Input &input, char* target) {
+
+			char* row = convert ? &rowBuffer[0] : target;
+			size_t width = imageInfo.width;
+
+			if (!imageInfo.rleCompressed) {
+				const char* pixels = input.fetch(width * inputPixelSize);
+
+				if (!pixels) {
+					return false;
+				}
+
+				fetchPixels(row, pixels, inputPixelSize, colorMapData, decodedPixelSize, width);
+
+			} else {
+
+				// Packet left from previous row is finished first
+				for (size_t x = 0; x < width; ) {
+
+					if (packetRemaining == 0) {
+						const char* packetHeader = input.fetch(1);
+
+						if (!packetHeader) {
+							return false;
+						}
+
+						packetRemaining = (*packetHeader & 0x7F) + 1;
+						rlePacket = (*packetHeader & 0x80) == 0x80;
+
+						if (rlePacket) {
+							const char* color = input.fetch(inputPixelSize);
+
+							if (!color) {
+								return false;
+							}
+
+							fetchPixel(packetColor, color, inputPixelSize, colorMapData, decodedPixelSize);
+						}
+					}
+
+					size_t count = width - x < packetRemaining ? width - x : packetRemaining;
+
+					if (rlePacket) {
+						fillPixels(&row[x * decodedPixelSize], packetColor, decodedPixelSize, count);
+					} else {
+						const char* pixels = input.fetch(count * inputPixelSize);
+
+						if (!pixels) {
+							return false;
+						}
+
+						fetchPixels(&row[x * decodedPixelSize], pixels, inputPixelSize, colorMapData, decodedPixelSize, count);
+					}
+
+					packetRemaining -= count;
+					x += count;
+				}
+
+				if (nextRow + 1 == imageInfo.height && packetRemaining > 0) {
+					// Last packet does not fit into image
+					return false;
+				}
+			}
+
+			if (convert) {
+				convertPixels(target, row, (TGAFormat) storedFormat, (TGAFormat) outputFormat, width);
+			}
+
+			return true;
+		}
+
+		unsigned char TGAImageInfo::decodedBitsPerPixel(TGAOptions options) const {
+
+			bool returnColorMap = (options & GWTGA_RETURN_COLOR_MAP) == GWTGA_RETURN_COLOR_MAP;
+			TGAFormat outputFormat = getOutputFormat(options);
+
+			// Color map of RGB and greyscale images is not used for decoding
+			bool colorMapped = imageType == 1 || imageType == 9;
+
+			if (outputFormat != UNKNOWN_FORMAT && !(colorMapped && returnColorMap)) {
+				return (unsigned char) (getFormatSize(outputFormat) * 8);
+			}
+
+			if (!colorMapped || returnColorMap) {
+				return bitsPerPixel;
+			} else {
+				return colorMapBitsPerPixel;
+			}
+		}
+
+		size_t TGAImageInfo::decodedSize(TGAOptions options) const {
+
+			if ((options & (GWTGA_GENERATE_MIPMAPS | GWTGA_MIPMAPS_SRGB)) != 0) {
+				return getMipChainPixels(width, height) * (decodedBitsPerPixel(options) / 8);
+			}
+
+			return (size_t) width * height * (decodedBitsPerPixel(options) / 8);
+		}
+
+		size_t TGAImage::mipOffset(unsigned int level) const {
+
+			size_t offset = 0;
+
+			for (unsigned int i = 0; i < level; i++) {
+				offset += (size_t) mipWidth(i) * mipHeight(i);
+			}
+
+			return offset * (bitsPerPixel / 8);
+		}
+
+		TGAImagePtr::TGAImagePtr(TGAImagePtr &&other) : image(other.image), owner(other.owner) {
+			other.image = TGAImage();
+			other.owner = NULL;
+		}
+
+		TGAImagePtr& TGAImagePtr::operator=(TGAImagePtr &&other) {
+
+			if (this != &other) {
+				reset();
+
+				image = other.image;
+				owner = other.owner;
+
+				other.image = TGAImage();
+				other.owner = NULL;
+			}
+
+			return *this;
+		}
+
+		TGAImage TGAImagePtr::release() {
+
+			TGAImage result = image;
+
+			image = TGAImage();
+			owner = NULL;
+
+			return result;
+		}
+
+		void TGAImagePtr::reset() {
+
+			if (owner) {
+				if (image.bytes) {
+					owner->release(image.bytes, GWTGA_IMAGE_DATA);
+				}
+
+				if (image.colorMap.bytes) {
+					owner->release(image.colorMap.bytes, GWTGA_COLOR_PALETTE);
+				}
+			} else {
+				delete[] image.bytes;
+				delete[] image.colorMap.bytes;
+			}
+
+			image = TGAImage();
+			owner = NULL;
+		}
+
+		TGAError SaveTga(char* fileName, const TGAImage &image) {
+			return SaveTga(fileName, image, GWTGA_OPTIONS_NONE);
+		}
+
+		TGAError SaveTga(std::ostream &stream, const TGAImage &image) {
+			return SaveTga(stream, image, GWTGA_OPTIONS_NONE);
+		}
+
+		TGAError SaveTga(char* fileName, const TGAImage &image, TGAOptions options) {
+
+			std::ofstream fileStream;
+			fileStream.open(fileName, std::ofstream::out | std::ofstream::binary);
+
+			if (fileStream.fail()) {
+				return GWTGA_CANNOT_OPEN_FILE; 
+			}
+
+			TGAError err = SaveTga(fileStream, image, options);
+
+			fileStream.close();
+
+			return err;
+		}
+
+		TGAError SaveTga(std::ostream &stream, const TGAImage &image, TGAOptions options) {
+
+			if (image.hasError()) {
+				// Input image is in error state
+				return GWTGA_INVALID_DATA;
+			}
+
+			// Parse options
+			bool useRLEcompression = (options & (GWTGA_COMPRESS_RLE | GWTGA_COMPRESS_RLE_OPTIMAL)) != 0;
+			bool useOptimalRLE = ((options & GWTGA_COMPRESS_RLE_OPTIMAL) == GWTGA_COMPRESS_RLE_OPTIMAL);
+			bool useScanLineTable = useRLEcompression && ((options & GWTGA_SCAN_LINE_TABLE) == GWTGA_SCAN_LINE_TABLE);
+			unsigned int threadCount = ((options & GWTGA_PARALLEL_ENCODE) == GWTGA_PARALLEL_ENCODE) ? getThreadCount() : 1;
+			bool flipVertically = ((options & GWTGA_FLIP_VERTICALLY) == GWTGA_FLIP_VERTICALLY);
+			bool flipHorizontally = ((options & GWTGA_FLIP_HORIZONTALLY) == GWTGA_FLIP_HORIZONTALLY);
+
+			// Everything is staged in blocks and written to stream at once, recorder outlives output so that it sees last write
+			GWTGA_STATS_RECORDER(statsRecorder);
+			TGAStreamOutput output(stream);
+
+			TGAError err = writeHeader(output, image, useRLEcompression);
+
+			if (err != GWTGA_NONE) {
+				return err;
+			}
+
+			recordStage(GWTGA_STAGE_PIXELS);
+
+			size_t pixelDataOffset = output.size();
+			unsigned char bytesPerPixel = image.bitsPerPixel / 8;
+
+			// Write pixel data
+			if (useRLEcompression) {
+				std::vector<size_t> rowOffsets;
+
+				if (!compressRLE(output, image.bytes, image.width, image.height, bytesPerPixel, flipVertically, flipHorizontally, useOptimalRLE, threadCount, useScanLineTable ? &rowOffsets : NULL)) {
+					return GWTGA_IO_ERROR;
+				}
+
+				if (useScanLineTable) {
+					recordStage(GWTGA_STAGE_FOOTER);
+
+					if (!writeScanLineTable(output, pixelDataOffset, rowOffsets, image.attributeBitsPerPixel)) {
+						return GWTGA_IO_ERROR;
+					}
+				}
+			} else if (!flipVertically && !flipHorizontally) {
+				// NO PROCESSING
+				output.write(image.bytes, image.width * image.height * bytesPerPixel);
+			} else {
+				// PROCESSING - Flip rows
+				writeFlippedRows(output, image.bytes, image.width, image.height, bytesPerPixel, flipVertically, flipHorizontally);
+			}
+
+			output.flush();
+			recordBytesWritten(output.size());
+
+			if (stream.fail()) {
+				return GWTGA_IO_ERROR;
+			}
+
+			return GWTGA_NONE;
+		}
+
+		TGAWriter::TGAWriter() : fileStream(NULL), stream(NULL), output(NULL), writeError(GWTGA_NONE) {
+			close();
+		}
+
+		TGAWriter::~TGAWriter() {
+			close();
+		}
+
+		TGAError TGAWriter::open(char* fileName, const TGAImage &layout, TGAOptions options) {
+
+			close();
+
+			fileStream = new std::ofstream(fileName, std::ofstream::out | std::ofstream::binary);
+
+			if (fileStream->fail()) {
+				close();
+				writeError = GWTGA_CANNOT_OPEN_FILE;
+				return writeError;
+			}
+
+			stream = fileStream;
+
+			TGAError err = start(layout, options);
+
+			if (err != GWTGA_NONE) {
+				// Writer stays closed, file without header is not left behind
+				close();
+				remove(fileName);
+				writeError = err;
+			}
+
+			return err;
+		}
+
+		TGAError TGAWriter::open(std::ostream &stream, const TGAImage &layout, TGAOptions options) {
+
+			close();
+
+			this->stream = &stream;
+
+			TGAError err = start(layout, options);
+
+			if (err != GWTGA_NONE) {
+				close();
+				writeError = err;
+			}
+
+			return err;
+		}
+
+		TGAError TGAWriter::close() {
+
+			// Error of failed open is reported by error() only
+			TGAError err = isOpen() ? writeError : GWTGA_NONE;
+
+			if (output) {
+				if (err == GWTGA_NONE && nextRow < height) {
+					// Image is not complete
+					err = GWTGA_INVALID_DATA;
+				}
+
+				if (err == GWTGA_NONE && useScanLineTable) {
+					rowOffsets[height] = output->size() - pixelDataOffset;
+
+					if (!writeScanLineTable(*output, pixelDataOffset, rowOffsets, attributeBitsPerPixel)) {
+						err = GWTGA_IO_ERROR;
+					}
+				}
+
+				output->flush();
+
+				if (err == GWTGA_NONE && stream->fail()) {
+					err = GWTGA_IO_ERROR;
+				}
+			}
+
+			delete output;
+			delete fileStream;
+
+			output = NULL;
+			fileStream = NULL;
+			stream = NULL;
+
+			writeError = GWTGA_NONE;
+			width = 0;
+			height = 0;
+			nextRow = 0;
+			bytesPerPixel = 0;
+			attributeBitsPerPixel = 0;
+			useRLEcompression = false;
+			useOptimalRLE = false;
+			useScanLineTable = false;
+			flipHorizontally = false;
+			threadCount = 1;
+
+			pixelDataOffset = 0;
+			std::vector<size_t>().swap(rowOffsets);
+
+			return err;
+		}
+
+		TGAError TGAWriter::writeRows(const char* source, unsigned int rowCount) {
+
+			if (!isOpen() || writeError != GWTGA_NONE) {
+				return isOpen() ? writeError : GWTGA_INVALID_DATA;
+			}
+
+			if (rowCount > height - nextRow) {
+				// More rows than image has left
+				return GWTGA_INVALID_DATA;
+			}
+
+			if (useRLEcompression) {
+				// Packets end with the batch, offsets of its rows are relative to its beginning
+				std::vector<size_t> batchOffsets;
+				size_t batchOffset = output->size() - pixelDataOffset;
+
+				if (!compressRLE(*output, source, width, rowCount, bytesPerPixel, false, flipHorizontally, useOptimalRLE, threadCount, useScanLineTable ? &batchOffsets : NULL)) {
+					writeError = GWTGA_IO_ERROR;
+					return writeError;
+				}
+
+				if (useScanLineTable) {
+					for (unsigned int y = 0; y < rowCount; y++) {
+						rowOffsets[nextRow + y] = batchOffset + batchOffsets[y];
+					}
+				}
+			} else if (!flipHorizontally) {
+				output->write(source, rowCount * rowSize());
+			} else {
+				writeFlippedRows(*output, source, width, rowCount, bytesPerPixel, false, true);
+			}
+
+			if (output->fail()) {
+				writeError = GWTGA_IO_ERROR;
+				return writeError;
+			}
+
+			nextRow += rowCount;
+
+			return GWTGA_NONE;
+		}
+
+		TGAError TGAWriter::start(const TGAImage &layout, TGAOptions options) {
+
+			if (layout.hasError()) {
+				// Input image is in error state
+				return GWTGA_INVALID_DATA;
+			}
+
+			if ((options & GWTGA_FLIP_VERTICALLY) == GWTGA_FLIP_VERTICALLY) {
+				// Last row would have to be written first
+				return GWTGA_INVALID_DATA;
+			}
+
+			// Header is checked before anything is written, block of rejected header does not reach the stream
+			output = new TGAStreamOutput(*stream);
+
+			useRLEcompression = (options & (GWTGA_COMPRESS_RLE | GWTGA_COMPRESS_RLE_OPTIMAL)) != 0;
+			useOptimalRLE = ((options & GWTGA_COMPRESS_RLE_OPTIMAL) == GWTGA_COMPRESS_RLE_OPTIMAL);
+			useScanLineTable = useRLEcompression && ((options & GWTGA_SCAN_LINE_TABLE) == GWTGA_SCAN_LINE_TABLE);
+			threadCount = ((options & GWTGA_PARALLEL_ENCODE) == GWTGA_PARALLEL_ENCODE) ? getThreadCount() : 1;
+			flipHorizontally = ((options & GWTGA_FLIP_HORIZONTALLY) == GWTGA_FLIP_HORIZONTALLY);
+
+			TGAError err = writeHeader(*output, layout, useRLEcompression);
+
+			if (err != GWTGA_NONE) {
+				return err;
+			}
+
+			width = layout.width;
+			height = layout.height;
+			bytesPerPixel = layout.bitsPerPixel / 8;
+			attributeBitsPerPixel = layout.attributeBitsPerPixel;
+
+			pixelDataOffset = output->size();
+
+			if (useScanLineTable) {
+				rowOffsets.resize(height + 1);
+			}
+
+			return GWTGA_NONE;
+		}
+
+		namespace details {
+
+			// Header in front of every block, padded to alignment of returned memory
+			struct TGAPoolBlock {
+				TGAPoolBlock* next; //< Next free block of the same class
+				size_t sizeClass;
+				size_t classSize;
+				size_t mappedSize; //< Size of huge page mapping, 0 when block is allocated from heap
+			};
+
+			const size_t TGA_POOL_BLOCK_HEADER = 64;
+			const size_t TGA_POOL_SIZE_CLASSES = 4 * 64;
+
+			class TGAMemoryPool {
+			public:
+				TGAMemoryPool(size_t maxCachedBytes, size_t hugePageThreshold);
+				~TGAMemoryPool();
+
+				char* allocate(size_t size);
+				void release(char* memory);
+				void trim();
+				size_t cachedBytes();
+
+			private:
+				TGAMemoryPool(const TGAMemoryPool&);
+				TGAMemoryPool& operator=(const TGAMemoryPool&);
+
+				static size_t getSizeClass(size_t size, size_t &classSize);
+				static void freeBlock(TGAPoolBlock* block);
+
+				size_t maxCachedBytes;
+				size_t hugePageThreshold;
+
+				std::mutex mutex;
+				TGAPoolBlock* freeLists[TGA_POOL_SIZE_CLASSES];
+				size_t cached;
+			};
+		}
+
+		TGAPoolListener::TGAPoolListener() : pool(new TGAMemoryPool(0, 0)) {
+		}
+
+		TGAPoolListener::TGAPoolListener(size_t maxCachedBytes, size_t hugePageThreshold) : pool(new TGAMemoryPool(maxCachedBytes, hugePageThreshold)) {
+		}
+
+		TGAPoolListener::~TGAPoolListener() {
+			delete pool;
+		}
+
+		char* TGAPoolListener::operator()(const unsigned int &bitsPerPixel, const unsigned int &width, const unsigned int &height, TGAMemoryType) {
+			return pool->allocate((size_t) width * height * (bitsPerPixel / 8));
+		}
+
+		void TGAPoolListener::release(char* memory, TGAMemoryType) {
+			pool->release(memory);
+		}
+
+		void TGAPoolListener::release(TGAImage &image) {
+			pool->release(image.bytes);
+			pool->release(image.colorMap.bytes);
+
+			image.bytes = NULL;
+			image.colorMap.bytes = NULL;
+		}
+
+		void TGAPoolListener::trim() {
+			pool->trim();
+		}
+
+		size_t TGAPoolListener::cachedBytes() const {
+			return pool->cachedBytes();
+		}
+
+		TGAFileMapping::TGAFileMapping() : address(NULL), length(0) {
+#ifdef _WIN32
+			fileHandle = NULL;
+			mappingHandle = NULL;
+#endif
+		}
+
+		TGAFileMapping::~TGAFileMapping() {
+			close();
+		}
+
+		TGAError TGAFileMapping::open(char* fileName) {
+
+			close();
+
+#ifdef _WIN32
+			HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+			if (file == INVALID_HANDLE_VALUE) {
+				return GWTGA_CANNOT_OPEN_FILE;
+			}
+
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+				// Empty files cannot be mapped
+				CloseHandle(file);
+				return GWTGA_IO_ERROR;
+			}
+
+			HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+			if (mapping == NULL) {
+				CloseHandle(file);
+				return GWTGA_IO_ERROR;
+			}
+
+			void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+			if (view == NULL) {
+				CloseHandle(mapping);
+				CloseHandle(file);
+				return GWTGA_IO_ERROR;
+			}
+
+			fileHandle = file;
+			mappingHandle = mapping;
+			address = (const char*) view;
+			length = (size_t) fileSize.QuadPart;
+#else
+			int file = ::open(fileName, O_RDONLY);
+
+			if (file < 0) {
+				return GWTGA_CANNOT_OPEN_FILE;
+			}
+
+			struct stat fileInfo;
+			if (fstat(file, &fileInfo) != 0 || !S_ISREG(fileInfo.st_mode) || fileInfo.st_size == 0) {
+				// Only non-empty regular files can be mapped
+				::close(file);
+				return GWTGA_IO_ERROR;
+			}
+
+			void* view = mmap(NULL, (size_t) fileInfo.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+
+			// Mapping stays valid after the descriptor is closed
+			::close(file);
+
+			if (view == MAP_FAILED) {
+				return GWTGA_IO_ERROR;
+			}
+
+			// Pixel data are mostly read front to back
+			madvise(view, (size_t) fileInfo.st_size, MADV_SEQUENTIAL);
+
+			address = (const char*) view;
+			length = (size_t) fileInfo.st_size;
+#endif
+
+			return GWTGA_NONE;
+		}
+
+		void TGAFileMapping::close() {
+
+			if (address == NULL) return;
+
+#ifdef _WIN32
+			UnmapViewOfFile(address);
+			CloseHandle(mappingHandle);
+			CloseHandle(fileHandle);
+			fileHandle = NULL;
+			mappingHandle = NULL;
+#else
+			munmap((void*) address, length);
+#endif
+
+			address = NULL;
+			length = 0;
+		}
+
+		namespace details {
+
+			uint16_t readUInt16(const char* bytes) {
+				const uint8_t* b = (const uint8_t*) bytes;
+				return (uint16_t) (b[0] | (b[1] << 8));
+			}
+
+			uint32_t readUInt32(const char* bytes) {
+				const uint8_t* b = (const uint8_t*) bytes;
+				return (uint32_t) b[0] | ((uint32_t) b[1] << 8) | ((uint32_t) b[2] << 16) | ((uint32_t) b[3] << 24);
+			}
+
+			void writeUInt16(char* bytes, uint16_t value) {
+				bytes[0] = (char) (value & 0xFF);
+				bytes[1] = (char) (value >> 8);
+			}
+
+			void writeUInt32(char* bytes, uint32_t value) {
+				writeUInt16(bytes, (uint16_t) (value & 0xFFFF));
+				writeUInt16(bytes + 2, (uint16_t) (value >> 16));
+			}
+
+			TGAError writeHeader(TGAStreamOutput &output, const TGAImage &image, bool useRLEcompression) {
+
+				// Assert height and width and origin coords is 16-bit unsigned int
+				if (image.width > 0xFFFF || image.height > 0xFFFF || image.xOrigin > 0xFFFF || image.yOrigin > 0xFFFF) {
+					// Invalid image dimensions
+					return GWTGA_INVALID_DATA;
+				}
+
+				// Assert height and width are non-null
+				if (image.width == 0 || image.height == 0) {
+					// Invalid image dimensions
+					return GWTGA_INVALID_DATA;
+				}
+
+				if ((image.bitsPerPixel & 0x07) != 0) {
+					// Bits per pixel has to be divisible by 8
+					return GWTGA_UNSUPPORTED_PIXEL_DEPTH;
+				}
+
+				if (image.hasColorMap() && (image.colorMap.bitsPerPixel & 0x07) != 0) {
+					// Bits per pixel has to be divisible by 8 for color map too
+					return GWTGA_UNSUPPORTED_PIXEL_DEPTH;
+				}
+
+				// Build header
+				TGAHeader header;
+				header.iDLength = 0;
+				header.colorMapType = image.hasColorMap() ? 1 : 0;
+
+				switch (image.colorType) {
+				case GWTGA_RGB:
+					if (header.colorMapType == 1) {
+						if (useRLEcompression) {
+							header.ImageType = 9; //< Runlength encoded color-mapped image
+						} else {
+							header.ImageType = 1; //< Uncompressed color-mapped image
+						}
+					} else {
+						if (useRLEcompression) {
+							header.ImageType = 10; //< Runlength encoded RGB
+						} else {
+							header.ImageType = 2; //< Uncompressed RGB 
+						}
+					}
+					break;
+				case GWTGA_GREYSCALE:
+					if (header.colorMapType == 1) {
+						// TGA does not support greyscale color mapped images
+						return GWTGA_INVALID_DATA;
+					} else {
+						if (useRLEcompression) {
+							header.ImageType = 11; //< Runlength encoded black and white image
+						} else {
+							header.ImageType = 3; //< Uncompressed greyscale
+						}
+					}
+					break;
+				default:
+					// Unknown color type provided
+					return GWTGA_INVALID_DATA;
+				}
+
+				header.colorMapSpec.colorMapEntrySize = image.colorMap.bitsPerPixel;
+				header.colorMapSpec.colorMapLength = image.colorMap.length;
+				header.colorMapSpec.firstEntryIndex = 0;
+
+				header.imageSpec.xOrigin = image.xOrigin;
+				header.imageSpec.yOrigin = image.yOrigin;
+				header.imageSpec.width = image.width;
+				header.imageSpec.height = image.height;
+				header.imageSpec.bitsPerPixel = image.bitsPerPixel;
+
+				switch (image.origin) {
+				case GWTGA_BOTTOM_LEFT:
+					header.imageSpec.imgDescriptor = 0x00;
+					break;
+				case GWTGA_BOTTOM_RIGHT:
+					header.imageSpec.imgDescriptor = 0x10;
+					break;
+				case GWTGA_TOP_LEFT:
+					header.imageSpec.imgDescriptor = 0x20;
+					break;
+				case GWTGA_TOP_RIGHT:
+					header.imageSpec.imgDescriptor = 0x30;
+					break;
+				default:
+					// Unknown origin provided
+					return GWTGA_INVALID_DATA;
+				}
+
+				// Store "attribute bites per pixel" to LSB
+				header.imageSpec.imgDescriptor |= image.attributeBitsPerPixel & 0x0F;
+
+				// Write TGA header
+				output.write((char*)&header.iDLength, sizeof(header.iDLength));
+				output.write((char*)&header.colorMapType, sizeof(header.colorMapType));
+				output.write((char*)&header.ImageType, sizeof(header.ImageType));
+				output.write((char*)&header.colorMapSpec.firstEntryIndex, sizeof(header.colorMapSpec.firstEntryIndex));
+				output.write((char*)&header.colorMapSpec.colorMapLength, sizeof(header.colorMapSpec.colorMapLength));
+				output.write((char*)&header.colorMapSpec.colorMapEntrySize, sizeof(header.colorMapSpec.colorMapEntrySize));
+				output.write((char*)&header.imageSpec.xOrigin, sizeof(header.imageSpec.xOrigin));
+				output.write((char*)&header.imageSpec.yOrigin, sizeof(header.imageSpec.yOrigin));
+				output.write((char*)&header.imageSpec.width, sizeof(header.imageSpec.width));
+				output.write((char*)&header.imageSpec.height, sizeof(header.imageSpec.height));
+				output.write((char*)&header.imageSpec.bitsPerPixel, sizeof(header.imageSpec.bitsPerPixel));
+				output.write((char*)&header.imageSpec.imgDescriptor, sizeof(header.imageSpec.imgDescriptor));
+
+				// Write color map
+				recordStage(GWTGA_STAGE_COLOR_MAP);
+
+				if (image.hasColorMap()) {
+					output.write(image.colorMap.bytes, image.colorMap.length * (image.colorMap.bitsPerPixel / 8));
+				}
+
+				return GWTGA_NONE;
+			}
+
+			bool writeScanLineTable(TGAStreamOutput &output, size_t pixelDataOffset, const std::vector<size_t> &rowOffsets, unsigned char attributeBitsPerPixel) {
+
+				// Last offset is size of pixel data
+				size_t rowCount = rowOffsets.size() - 1;
+				size_t extensionOffset = pixelDataOffset + rowOffsets.back();
+				size_t tableOffset = extensionOffset + TGA_EXTENSION_SIZE;
+
+				if ((uint64_t) tableOffset + rowCount * 4 + TGA_FOOTER_SIZE > 0xFFFFFFFF) {
+					// TGA 2.0 offsets are 32-bit, leave file without footer
+					return true;
+				}
+
+				// Extension area with all fields empty, except scan line table and attributes type
+				char extension[TGA_EXTENSION_SIZE];
+				memset(extension, 0, sizeof(extension));
+
+				writeUInt16(extension, (uint16_t) TGA_EXTENSION_SIZE);
+				writeUInt32(extension + TGA_EXTENSION_SCAN_LINE_OFFSET, (uint32_t) tableOffset);
+				extension[TGA_EXTENSION_SIZE - 1] = attributeBitsPerPixel > 0 ? 3 : 0; //< 3 - useful alpha channel data
+
+				output.write(extension, sizeof(extension));
+
+				std::vector<char> table(rowCount * 4);
+
+				for (size_t i = 0; i < rowCount; i++) {
+					writeUInt32(&table[i * 4], (uint32_t) (pixelDataOffset + rowOffsets[i]));
+				}
+
+				if (!table.empty()) {
+					output.write(&table[0], table.size());
+				}
+
+				char footer[TGA_FOOTER_SIZE];
+
+				writeUInt32(footer, (uint32_t) extensionOffset);
+				writeUInt32(footer + 4, 0);
+				memcpy(footer + 8, "TRUEVISION-XFILE", 16);
+				footer[24] = '.';
+				footer[25] = 0;
+
+				output.write(footer, sizeof(footer));
+
+				return !output.fail();
+			}
+
+			void parseHeader(const char* bytes, TGAHeader &header) {
+
+				// TGA is little endian, fields are not aligned
+				header.iDLength = bytes[0];
+				header.colorMapType = bytes[1];
+				header.ImageType = bytes[2];
+				header.colorMapSpec.firstEntryIndex = readUInt16(bytes + 3);
+				header.colorMapSpec.colorMapLength = readUInt16(bytes + 5);
+				header.colorMapSpec.colorMapEntrySize = bytes[7];
+				header.imageSpec.xOrigin = readUInt16(bytes + 8);
+				header.imageSpec.yOrigin = readUInt16(bytes + 10);
+				header.imageSpec.width = readUInt16(bytes + 12);
+				header.imageSpec.height = readUInt16(bytes + 14);
+				header.imageSpec.bitsPerPixel = bytes[16];
+				header.imageSpec.imgDescriptor = bytes[17];
+			}
+
+			bool parseFooter(const char* bytes, TGAFooter &footer) {
+
+				footer.extensionOffset = readUInt32(bytes);
+				footer.devAreaOffset = readUInt32(bytes + 4);
+				memcpy(footer.signature, bytes + 8, sizeof(footer.signature));
+				footer.dot = bytes[24];
+				footer.null = bytes[25];
+
+				return memcmp(footer.signature, "TRUEVISION-XFILE", sizeof(footer.signature)) == 0 && footer.dot == '.' && footer.null == 0;
+			}
+
+			size_t getImageDataSize(const TGAHeader &header) {
+
+				if (header.ImageType >= 9) {
+					// End of RLE packets is not known before they are decoded
+					return TGAStreamInput::noLimit;
+				}
+
+				size_t colorMapSize = (size_t) header.colorMapSpec.colorMapLength * ((header.colorMapSpec.colorMapEntrySize + 7) / 8);
+				size_t pixelDataSize = (size_t) header.imageSpec.width * header.imageSpec.height * ((header.imageSpec.bitsPerPixel + 7) / 8);
+
+				return header.iDLength + colorMapSize + pixelDataSize;
+			}
+
+			void getImageInfo(const TGAHeader &header, TGAImageInfo &info) {
+
+				info.width = header.imageSpec.width;
+				info.height = header.imageSpec.height;
+				info.xOrigin = header.imageSpec.xOrigin;
+				info.yOrigin = header.imageSpec.yOrigin;
+				info.bitsPerPixel = header.imageSpec.bitsPerPixel;
+				info.attributeBitsPerPixel = header.imageSpec.imgDescriptor & 0x0F;
+
+				switch (header.imageSpec.imgDescriptor & 0x30) {
+				case 0x00:
+					info.origin = GWTGA_BOTTOM_LEFT;
+					break;
+				case 0x10:
+					info.origin = GWTGA_BOTTOM_RIGHT;
+					break;
+				case 0x20:
+					info.origin = GWTGA_TOP_LEFT;
+					break;
+				case 0x30:
+					info.origin = GWTGA_TOP_RIGHT;
+					break;
+				}
+
+				switch (header.ImageType) {
+				case 1:
+				case 2:
+				case 9:
+				case 10:
+					info.colorType = GWTGA_RGB;
+					break;
+				case 3:
+				case 11:
+					info.colorType = GWTGA_GREYSCALE;
+					break;
+				}
+
+				info.imageType = header.ImageType;
+				info.rleCompressed = header.ImageType == 9 || header.ImageType == 10 || header.ImageType == 11;
+
+				info.colorMapFirstEntry = header.colorMapSpec.firstEntryIndex;
+				info.colorMapLength = header.colorMapSpec.colorMapLength;
+				info.colorMapBitsPerPixel = header.colorMapSpec.colorMapEntrySize;
+
+				info.colorMapOffset = TGA_HEADER_SIZE + header.iDLength;
+				info.pixelDataOffset = info.colorMapOffset + info.colorMapSize();
+
+				if ((info.bitsPerPixel & 0x07) != 0 || (info.hasColorMap() && (info.colorMapBitsPerPixel & 0x07) != 0) || info.bitsPerPixel > 16 * 8) {
+					// Pixels have to be byte aligned and at most 16 bytes long
+					info.error = GWTGA_UNSUPPORTED_PIXEL_DEPTH;
+				}
+			}
+
+			TGAFormat getStoredFormat(TGAColorType colorType, size_t bitsPerPixel, size_t attributeBitsPerPixel) {
+
+				if (colorType == GWTGA_GREYSCALE) {
+					switch (bitsPerPixel) {
+					case 8:
+						return LUMINANCE_U8;
+					case 16:
+						return LUMINANCE_ALPHA_U16;
+					default:
+						return UNKNOWN_FORMAT;
+					}
+				}
+
+				switch (bitsPerPixel) {
+				case 16:
+					// Top bit is alpha only when attribute bits say so, otherwise 16-bit pixels are opaque
+					return attributeBitsPerPixel > 0 ? BGRA5551_U16 : BGR555_U16;
+				case 24:
+					return BGR_U24;
+				case 32:
+					return BGRA_U32;
+				default:
+					return UNKNOWN_FORMAT;
+				}
+			}
+
+			TGAFormat getOutputFormat(TGAOptions options) {
+
+				if ((options & GWTGA_OUTPUT_RGBA8) == GWTGA_OUTPUT_RGBA8) {
+					return RGBA_U32;
+				} else if ((options & GWTGA_OUTPUT_RGB8) == GWTGA_OUTPUT_RGB8) {
+					return RGB_U24;
+				} else if ((options & GWTGA_OUTPUT_BGRA8) == GWTGA_OUTPUT_BGRA8) {
+					return BGRA_U32;
+				} else {
+					return UNKNOWN_FORMAT;
+				}
+			}
+
+			size_t getFormatSize(TGAFormat format) {
+
+				switch (format) {
+				case LUMINANCE_U8:
+					return 1;
+				case LUMINANCE_ALPHA_U16:
+				case BGR555_U16:
+				case BGRA5551_U16:
+					return 2;
+				case BGR_U24:
+				case RGB_U24:
+					return 3;
+				case BGRA_U32:
+				case RGBA_U32:
+					return 4;
+				default:
+					return 0;
+				}
+			}
+
+			void getFooterInfo(const char* bytes, size_t fileSize, TGAImageInfo &info) {
+
+				TGAFooter footer;
+
+				if (!parseFooter(bytes, footer)) {
+					// Original TGA format without footer
+					return;
+				}
+
+				info.hasFooter = true;
+
+				// Ignore offsets pointing outside of file
+				if (footer.extensionOffset < fileSize) {
+					info.extensionOffset = footer.extensionOffset;
+				}
+
+				if (footer.devAreaOffset < fileSize) {
+					info.developerAreaOffset = footer.devAreaOffset;
+				}
+			}
+
+			void setValidationIssue(TGAValidation &result, TGAValidationIssue issue, size_t offset) {
+
+				result.issue = issue;
+				result.offset = offset;
+
+				// Same errors as LoadTga returns when it runs into the issue
+				switch (issue) {
+				case GWTGA_VALID:
+					result.error = GWTGA_NONE;
+					break;
+				case GWTGA_UNREADABLE:
+					result.error = GWTGA_CANNOT_OPEN_FILE;
+					break;
+				case GWTGA_TRUNCATED_HEADER:
+				case GWTGA_TRUNCATED_COLOR_MAP:
+				case GWTGA_TRUNCATED_PIXEL_DATA:
+				case GWTGA_PACKET_OVERRUN:
+					result.error = GWTGA_IO_ERROR;
+					break;
+				case GWTGA_BAD_PIXEL_DEPTH:
+					result.error = GWTGA_UNSUPPORTED_PIXEL_DEPTH;
+					break;
+				default:
+					result.error = GWTGA_INVALID_DATA;
+					break;
+				}
+			}
+
+			template<class Input>
+			TGAValidation validateTga(Input &input, ITGABlockReader* reader, size_t fileSize) {
+
+				TGAValidation result;
+				TGAValidation footerResult;
+				TGAFooterAreas areas;
+
+				// Input has not read anything yet, so reader may move stream around
+				if (reader != NULL) {
+					validateFooter(*reader, fileSize, areas, footerResult);
+				}
+
+				size_t pixelDataEnd = validateImage(input, areas, result);
+
+				if (result.hasError()) {
+					return result;
+				}
+
+				if (footerResult.hasError()) {
+					return footerResult;
+				}
+
+				validateAreas(areas, pixelDataEnd, result);
+
+				return result;
+			}
+
+			void validateHeader(const TGAHeader &header, const TGAImageInfo &info, TGAValidation &result) {
+
+				// Offsets of header fields are reported
+				const size_t colorMapTypeField = 1;
+				const size_t imageTypeField = 2;
+				const size_t colorMapEntrySizeField = 7;
+				const size_t bitsPerPixelField = 16;
+
+				bool colorMapped = header.ImageType == 1 || header.ImageType == 9;
+
+				if (!colorMapped && header.ImageType != 2 && header.ImageType != 3 && header.ImageType != 10 && header.ImageType != 11) {
+					// No image data or unknown type
+					setValidationIssue(result, GWTGA_UNSUPPORTED_IMAGE_TYPE, imageTypeField);
+				} else if (info.bitsPerPixel == 0 || (info.bitsPerPixel & 0x07) != 0 || info.bitsPerPixel > 16 * 8) {
+					// Pixels have to be byte aligned and at most 16 bytes long
+					setValidationIssue(result, GWTGA_BAD_PIXEL_DEPTH, bitsPerPixelField);
+				} else if (info.hasColorMap() && ((info.colorMapBitsPerPixel & 0x07) != 0 || info.colorMapBitsPerPixel > 16 * 8)) {
+					// Entries of color map are decoded as pixels
+					setValidationIssue(result, GWTGA_BAD_PIXEL_DEPTH, colorMapEntrySizeField);
+				} else if (colorMapped && (header.colorMapType != 1 || !info.hasColorMap())) {
+					setValidationIssue(result, GWTGA_MISSING_COLOR_MAP, colorMapTypeField);
+				} else if (colorMapped && info.bitsPerPixel > 24) {
+					// Color indices are at most 3 bytes long
+					setValidationIssue(result, GWTGA_BAD_PIXEL_DEPTH, bitsPerPixelField);
+				} else if (colorMapped && info.colorMapBitsPerPixel == 0) {
+					setValidationIssue(result, GWTGA_BAD_PIXEL_DEPTH, colorMapEntrySizeField);
+				}
+			}
+
+			template<class Input>
+			size_t validateImage(Input &input, const TGAFooterAreas &areas, TGAValidation &result) {
+
+				const char* headerBytes = input.fetch(TGA_HEADER_SIZE);
+
+				if (!headerBytes) {
+					setValidationIssue(result, GWTGA_TRUNCATED_HEADER, 0);
+					return 0;
+				}
+
+				TGAHeader header;
+				parseHeader(headerBytes, header);
+
+				TGAImageInfo info;
+				getImageInfo(header, info);
+
+				validateHeader(header, info, result);
+
+				if (result.hasError()) {
+					return 0;
+				}
+
+				// Image ID and color map are only walked through, any content is valid
+				if (header.iDLength > 0 && !input.fetch(header.iDLength)) {
+					setValidationIssue(result, GWTGA_TRUNCATED_COLOR_MAP, TGA_HEADER_SIZE);
+					return 0;
+				}
+
+				if (info.colorMapSize() > 0 && !input.fetch(info.colorMapSize())) {
+					setValidationIssue(result, GWTGA_TRUNCATED_COLOR_MAP, info.colorMapOffset);
+					return 0;
+				}
+
+				bool colorMapped = info.imageType == 1 || info.imageType == 9;
+				size_t pixelSize = info.bitsPerPixel / 8;
+				size_t offset = info.pixelDataOffset;
+
+				// Rows are checked against scan line table when file has one
+				const std::vector<uint32_t> &table = areas.scanLineTable;
+				bool checkRows = !table.empty();
+
+				if (!info.rleCompressed) {
+
+					size_t rowSize = info.width * pixelSize;
+
+					for (size_t y = 0; y < info.height; y++) {
+
+						if (checkRows && table[y] != offset) {
+							setValidationIssue(result, GWTGA_BAD_SCAN_LINE_TABLE, areas.scanLineTableOffset + 4 * y);
+							return 0;
+						}
+
+						const char* row = input.fetch(rowSize);
+
+						if (!row) {
+							setValidationIssue(result, GWTGA_TRUNCATED_PIXEL_DATA, offset);
+							return 0;
+						}
+
+						if (colorMapped) {
+							size_t invalid = findInvalidColorIndex(row, info.width, pixelSize, info.colorMapLength);
+
+							if (invalid < info.width) {
+								setValidationIssue(result, GWTGA_COLOR_INDEX_OUT_OF_RANGE, offset + invalid * pixelSize);
+								return 0;
+							}
+						}
+
+						offset += rowSize;
+					}
+
+					return offset;
+				}
+
+				// Packets are walked the same way as they are decoded, only color indices are looked at
+				size_t pixelCount = (size_t) info.width * info.height;
+				size_t pixel = 0;
+				size_t nextRow = 0;
+
+				while (pixel < pixelCount) {
+
+					// Every row of file with scan line table starts with a packet at offset stored in the table
+					while (checkRows && nextRow * info.width <= pixel) {
+
+						if (nextRow * info.width != pixel || table[nextRow] != offset) {
+							setValidationIssue(result, GWTGA_BAD_SCAN_LINE_TABLE, areas.scanLineTableOffset + 4 * nextRow);
+							return 0;
+						}
+
+						nextRow++;
+					}
+
+					const char* packetHeader = input.fetch(1);
+
+					if (!packetHeader) {
+						setValidationIssue(result, GWTGA_TRUNCATED_PIXEL_DATA, offset);
+						return 0;
+					}
+
+					size_t repetitionCount = (*packetHeader & 0x7F) + 1;
+					bool rlePacket = (*packetHeader & 0x80) == 0x80;
+
+					if (repetitionCount > pixelCount - pixel) {
+						setValidationIssue(result, GWTGA_PACKET_OVERRUN, offset);
+						return 0;
+					}
+
+					size_t valueCount = rlePacket ? 1 : repetitionCount;
+					const char* colorValues = input.fetch(valueCount * pixelSize);
+
+					if (!colorValues) {
+						setValidationIssue(result, GWTGA_TRUNCATED_PIXEL_DATA, offset);
+						return 0;
+					}
+
+					if (colorMapped) {
+						size_t invalid = findInvalidColorIndex(colorValues, valueCount, pixelSize, info.colorMapLength);
+
+						if (invalid < valueCount) {
+							setValidationIssue(result, GWTGA_COLOR_INDEX_OUT_OF_RANGE, offset + 1 + invalid * pixelSize);
+							return 0;
+						}
+					}
+
+					pixel += repetitionCount;
+					offset += 1 + valueCount * pixelSize;
+				}
+
+				return offset;
+			}
+
+			void validateFooter(ITGABlockReader &reader, size_t fileSize, TGAFooterAreas &areas, TGAValidation &result) {
+
+				if (fileSize < TGA_HEADER_SIZE + TGA_FOOTER_SIZE) {
+					return;
+				}
+
+				// Header is read again, it is needed for size of scan line table
+				const char* headerBytes = reader.read(0, TGA_HEADER_SIZE);
+
+				if (!headerBytes) {
+					return;
+				}
+
+				TGAHeader header;
+				parseHeader(headerBytes, header);
+
+				const char* footerBytes = reader.read(fileSize - TGA_FOOTER_SIZE, TGA_FOOTER_SIZE);
+				TGAFooter footer;
+
+				if (!footerBytes || !parseFooter(footerBytes, footer)) {
+					// Original TGA format without footer
+					return;
+				}
+
+				areas.footerOffset = fileSize - TGA_FOOTER_SIZE;
+
+				if (footer.extensionOffset != 0) {
+
+					const char* extension = NULL;
+
+					if (footer.extensionOffset <= areas.footerOffset && areas.footerOffset - footer.extensionOffset >= TGA_EXTENSION_SIZE) {
+						extension = reader.read(footer.extensionOffset, TGA_EXTENSION_SIZE);
+					}
+
+					// Extension area may be longer than TGA 2.0 defines, but not shorter
+					if (!extension || readUInt16(extension) < TGA_EXTENSION_SIZE || readUInt16(extension) > areas.footerOffset - footer.extensionOffset) {
+						setValidationIssue(result, GWTGA_BAD_FOOTER, areas.footerOffset);
+						return;
+					}
+
+					areas.extensionOffset = footer.extensionOffset;
+
+					size_t tableOffset = readUInt32(extension + TGA_EXTENSION_SCAN_LINE_OFFSET);
+					size_t rowCount = header.imageSpec.height;
+
+					// Table of empty image has no entries
+					if (tableOffset != 0 && rowCount > 0) {
+
+						const char* table = NULL;
+
+						if (tableOffset <= areas.footerOffset && (areas.footerOffset - tableOffset) / 4 >= rowCount) {
+							table = reader.read(tableOffset, rowCount * 4);
+						}
+
+						if (!table) {
+							setValidationIssue(result, GWTGA_BAD_SCAN_LINE_TABLE, areas.extensionOffset + TGA_EXTENSION_SCAN_LINE_OFFSET);
+							return;
+						}
+
+						areas.scanLineTableOffset = tableOffset;
+						areas.scanLineTable.resize(rowCount);
+
+						for (size_t y = 0; y < rowCount; y++) {
+							areas.scanLineTable[y] = readUInt32(table + 4 * y);
+						}
+					}
+				}
+
+				if (footer.devAreaOffset != 0) {
+
+					if (footer.devAreaOffset >= areas.footerOffset) {
+						setValidationIssue(result, GWTGA_BAD_FOOTER, areas.footerOffset + 4);
+						return;
+					}
+
+					areas.developerAreaOffset = footer.devAreaOffset;
+				}
+			}
+
+			void validateAreas(const TGAFooterAreas &areas, size_t pixelDataEnd, TGAValidation &result) {
+
+				// Areas follow pixel data
+				if (areas.extensionOffset != 0 && areas.extensionOffset < pixelDataEnd) {
+					setValidationIssue(result, GWTGA_BAD_FOOTER, areas.footerOffset);
+				} else if (areas.scanLineTableOffset != 0 && areas.scanLineTableOffset < pixelDataEnd) {
+					setValidationIssue(result, GWTGA_BAD_SCAN_LINE_TABLE, areas.extensionOffset + TGA_EXTENSION_SCAN_LINE_OFFSET);
+				} else if (areas.developerAreaOffset != 0 && areas.developerAreaOffset < pixelDataEnd) {
+					setValidationIssue(result, GWTGA_BAD_FOOTER, areas.footerOffset + 4);
+				}
+			}
+
+			size_t findInvalidColorIndex(const char* indices, size_t count, size_t bytesPerIndex, size_t colorMapLength) {
+
+				if (bytesPerIndex == 1 && colorMapLength >= 256) {
+					// Every 8-bit index is valid
+					return count;
+				}
+
+				// Largest index of a block is found without branching, the block is searched only when it contains invalid index
+				const size_t blockSize = 64;
+
+				for (size_t first = 0; first < count; first += blockSize) {
+
+					size_t last = first + blockSize < count ? first + blockSize : count;
+					size_t maxIndex = 0;
+
+					if (bytesPerIndex == 1) {
+						for (size_t i = first; i < last; i++) {
+							size_t index = (uint8_t) indices[i];
+							maxIndex = index > maxIndex ? index : maxIndex;
+						}
+					} else {
+						for (size_t i = first; i < last; i++) {
+							size_t index = readColorIndex(&indices[i * bytesPerIndex], bytesPerIndex);
+							maxIndex = index > maxIndex ? index : maxIndex;
+						}
+					}
+
+					if (maxIndex >= colorMapLength) {
+						for (size_t i = first; i < last; i++) {
+							if (readColorIndex(&indices[i * bytesPerIndex], bytesPerIndex) >= colorMapLength) {
+								return i;
+							}
+						}
+					}
+				}
+
+				return count;
+			}
+
+			const char* TGAMemoryBlockReader::read(size_t offset, size_t size) {
+
+				if (offset > dataSize || dataSize - offset < size) {
+					return NULL;
+				}
+
+				return data + offset;
+			}
+
+			const char* TGAStreamBlockReader::read(size_t offset, size_t size) {
+
+				if (size == 0) {
+					return NULL;
+				}
+
+				buffer.resize(size);
+
+				stream.clear();
+				stream.seekg(start + (std::streamoff) offset);
+				stream.read(&buffer[0], size);
+
+				bool failed = stream.fail();
+
+				stream.clear();
+				stream.seekg(start);
+
+				return failed ? NULL : &buffer[0];
+			}
+
+			TGAStreamInput::TGAStreamInput(std::istream &stream) : stream(stream), block(blockSize), current(0), end(0), readLimit(noLimit), failed(false) {
+			}
+
+			TGAStreamInput::~TGAStreamInput() {
+
+				if (failed) {
+					// Leave stream in error state
+					return;
+				}
+
+				// Reading ahead may have hit end of stream, which is not an error of the caller's read
+				stream.clear();
+
+				if (current < end) {
+					// Position stream right behind the data we consumed, failbit stays set when stream is not seekable
+					stream.seekg(-(std::streamoff) (end - current), std::ios_base::cur);
+				}
+			}
+
+			void TGAStreamInput::limit(size_t size) {
+
+				size_t available = end - current;
+
+				if (size == noLimit) {
+					readLimit = noLimit;
+				} else {
+					readLimit = size > available ? size - available : 0;
+				}
+			}
+
+			bool TGAStreamInput::refill(size_t size) {
+
+				if (failed) return false;
+
+				size_t available = end - current;
+
+				if (current > 0) {
+					memmove(&block[0], &block[current], available);
+					current = 0;
+					end = available;
+				}
+
+				if (block.size() < size) {
+					// Requested more than fits into block (e.g. large RAW color map)
+					block.resize(size);
+				}
+
+				TGAStatsIoTimer ioTimer;
+
+				while (end < size) {
+					// Read ahead only up to the limit, but always what was asked for
+					size_t readSize = block.size() - end;
+
+					if (readSize > readLimit) {
+						readSize = readLimit > size - end ? readLimit : size - end;
+					}
+
+					stream.read(&block[end], readSize);
+					end += (size_t) stream.gcount();
+
+					if (readLimit != noLimit) {
+						readLimit -= readLimit > (size_t) stream.gcount() ? (size_t) stream.gcount() : readLimit;
+					}
+
+					if (stream.fail()) {
+						// Partial read at end of stream is fine as long as we have enough data
+						break;
+					}
+				}
+
+				if (end < size) {
+					failed = true;
+					return false;
+				}
+
+				return true;
+			}
+
+			const char* TGAStreamInput::fetch(size_t size) {
+
+				if (end - current < size && !refill(size)) {
+					return NULL;
+				}
+
+				const char* result = &block[current];
+				current += size;
+
+				return result;
+			}
+
+			void TGAStreamInput::read(char* target, size_t size) {
+
+				if (failed) return;
+
+				size_t available = end - current;
+
+				if (size <= available) {
+					memcpy(target, &block[current], size);
+					current += size;
+					return;
+				}
+
+				// Use what is left in the block first
+				memcpy(target, &block[current], available);
+				current = end = 0;
+
+				target += available;
+				size -= available;
+
+				if (size >= blockSize) {
+					// Large reads go to the target directly
+					TGAStatsIoTimer ioTimer;
+					stream.read(target, size);
+
+					if (readLimit != noLimit) {
+						readLimit -= readLimit > size ? size : readLimit;
+					}
+
+					if (stream.fail()) {
+						failed = true;
+					}
+					return;
+				}
+
+				if (refill(size)) {
+					memcpy(target, &block[current], size);
+					current += size;
+				}
+			}
+
+			void TGAStreamInput::skip(size_t size) {
+
+				if (failed) return;
+
+				size_t available = end - current;
+
+				if (size <= available) {
+					current += size;
+					return;
+				}
+
+				current = end = 0;
+				stream.seekg(size - available, std::ios_base::cur);
+
+				if (readLimit != noLimit) {
+					readLimit -= readLimit > size - available ? size - available : readLimit;
+				}
+
+				if (stream.fail()) {
+					failed = true;
+				}
+			}
+
+			void TGAMemoryInput::read(char* target, size_t size) {
+
+				if (failed || size > (size_t) (end - current)) {
+					// Reading behind the end of data
+					failed = true;
+					current = end;
+					return;
+				}
+
+				memcpy(target, current, size);
+				current += size;
+			}
+
+			void TGAMemoryInput::skip(size_t size) {
+
+				if (size > (size_t) (end - current)) {
+					failed = true;
+					current = end;
+					return;
+				}
+
+				current += size;
+			}
+
+			const char* TGAMemoryInput::borrow(size_t size) {
+
+				if (failed || size > (size_t) (end - current)) {
+					failed = true;
+					return NULL;
+				}
+
+				const char* result = current;
+				current += size;
+
+				return result;
+			}
+
+			unsigned int getThreadCount() {
+
+				unsigned int threadCount = threadCountSetting;
+
+				if (threadCount == 0) {
+					threadCount = std::thread::hardware_concurrency();
+				}
+
+				return threadCount > 0 ? threadCount : 1;
+			}
+
+			// Threads are started when first needed and live until the program exits, each of them waits for next batch of tasks
+			class TGAThreadPool {
+			public:
+				static TGAThreadPool& get() {
+					static TGAThreadPool pool;
+					return pool;
+				}
+
+				void run(taskFunc task, void* context, size_t count, unsigned int threadCount);
+
+			private:
+				TGAThreadPool() : task(NULL), context(NULL), batch(0), activeThreads(0), busyThreads(0), stopping(false) {}
+				~TGAThreadPool();
+
+				// Indices of tasks assigned to a thread, owner takes them from front and thieves from back
+				struct Queue {
+					std::mutex mutex;
+					std::deque<size_t> indices;
+				};
+
+				bool pop(size_t slot, size_t &index);
+				void work(size_t slot);
+				static void threadMain(TGAThreadPool* pool, size_t slot, unsigned int seenBatch);
+
+				std::mutex runMutex; //< One batch at a time
+				std::mutex mutex;
+				std::condition_variable wake;
+				std::condition_variable done;
+
+				// Thread i works in slot i + 1, slot 0 belongs to calling thread
+				std::vector<std::thread> threads;
+				std::vector<Queue*> queues;
+
+				taskFunc task;
+				void* context;
+				unsigned int batch;
+				size_t activeThreads;
+				size_t busyThreads;
+				bool stopping;
+			};
+
+			TGAThreadPool::~TGAThreadPool() {
+
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					stopping = true;
+				}
+
+				wake.notify_all();
+
+				for (size_t i = 0; i < threads.size(); i++) {
+					threads[i].join();
+				}
+
+				for (size_t i = 0; i < queues.size(); i++) {
+					delete queues[i];
+				}
+			}
+
+			void TGAThreadPool::run(taskFunc task, void* context, size_t count, unsigned int threadCount) {
+
+				if (threadCount > count) {
+					threadCount = (unsigned int) count;
+				}
+
+				// Pool is busy with outer batch when task runs tasks again, waiting for it would never end
+				if (threadCount <= 1 || insidePoolTask) {
+					for (size_t i = 0; i < count; i++) {
+						task(context, i);
+					}
+
+					return;
+				}
+
+				std::lock_guard<std::mutex> runLock(runMutex);
+
+				while (queues.size() < threadCount) {
+					queues.push_back(new Queue());
+				}
+
+				while (threads.size() + 1 < threadCount) {
+					threads.push_back(std::thread(threadMain, this, threads.size() + 1, batch));
+				}
+
+				// Every thread starts with a contiguous range, so files are mostly read in order
+				for (size_t slot = 0; slot < threadCount; slot++) {
+					std::lock_guard<std::mutex> lock(queues[slot]->mutex);
+
+					for (size_t i = count * slot / threadCount; i < count * (slot + 1) / threadCount; i++) {
+						queues[slot]->indices.push_back(i);
+					}
+				}
+
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					this->task = task;
+					this->context = context;
+					activeThreads = threadCount;
+					busyThreads = threadCount - 1;
+					batch++;
+				}
+
+				wake.notify_all();
+
+				work(0);
+
+				std::unique_lock<std::mutex> lock(mutex);
+
+				while (busyThreads > 0) {
+					done.wait(lock);
+				}
+			}
+
+			bool TGAThreadPool::pop(size_t slot, size_t &index) {
+
+				{
+					std::lock_guard<std::mutex> lock(queues[slot]->mutex);
+
+					if (!queues[slot]->indices.empty()) {
+						index = queues[slot]->indices.front();
+						queues[slot]->indices.pop_front();
+						return true;
+					}
+				}
+
+				for (size_t i = 1; i < activeThreads; i++) {
+					Queue* victim = queues[(slot + i) % activeThreads];
+					std::lock_guard<std::mutex> lock(victim->mutex);
+
+					if (!victim->indices.empty()) {
+						index = victim->indices.back();
+						victim->indices.pop_back();
+						return true;
+					}
+				}
+
+				return false;
+			}
+
+			void TGAThreadPool::work(size_t slot) {
+
+				size_t index;
+				insidePoolTask = true;
+
+				while (pop(slot, index)) {
+					task(context, index);
+				}
+
+				insidePoolTask = false;
+			}
+
+			void TGAThreadPool::threadMain(TGAThreadPool* pool, size_t slot, unsigned int seenBatch) {
+
+				std::unique_lock<std::mutex> lock(pool->mutex);
+
+				for (;;) {
+					while (!pool->stopping && (pool->batch == seenBatch || slot >= pool->activeThreads)) {
+						pool->wake.wait(lock);
+					}
+
+					if (pool->stopping) {
+						return;
+					}
+
+					seenBatch = pool->batch;
+
+					lock.unlock();
+					pool->work(slot);
+					lock.lock();
+
+					if (--pool->busyThreads == 0) {
+						pool->done.notify_one();
+					}
+				}
+			}
+
+			void runTasks(taskFunc task, void* context, size_t count, unsigned int threadCount) {
+				TGAThreadPool::get().run(task, context, count, threadCount);
+			}
+
+			void prefetchFile(char* fileName) {
+#ifdef _WIN32
+				// Mapped files are opened with FILE_FLAG_SEQUENTIAL_SCAN, Windows reads them ahead on its own
+				(void) fileName;
+#else
+				int file = ::open(fileName, O_RDONLY);
+
+				if (file < 0) {
+					return;
+				}
+
+#ifdef POSIX_FADV_WILLNEED
+				posix_fadvise(file, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+
+				::close(file);
+#endif
+			}
+
+			void prefetchMapping(const TGAFileMapping &mapping) {
+#ifndef _WIN32
+				madvise((void*) mapping.data(), mapping.size(), MADV_WILLNEED);
+#else
+				// Same as prefetchFile
+				(void) mapping;
+#endif
+			}
+
+			TGAMemoryPool::TGAMemoryPool(size_t maxCachedBytes, size_t hugePageThreshold) : maxCachedBytes(maxCachedBytes), hugePageThreshold(hugePageThreshold), cached(0) {
+				for (size_t i = 0; i < TGA_POOL_SIZE_CLASSES; i++) {
+					freeLists[i] = NULL;
+				}
+			}
+
+			TGAMemoryPool::~TGAMemoryPool() {
+				trim();
+			}
+
+			size_t TGAMemoryPool::getSizeClass(size_t size, size_t &classSize) {
+
+				if (size <= TGA_POOL_BLOCK_HEADER) {
+					classSize = TGA_POOL_BLOCK_HEADER;
+					return 0;
+				}
+
+				// Power of two range (2^bit, 2^(bit + 1)] is split to 4 classes, so at most 25 % of block is wasted
+				size_t bit = 0;
+				while (((size - 1) >> (bit + 1)) != 0) {
+					bit++;
+				}
+
+				size_t step = ((size_t) 1 << bit) / 4;
+				size_t steps = (size - 1) / step + 1; //< 5 to 8
+				classSize = steps * step;
+
+				return 1 + (bit - 6) * 4 + (steps - 5);
+			}
+
+			char* TGAMemoryPool::allocate(size_t size) {
+
+				size_t classSize;
+				size_t sizeClass = getSizeClass(size, classSize);
+
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+
+					TGAPoolBlock* block = freeLists[sizeClass];
+
+					if (block) {
+						freeLists[sizeClass] = block->next;
+						cached -= classSize;
+						return (char*) block + TGA_POOL_BLOCK_HEADER;
+					}
+				}
+
+				size_t blockSize = TGA_POOL_BLOCK_HEADER + classSize;
+				TGAPoolBlock* block = NULL;
+				size_t mappedSize = 0;
+
+#if defined(GWTGA_LINUX_IO) && defined(MADV_HUGEPAGE)
+				if (hugePageThreshold > 0 && classSize >= hugePageThreshold) {
+					// Transparent huge pages need 2 MB aligned memory, mapping is trimmed to aligned part
+					const size_t hugePageSize = 2 * 1024 * 1024;
+					mappedSize = (blockSize + hugePageSize - 1) & ~(hugePageSize - 1);
+
+					void* mapped = mmap(NULL, mappedSize + hugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+					if (mapped != MAP_FAILED) {
+						char* begin = (char*) mapped;
+						char* aligned = (char*) (((uintptr_t) begin + hugePageSize - 1) & ~(uintptr_t) (hugePageSize - 1));
+
+						if (aligned > begin) {
+							munmap(begin, aligned - begin);
+						}
+
+						if (begin + hugePageSize > aligned) {
+							munmap(aligned + mappedSize, begin + hugePageSize - aligned);
+						}
+
+						madvise(aligned, mappedSize, MADV_HUGEPAGE);
+						block = (TGAPoolBlock*) aligned;
+					} else {
+						mappedSize = 0;
+					}
+				}
+#endif
+
+				if (!block) {
+#ifdef _WIN32
+					block = (TGAPoolBlock*) _aligned_malloc(blockSize, TGAPoolListener::alignment);
+#else
+					void* memory = NULL;
+					block = posix_memalign(&memory, TGAPoolListener::alignment, blockSize) == 0 ? (TGAPoolBlock*) memory : NULL;
+#endif
+				}
+
+				if (!block) {
+					return NULL;
+				}
+
+				block->next = NULL;
+				block->sizeClass = sizeClass;
+				block->classSize = classSize;
+				block->mappedSize = mappedSize;
+
+				return (char*) block + TGA_POOL_BLOCK_HEADER;
+			}
+
+			void TGAMemoryPool::release(char* memory) {
+
+				if (!memory) {
+					return;
+				}
+
+				TGAPoolBlock* block = (TGAPoolBlock*) (memory - TGA_POOL_BLOCK_HEADER);
+
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+
+					if (maxCachedBytes == 0 || cached + block->classSize <= maxCachedBytes) {
+						block->next = freeLists[block->sizeClass];
+						freeLists[block->sizeClass] = block;
+						cached += block->classSize;
+						return;
+					}
+				}
+
+				freeBlock(block);
+			}
+
+			void TGAMemoryPool::trim() {
+
+				std::lock_guard<std::mutex> lock(mutex);
+
+				for (size_t i = 0; i < TGA_POOL_SIZE_CLASSES; i++) {
+					while (freeLists[i]) {
+						TGAPoolBlock* block = freeLists[i];
+						freeLists[i] = block->next;
+						freeBlock(block);
+					}
+				}
+
+				cached = 0;
+			}
+
+			size_t TGAMemoryPool::cachedBytes() {
+				std::lock_guard<std::mutex> lock(mutex);
+				return cached;
+			}
+
+			void TGAMemoryPool::freeBlock(TGAPoolBlock* block) {
+#if defined(GWTGA_LINUX_IO) && defined(MADV_HUGEPAGE)
+				if (block->mappedSize > 0) {
+					munmap(block, block->mappedSize);
+					return;
+				}
+#endif
+
+#ifdef _WIN32
+				_aligned_free(block);
+#else
+				free(block);
+#endif
+			}
+
+			unsigned int getQueueDepth() {
+				return queueDepthSetting;
+			}
+
+#ifdef GWTGA_STATS
+			TGAStatsRecorder::TGAStatsRecorder() : previous(currentStats), currentStage(GWTGA_STAGE_HEADER), stageStart(0.0) {
+
+				// Nothing is measured when stats are not set
+				if (previous.stats != NULL) {
+					currentStats.recorder = this;
+					stageStart = getStatsTime();
+				}
+			}
+
+			TGAStatsRecorder::~TGAStatsRecorder() {
+
+				if (previous.stats == NULL) {
+					return;
+				}
+
+				stage(currentStage);
+				currentStats.recorder = previous.recorder;
+
+				std::lock_guard<std::mutex> lock(statsMutex);
+				TGAStats &target = *previous.stats;
+
+				target.images++;
+				target.bytesRead += stats.bytesRead;
+				target.bytesWritten += stats.bytesWritten;
+				target.rlePackets += stats.rlePackets;
+				target.rawPackets += stats.rawPackets;
+				target.rlePixels += stats.rlePixels;
+				target.rawPixels += stats.rawPixels;
+				target.headerSeconds += stats.headerSeconds;
+				target.colorMapSeconds += stats.colorMapSeconds;
+				target.pixelSeconds += stats.pixelSeconds;
+				target.footerSeconds += stats.footerSeconds;
+				target.ioSeconds += stats.ioSeconds;
+			}
+
+			void TGAStatsRecorder::stage(TGAStatsStage stage) {
+
+				double now = getStatsTime();
+
+				switch (currentStage) {
+				case GWTGA_STAGE_HEADER: stats.headerSeconds += now - stageStart; break;
+				case GWTGA_STAGE_COLOR_MAP: stats.colorMapSeconds += now - stageStart; break;
+				case GWTGA_STAGE_PIXELS: stats.pixelSeconds += now - stageStart; break;
+				case GWTGA_STAGE_FOOTER: stats.footerSeconds += now - stageStart; break;
+				}
+
+				currentStage = stage;
+				stageStart = now;
+			}
+
+			void TGAStatsRecorder::bytesRead(size_t size) {
+				stats.bytesRead += size;
+			}
+
+			void TGAStatsRecorder::bytesWritten(size_t size) {
+				stats.bytesWritten += size;
+			}
+
+			void TGAStatsRecorder::io(double seconds) {
+				stats.ioSeconds += seconds;
+			}
+
+			void TGAStatsRecorder::packets(const TGAPacketCounter &packets, size_t size) {
+
+				std::lock_guard<std::mutex> lock(statsMutex);
+
+				stats.rlePackets += packets.rlePackets;
+				stats.rawPackets += packets.rawPackets;
+				stats.rlePixels += packets.rlePixels;
+				stats.rawPixels += packets.rawPixels;
+				stats.bytesRead += size;
+			}
+
+			TGAStatsContext getStatsContext() {
+				return currentStats;
+			}
+
+			double getStatsTime() {
+				return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+			}
+
+			void recordStage(TGAStatsStage stage) {
+				if (currentStats.recorder) currentStats.recorder->stage(stage);
+			}
+
+			void recordBytesRead(size_t size) {
+				if (currentStats.recorder) currentStats.recorder->bytesRead(size);
+			}
+
+			void recordBytesWritten(size_t size) {
+				if (currentStats.recorder) currentStats.recorder->bytesWritten(size);
+			}
+
+			void recordPackets(const TGAPacketCounter &packets, size_t size) {
+				if (currentStats.recorder) currentStats.recorder->packets(packets, size);
+			}
+
+			TGAStatsIoTimer::TGAStatsIoTimer() : recorder(currentStats.recorder), start(recorder ? getStatsTime() : 0.0) {
+			}
+
+			TGAStatsIoTimer::~TGAStatsIoTimer() {
+				if (recorder) recorder->io(getStatsTime() - start);
+			}
+
+			TGAStatsScope::TGAStatsScope(const TGAStatsContext &context) : previous(currentStats) {
+				currentStats = context;
+			}
+
+			TGAStatsScope::~TGAStatsScope() {
+				currentStats = previous;
+			}
+#endif
+
+#ifdef GWTGA_IO_URING
+			// Minimal io_uring wrapper without liburing, rings are mapped as io_uring_setup(2) describes. Entries are queued and 
+			// submitted under lock of file queue, completions are popped only by the thread waiting for them.
+			class TGAIoRing {
+			public:
+				TGAIoRing() : ringFd(-1), sqRing(NULL), cqRing(NULL), sqes(NULL), queuedTail(0) {}
+				~TGAIoRing() { close(); }
+
+				bool open(unsigned int entries);
+				void close();
+
+				// Queues readv of single buffer, false when submission queue is full. Kernel gets it on next submit.
+				bool read(int fd, struct iovec* buffer, uint64_t offset, uint64_t userData);
+
+				// Passes all queued entries to kernel with single system call and returns how many of them it took, rest 
+				// of them (queued last) is dropped
+				unsigned int submit();
+
+				// Waits for at least one completion
+				bool wait();
+				bool pop(uint64_t &userData, int &result);
+
+			private:
+				TGAIoRing(const TGAIoRing&);
+				TGAIoRing& operator=(const TGAIoRing&);
+
+				int ringFd;
+				char* sqRing;
+				size_t sqRingSize;
+				char* cqRing;
+				size_t cqRingSize;
+				struct io_uring_sqe* sqes;
+				size_t sqesSize;
+
+				unsigned int* sqHead;
+				unsigned int* sqTail;
+				unsigned int* sqArray;
+				unsigned int sqMask;
+				unsigned int sqEntries;
+				unsigned int queuedTail; //< Tail including entries not published to kernel yet
+
+				unsigned int* cqHead;
+				unsigned int* cqTail;
+				struct io_uring_cqe* cqes;
+				unsigned int cqMask;
+			};
+
+			bool TGAIoRing::open(unsigned int entries) {
+
+				struct io_uring_params params;
+				memset(&params, 0, sizeof(params));
+
+				ringFd = (int) syscall(__NR_io_uring_setup, entries, &params);
+
+				if (ringFd < 0) {
+					// Kernel without io_uring or io_uring is disabled
+					return false;
+				}
+
+				sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+				cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+				// Both rings share single mapping on newer kernels
+				bool singleMapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+
+				if (singleMapping) {
+					sqRingSize = sqRingSize > cqRingSize ? sqRingSize : cqRingSize;
+					cqRingSize = sqRingSize;
+				}
+
+				void* sq = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+
+				if (sq == MAP_FAILED) {
+					close();
+					return false;
+				}
+
+				sqRing = (char*) sq;
+
+				if (singleMapping) {
+					cqRing = sqRing;
+				} else {
+					void* cq = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+
+					if (cq == MAP_FAILED) {
+						close();
+						return false;
+					}
+
+					cqRing = (char*) cq;
+				}
+
+				sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+				void* entryArray = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+
+				if (entryArray == MAP_FAILED) {
+					close();
+					return false;
+				}
+
+				sqes = (struct io_uring_sqe*) entryArray;
+
+				sqHead = (unsigned int*) (sqRing + params.sq_off.head);
+				sqTail = (unsigned int*) (sqRing + params.sq_off.tail);
+				sqArray = (unsigned int*) (sqRing + params.sq_off.array);
+				sqMask = *(unsigned int*) (sqRing + params.sq_off.ring_mask);
+				sqEntries = params.sq_entries;
+				queuedTail = *sqTail;
+
+				cqHead = (unsigned int*) (cqRing + params.cq_off.head);
+				cqTail = (unsigned int*) (cqRing + params.cq_off.tail);
+				cqes = (struct io_uring_cqe*) (cqRing + params.cq_off.cqes);
+				cqMask = *(unsigned int*) (cqRing + params.cq_off.ring_mask);
+
+				return true;
+			}
+
+			void TGAIoRing::close() {
+
+				if (sqes) {
+					munmap(sqes, sqesSize);
+				}
+
+				if (cqRing && cqRing != sqRing) {
+					munmap(cqRing, cqRingSize);
+				}
+
+				if (sqRing) {
+					munmap(sqRing, sqRingSize);
+				}
+
+				if (ringFd >= 0) {
+					::close(ringFd);
+				}
+
+				ringFd = -1;
+				sqRing = NULL;
+				cqRing = NULL;
+				sqes = NULL;
+			}
+
+			bool TGAIoRing::read(int fd, struct iovec* buffer, uint64_t offset, uint64_t userData) {
+
+				unsigned int tail = queuedTail;
+
+				if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+					return false;
+				}
+
+				unsigned int index = tail & sqMask;
+				struct io_uring_sqe* entry = &sqes[index];
+
+				memset(entry, 0, sizeof(*entry));
+				entry->opcode = IORING_OP_READV; //< Supported since the first io_uring kernels
+				entry->fd = fd;
+				entry->addr = (uint64_t) (uintptr_t) buffer;
+				entry->len = 1;
+				entry->off = offset;
+				entry->user_data = userData;
+
+				sqArray[index] = index;
+				queuedTail = tail + 1;
+
+				return true;
+			}
+
+			unsigned int TGAIoRing::submit() {
+
+				unsigned int tail = *sqTail;
+				unsigned int count = queuedTail - tail;
+				unsigned int submitted = 0;
+
+				__atomic_store_n(sqTail, queuedTail, __ATOMIC_RELEASE);
+
+				// Kernel may take only part of entries, then it is asked for the rest
+				while (submitted < count) {
+					int result = (int) syscall(__NR_io_uring_enter, ringFd, count - submitted, 0, 0, NULL, 0);
+
+					if (result > 0) {
+						submitted += (unsigned int) result;
+					} else if (result < 0 && errno == EINTR) {
+						continue;
+					} else {
+						break;
+					}
+				}
+
+				if (submitted < count) {
+					// Kernel consumes entries in order only within io_uring_enter, so those it did not take can be taken back
+					queuedTail = tail + submitted;
+					__atomic_store_n(sqTail, queuedTail, __ATOMIC_RELEASE);
+				}
+
+				return submitted;
+			}
+
+			bool TGAIoRing::wait() {
+
+				for (;;) {
+					if (syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) >= 0) {
+						return true;
+					}
+
+					if (errno != EINTR) {
+						return false;
+					}
+				}
+			}
+
+			bool TGAIoRing::pop(uint64_t &userData, int &result) {
+
+				unsigned int head = *cqHead;
+
+				if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+					return false;
+				}
+
+				struct io_uring_cqe* entry = &cqes[head & cqMask];
+				userData = entry->user_data;
+				result = entry->res;
+
+				__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+
+				return true;
+			}
+#endif
+
+#ifdef GWTGA_LINUX_IO
+			// Files are opened and their buffers allocated when they are requested, read ahead counts against queue depth 
+			// until decoded. Thread which waits for its file reaps completions for everyone, others wait until it is done.
+			class TGAFileQueue {
+			public:
+				TGAFileQueue(char** fileNames, size_t count, unsigned int queueDepth);
+				~TGAFileQueue();
+
+				TGAImage load(size_t index, ITGALoaderListener* listener, TGAOptions options);
+
+			private:
+				TGAFileQueue(const TGAFileQueue&);
+				TGAFileQueue& operator=(const TGAFileQueue&);
+
+				enum FileState {
+					FILE_IDLE,      //< Not requested yet
+					FILE_IN_FLIGHT, //< Read through io_uring
+					FILE_READ_SYNC, //< Read with preadv by thread which loads it, kernel was asked to read it ahead
+					FILE_LOAD_PATH, //< Not a regular file, out of memory or read was lost with io_uring, loaded by name
+					FILE_DONE,
+					FILE_TAKEN
+				};
+
+				struct File {
+					File() : state(FILE_IDLE), fd(-1), data(NULL), size(0), done(0), error(GWTGA_NONE) {}
+
+					FileState state;
+					int fd;
+					char* data;
+					size_t size;
+					size_t done;
+					struct iovec buffer; //< Has to stay valid until read is submitted
+					TGAError error;
+				};
+
+				void submit(size_t index);
+				void fillQueue(size_t first);
+				bool startRead(size_t index);
+				void submitReads();
+				void readCompleted(size_t index, int result);
+				void finish(File &file, TGAError error);
+				void reapCompletions();
+				void readSync(File &file);
+
+				char** fileNames;
+				std::vector<File> files;
+				unsigned int queueDepth;
+				size_t pending; //< Files requested but not taken yet
+
+				std::mutex mutex;
+				std::condition_variable completed;
+
+#ifdef GWTGA_IO_URING
+				TGAIoRing ring;
+				bool useRing;
+				bool reaping;
+				size_t inFlight;
+				std::vector<size_t> queued; //< Files whose reads wait for submitReads
+#endif
+			};
+
+			// Single read is limited by kernel to a bit less than 2 GB
+			const size_t TGA_MAX_READ_SIZE = 1024 * 1024 * 1024;
+
+			TGAFileQueue::TGAFileQueue(char** fileNames, size_t count, unsigned int queueDepth) : fileNames(fileNames), files(count), queueDepth(queueDepth), pending(0) {
+#ifdef GWTGA_IO_URING
+				useRing = ring.open(queueDepth);
+				reaping = false;
+				inFlight = 0;
+#endif
+			}
+
+			TGAFileQueue::~TGAFileQueue() {
+#ifdef GWTGA_IO_URING
+				// Buffers may be released only after kernel is done with them
+				while (inFlight > 0 && ring.wait()) {
+					uint64_t index;
+					int result;
+
+					while (ring.pop(index, result)) {
+						files[(size_t) index].state = FILE_DONE;
+						inFlight--;
+					}
+				}
+
+				// Kernel may still write to buffers of reads which were not reaped, they are leaked instead
+				for (size_t i = 0; i < files.size() && inFlight > 0; i++) {
+					if (files[i].state == FILE_IN_FLIGHT) {
+						files[i].data = NULL;
+					}
+				}
+#endif
+
+				for (size_t i = 0; i < files.size(); i++) {
+					if (files[i].fd >= 0) {
+						::close(files[i].fd);
+					}
+
+					delete[] files[i].data;
+				}
+			}
+
+			TGAImage TGAFileQueue::load(size_t index, ITGALoaderListener* listener, TGAOptions options) {
+
+				std::unique_lock<std::mutex> lock(mutex);
+
+				File &file = files[index];
+
+				if (file.state == FILE_IDLE) {
+					submit(index);
+				}
+
+				fillQueue(index + 1);
+
+				while (file.state != FILE_DONE && file.state != FILE_LOAD_PATH) {
+					if (file.state == FILE_READ_SYNC) {
+						lock.unlock();
+						readSync(file);
+						lock.lock();
+						continue;
+					}
+
+#ifdef GWTGA_IO_URING
+					if (reaping) {
+						completed.wait(lock);
+						continue;
+					}
+
+					reaping = true;
+					lock.unlock();
+
+					bool waited = ring.wait();
+
+					lock.lock();
+					reaping = false;
+
+					if (waited) {
+						reapCompletions();
+					} else {
+						// Ring is broken and reads in flight cannot be reaped, kernel may still write to their buffers. 
+						// Buffers are leaked and files loaded by name.
+						for (size_t i = 0; i < files.size(); i++) {
+							if (files[i].state == FILE_IN_FLIGHT) {
+								::close(files[i].fd);
+								files[i].fd = -1;
+								files[i].data = NULL;
+								files[i].state = FILE_LOAD_PATH;
+							}
+						}
+
+						ring.close();
+						useRing = false;
+						inFlight = 0;
+					}
+
+					completed.notify_all();
+#endif
+				}
+
+				FileState state = file.state;
+				char* data = file.data;
+				size_t size = file.size;
+				TGAError error = file.error;
+
+				file.state = FILE_TAKEN;
+				file.data = NULL;
+				pending--;
+
+				fillQueue(index + 1);
+
+				lock.unlock();
+
+				TGAImage image;
+
+				if (state == FILE_LOAD_PATH) {
+					image = LoadTga(fileNames[index], listener, options);
+				} else if (error != GWTGA_NONE) {
+					image.error = error;
+				} else {
+					image = LoadTga(data, size, listener, options);
+				}
+
+				delete[] data;
+
+				return image;
+			}
+
+			void TGAFileQueue::submit(size_t index) {
+
+				File &file = files[index];
+				pending++;
+
+				file.fd = ::open(fileNames[index], O_RDONLY | O_CLOEXEC);
+
+				if (file.fd < 0) {
+					finish(file, GWTGA_CANNOT_OPEN_FILE);
+					return;
+				}
+
+				struct stat fileInfo;
+
+				if (fstat(file.fd, &fileInfo) == 0 && S_ISREG(fileInfo.st_mode) && fileInfo.st_size > 0) {
+					file.size = (size_t) fileInfo.st_size;
+					file.data = new (std::nothrow) char[file.size];
+				}
+
+				if (!file.data) {
+					// Loaded by name, so errors are the same as when loaded on its own
+					::close(file.fd);
+					file.fd = -1;
+					file.state = FILE_LOAD_PATH;
+					return;
+				}
+
+				if (startRead(index)) {
+					return;
+				}
+
+#ifdef POSIX_FADV_WILLNEED
+				posix_fadvise(file.fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+				file.state = FILE_READ_SYNC;
+			}
+
+			void TGAFileQueue::fillQueue(size_t first) {
+
+				for (size_t i = first; i < files.size() && pending < queueDepth; i++) {
+					if (files[i].state == FILE_IDLE) {
+						submit(i);
+					}
+				}
+
+				submitReads();
+			}
+
+			bool TGAFileQueue::startRead(size_t index) {
+#ifdef GWTGA_IO_URING
+				File &file = files[index];
+
+				if (!useRing) {
+					return false;
+				}
+
+				size_t readSize = file.size - file.done;
+				file.buffer.iov_base = file.data + file.done;
+				file.buffer.iov_len = readSize < TGA_MAX_READ_SIZE ? readSize : TGA_MAX_READ_SIZE;
+
+				if (!ring.read(file.fd, &file.buffer, file.done, index)) {
+					return false;
+				}
+
+				file.state = FILE_IN_FLIGHT;
+				inFlight++;
+				queued.push_back(index);
+
+				return true;
+#else
+				(void) index;
+				return false;
+#endif
+			}
+
+			void TGAFileQueue::submitReads() {
+#ifdef GWTGA_IO_URING
+				if (queued.empty()) {
+					return;
+				}
+
+				unsigned int submitted = ring.submit();
+
+				// Reads kernel did not take are finished with preadv by thread which loads the file
+				for (size_t i = submitted; i < queued.size(); i++) {
+					File &file = files[queued[i]];
+					file.state = FILE_READ_SYNC;
+					inFlight--;
+
+#ifdef POSIX_FADV_WILLNEED
+					posix_fadvise(file.fd, (off_t) file.done, 0, POSIX_FADV_WILLNEED);
+#endif
+				}
+
+				queued.clear();
+#endif
+			}
+
+			void TGAFileQueue::readCompleted(size_t index, int result) {
+
+				File &file = files[index];
+
+				if (result == -EINTR || result == -EAGAIN) {
+					// Nothing was read, try again
+				} else if (result <= 0) {
+					// Error or file got shorter
+					finish(file, GWTGA_IO_ERROR);
+					return;
+				} else {
+					file.done += (size_t) result;
+				}
+
+				if (file.done == file.size) {
+					finish(file, GWTGA_NONE);
+				} else if (!startRead(index)) {
+					file.state = FILE_READ_SYNC;
+				}
+			}
+
+			void TGAFileQueue::finish(File &file, TGAError error) {
+
+				if (file.fd >= 0) {
+					::close(file.fd);
+					file.fd = -1;
+				}
+
+				file.error = error;
+				file.state = FILE_DONE;
+			}
+
+			void TGAFileQueue::reapCompletions() {
+#ifdef GWTGA_IO_URING
+				uint64_t index;
+				int result;
+
+				while (ring.pop(index, result)) {
+					inFlight--;
+					readCompleted((size_t) index, result);
+				}
+
+				// Continued reads of large files
+				submitReads();
+#endif
+			}
+
+			void TGAFileQueue::readSync(File &file) {
+
+				// Only the loading thread touches the file until it is finished
+				TGAError error = GWTGA_NONE;
+
+				while (file.done < file.size) {
+					size_t readSize = file.size - file.done;
+					struct iovec buffer;
+					buffer.iov_base = file.data + file.done;
+					buffer.iov_len = readSize < TGA_MAX_READ_SIZE ? readSize : TGA_MAX_READ_SIZE;
+
+					ssize_t result = preadv(file.fd, &buffer, 1, (off_t) file.done);
+
+					if (result < 0 && errno == EINTR) {
+						continue;
+					}
+
+					if (result <= 0) {
+						error = GWTGA_IO_ERROR;
+						break;
+					}
+
+					file.done += (size_t) result;
+				}
+
+				std::lock_guard<std::mutex> lock(mutex);
+				finish(file, error);
+			}
+
+			TGAFileQueue* openFileQueue(char** fileNames, size_t count, unsigned int queueDepth) {
+				return queueDepth > 0 ? new TGAFileQueue(fileNames, count, queueDepth) : NULL;
+			}
+
+			void closeFileQueue(TGAFileQueue* queue) {
+				delete queue;
+			}
+
+			TGAImage loadQueuedFile(TGAFileQueue* queue, size_t index, ITGALoaderListener* listener, TGAOptions options) {
+				return queue->load(index, listener, options);
+			}
+#else
+			class TGAFileQueue {
+			};
+
+			TGAFileQueue* openFileQueue(char**, size_t, unsigned int) {
+				// Files are mapped and read ahead by OS
+				return NULL;
+			}
+
+			void closeFileQueue(TGAFileQueue*) {
+			}
+
+			TGAImage loadQueuedFile(TGAFileQueue*, size_t, ITGALoaderListener*, TGAOptions) {
+				return TGAImage();
+			}
+#endif
+
+			TGAStreamOutput::TGAStreamOutput(std::ostream &stream) : stream(stream), block(blockSize), used(0), written(0) {
+			}
+
+			TGAStreamOutput::~TGAStreamOutput() {
+				flush();
+			}
+
+			void TGAStreamOutput::write(const char* data, size_t size) {
+
+				written += size;
+
+				if (size <= blockSize - used) {
+					memcpy(&block[used], data, size);
+					used += size;
+					return;
+				}
+
+				flush();
+
+				if (size >= blockSize) {
+					// Large writes go to the stream directly
+					TGAStatsIoTimer ioTimer;
+					stream.write(data, size);
+				} else {
+					memcpy(&block[0], data, size);
+					used = size;
+				}
+			}
+
+			void TGAStreamOutput::flush() {
+
+				if (used > 0) {
+					TGAStatsIoTimer ioTimer;
+					stream.write(&block[0], used);
+					used = 0;
+				}
+			}
+
+			void TGAMemoryOutput::write(const char* data, size_t size) {
+				bytes.insert(bytes.end(), data, data + size);
+			}
+
+			template<class Input>
+			TGAImage loadTga(Input &input, ITGALoaderListener* listener, TGAOptions options, bool borrowPixels, const TGARegion* region) {
+				// TODO: TGA is little endian. Make sure reading from input is little endian
+
+				// Parse options
+				bool flipVertically = ((options & GWTGA_FLIP_VERTICALLY) == GWTGA_FLIP_VERTICALLY);
+				bool flipHorizontally = ((options & GWTGA_FLIP_HORIZONTALLY) == GWTGA_FLIP_HORIZONTALLY);
+				bool returnColorMap = ((options & GWTGA_RETURN_COLOR_MAP) == GWTGA_RETURN_COLOR_MAP);
+				bool generateMipmaps = (options & (GWTGA_GENERATE_MIPMAPS | GWTGA_MIPMAPS_SRGB)) != 0;
+				bool sRGBMipmaps = ((options & GWTGA_MIPMAPS_SRGB) == GWTGA_MIPMAPS_SRGB);
+				unsigned int threadCount = ((options & GWTGA_PARALLEL_DECODE) == GWTGA_PARALLEL_DECODE) ? getThreadCount() : 1;
+
+				TGAImage resultImage;
+				GWTGA_STATS_RECORDER(statsRecorder);
+
+				// Read header
+				TGAHeader header;
+				char headerBytes[TGA_HEADER_SIZE];
+
+				// Stream is read ahead only within the image
+				input.limit(TGA_HEADER_SIZE);
+				input.read(headerBytes, TGA_HEADER_SIZE);
+				recordBytesRead(TGA_HEADER_SIZE);
+
+				if (input.fail()) {
+					// Reading of header failed
+					resultImage.error = GWTGA_IO_ERROR;
+					return resultImage;
+				}
+
+				parseHeader(headerBytes, header);
+				input.limit(getImageDataSize(header));
+
+				TGAImageInfo info;
+				getImageInfo(header, info);
+
+				resultImage.width = info.width;
+				resultImage.height = info.height;
+				resultImage.xOrigin = info.xOrigin;
+				resultImage.yOrigin = info.yOrigin;
+				resultImage.bitsPerPixel = info.decodedBitsPerPixel(options);
+				resultImage.attributeBitsPerPixel = info.attributeBitsPerPixel;
+				resultImage.origin = info.origin;
+				resultImage.colorType = info.colorType;
+
+				// Region is decoded in file coordinates (rows and columns as stored), the whole image unless region is given
+				TGARegion fileRegion(0, 0, info.width, info.height);
+				const TGARegion* storedRegion = NULL;
+
+				if (region != NULL) {
+
+					if (region->width == 0 || region->height == 0 || region->width > info.width || region->height > info.height ||
+						region->x > info.width - region->width || region->y > info.height - region->height) {
+						// Region does not lie within image
+						resultImage.error = GWTGA_INVALID_DATA;
+						return resultImage;
+					}
+
+					fileRegion.x = flipHorizontally ? info.width - region->x - region->width : region->x;
+					fileRegion.y = flipVertically ? info.height - region->y - region->height : region->y;
+					fileRegion.width = region->width;
+					fileRegion.height = region->height;
+
+					resultImage.width = (unsigned int) region->width;
+					resultImage.height = (unsigned int) region->height;
+
+					if (region->width != info.width || region->height != info.height) {
+						storedRegion = &fileRegion;
+					}
+				}
+
+				// Pixels are converted to requested format while decoding (palette is converted before decoding), 
+				// color indices are returned as they are
+				TGAFormat outputFormat = getOutputFormat(options);
+				TGAFormat storedFormat = UNKNOWN_FORMAT;
+				bool convert = outputFormat != UNKNOWN_FORMAT && !((header.ImageType == 1 || header.ImageType == 9) && returnColorMap);
+
+				if (convert) {
+					if (header.ImageType == 1 || header.ImageType == 9) {
+						storedFormat = getStoredFormat(GWTGA_RGB, header.colorMapSpec.colorMapEntrySize, info.attributeBitsPerPixel);
+					} else {
+						storedFormat = getStoredFormat(info.colorType, header.imageSpec.bitsPerPixel, info.attributeBitsPerPixel);
+					}
+
+					if (storedFormat == UNKNOWN_FORMAT) {
+						// Pixels cannot be converted to requested format
+						resultImage.error = GWTGA_UNSUPPORTED_PIXEL_DEPTH;
+						return resultImage;
+					}
+
+					resultImage.colorType = GWTGA_RGB;
+					resultImage.attributeBitsPerPixel = outputFormat == RGB_U24 ? 0 : 8;
+				}
+
+				if (resultImage.bitsPerPixel > 16 * 8) {
+					// Too many bits per pixel
+					resultImage.error = GWTGA_UNSUPPORTED_PIXEL_DEPTH;
+					return resultImage;
+				}
+
+				// Read image iD - skip this, we do not use image id now
+				input.skip(header.iDLength);
+				recordBytesRead(header.iDLength);
+				recordStage(GWTGA_STAGE_COLOR_MAP);
+
+				// Read color map
+				char* colorMap = NULL;
+				TGATemporaryMemory temporaryColorMap(listener);
+
+				if (header.colorMapSpec.colorMapLength > 0) {
+
+					// Pick temporary memory (possibly from stack or preallocated) when we dont need color palette anymore after loading the image
+					TGAMemoryType colorMapType = returnColorMap ? GWTGA_COLOR_PALETTE : GWTGA_COLOR_PALETTE_TEMPORARY;
+
+					colorMap = (*listener)(header.colorMapSpec.colorMapEntrySize, header.colorMapSpec.colorMapLength, 1, colorMapType);
+
+					if (!colorMap) {
+						// Could not allocate memory for color map
+						resultImage.error = GWTGA_MALLOC_ERROR;
+						return resultImage;
+					}
+
+					if (returnColorMap) {
+						resultImage.colorMap.bytes = colorMap;
+						resultImage.colorMap.length = header.colorMapSpec.colorMapLength;
+						resultImage.colorMap.bitsPerPixel = header.colorMapSpec.colorMapEntrySize;
+					} else {
+						temporaryColorMap.memory = colorMap;
+					}
+
+					size_t size = header.colorMapSpec.colorMapLength * (header.colorMapSpec.colorMapEntrySize / 8);
+					input.read(colorMap, size);
+					recordBytesRead(size);
+
+					if (input.fail()) {
+						// Could not read color map from input
+						resultImage.error = GWTGA_IO_ERROR;
+						return resultImage;
+					}
+				}
+
+				recordStage(GWTGA_STAGE_PIXELS);
+
+				// Read image data
+				size_t pixelsNumber = (size_t) resultImage.width * resultImage.height;
+
+				if ((resultImage.bitsPerPixel & 0x07) != 0) {
+					// Bits per pixel has to be divisible by 8
+					resultImage.error = GWTGA_UNSUPPORTED_PIXEL_DEPTH;
+					return resultImage;
+				}
+
+				size_t bytesPerPixel = resultImage.bitsPerPixel / 8;
+				size_t imgDataSize = pixelsNumber * bytesPerPixel;
+
+				// Mip levels are filtered byte by byte, which does not work for packed 16-bit pixels and color indices
+				if (generateMipmaps && (bytesPerPixel > 4 || (bytesPerPixel == 2 && resultImage.colorType != GWTGA_GREYSCALE) ||
+					((header.ImageType == 1 || header.ImageType == 9) && returnColorMap))) {
+
+					resultImage.error = GWTGA_UNSUPPORTED_PIXEL_DEPTH;
+					return resultImage;
+				}
+
+				// Reference pixels in place when they do not need any processing, rows of region have to follow each other
+				if (borrowPixels && !flipVertically && !flipHorizontally && !convert && !generateMipmaps && fileRegion.width == info.width &&
+					(header.ImageType == 2 || header.ImageType == 3 || (header.ImageType == 1 && returnColorMap))) {
+
+					input.skip(fileRegion.y * info.width * bytesPerPixel);
+					resultImage.bytes = const_cast<char*>(input.borrow(imgDataSize));
+					recordBytesRead(imgDataSize);
+
+					if (!resultImage.bytes) {
+						// Not enough pixel data in input
+						resultImage.error = GWTGA_IO_ERROR;
+					}
+
+					return resultImage;
+				}
+
+				// Allocate memory for image data, mip levels are requested as additional rows of image (listener interface
+				// passes width and height only). Size of allocation is computed in size_t by listeners, it may not fit into
+				// 32 bits.
+				unsigned int allocatedRows = resultImage.height;
+
+				if (generateMipmaps && pixelsNumber > 0) {
+					size_t mipPixels = getMipChainPixels(resultImage.width, resultImage.height) - pixelsNumber;
+					allocatedRows += (unsigned int) ((mipPixels + resultImage.width - 1) / resultImage.width);
+
+					size_t rowSize = (size_t) resultImage.width * bytesPerPixel;
+
+					if (rowSize > 0 && allocatedRows > (size_t) -1 / rowSize) {
+						// Image with mip chain does not fit into address space (32-bit systems)
+						resultImage.error = GWTGA_MALLOC_ERROR;
+						return resultImage;
+					}
+				}
+
+				resultImage.bytes = (*listener)(resultImage.bitsPerPixel, resultImage.width, allocatedRows, GWTGA_IMAGE_DATA);
+
+				if (!resultImage.bytes) {
+					resultImage.error = GWTGA_MALLOC_ERROR;
+					return resultImage;
+				}
+
+				// Mip levels are filtered as soon as their source rows are decoded
+				TGAMipChain mipChain(resultImage.bytes, resultImage.width, resultImage.height, bytesPerPixel, flipVertically, sRGBMipmaps);
+				ITGARowListener* rowListener = NULL;
+
+				if (generateMipmaps && pixelsNumber > 0) {
+					resultImage.mipLevels = getMipLevelCount(resultImage.width, resultImage.height);
+					rowListener = &mipChain;
+				}
+
+				// Read pixel data
+				if (header.ImageType == 2 || header.ImageType == 3 || 
+					(header.ImageType == 1 && returnColorMap)) { // color mapped, but do not resolve palette is specified
+
+						// 2 - Uncompressed, RGB images
+						// 3 - Uncompressed, black and white images.
+
+						// Rows above region and columns around it are skipped
+						size_t inputPixelSize = convert ? getFormatSize(storedFormat) : bytesPerPixel;
+						size_t rowGap = (info.width - fileRegion.width) * inputPixelSize;
+
+						input.skip((fileRegion.y * info.width + fileRegion.x) * inputPixelSize);
+						recordBytesRead(pixelsNumber * inputPixelSize);
+
+						if (convert) {
+							// PROCESSING - Convert rows as they are read
+							size_t inputRowSize = resultImage.width * inputPixelSize;
+							size_t rowSize = resultImage.width * bytesPerPixel;
+
+							for (size_t y = 0; y < resultImage.height; y++) {
+
+								if (y > 0) {
+									input.skip(rowGap);
+								}
+
+								const char* pixels = input.fetch(inputRowSize);
+
+								if (!pixels) {
+									resultImage.error = GWTGA_IO_ERROR;
+									return resultImage;
+								}
+
+								char* row = &resultImage.bytes[(flipVertically ? resultImage.height - 1 - y : y) * rowSize];
+
+								convertPixels(row, pixels, storedFormat, outputFormat, resultImage.width);
+
+								if (flipHorizontally) {
+									reversePixels(row, resultImage.width, bytesPerPixel);
+								}
+
+								if (rowListener) {
+									rowListener->rowsDecoded(y + 1);
+								}
+							}
+
+						} else if (!flipVertically && !flipHorizontally && !rowListener && rowGap == 0) {
+							// NO PROCESSING
+							input.read(resultImage.bytes, imgDataSize);
+
+						} else {
+							// PROCESSING - Read row by row (also when filtering mip levels or reading region), vertical flip only changes 
+							// order of rows, horizontal flip reverses pixels of each row in place
+							size_t rowSize = resultImage.width * bytesPerPixel;
+
+							for (size_t y = 0; y < resultImage.height && !input.fail(); y++) {
+								char* row = &resultImage.bytes[(flipVertically ? resultImage.height - 1 - y : y) * rowSize];
+
+								if (y > 0) {
+									input.skip(rowGap);
+								}
+
+								input.read(row, rowSize);
+
+								if (flipHorizontally) {
+									reversePixels(row, resultImage.width, bytesPerPixel);
+								}
+
+								if (rowListener && !input.fail()) {
+									rowListener->rowsDecoded(y + 1);
+								}
+							}
+						}
+
+						if (input.fail()) {
+							resultImage.error = GWTGA_IO_ERROR;
+							return resultImage;
+						}
+
+				} else if (header.ImageType == 10 || header.ImageType == 11 ||
+					(header.ImageType == 9 && returnColorMap)) {  // color mapped, RLE compressed, but do not resolve palette is specified
+
+						// 10 - Runlength encoded RGB images
+						// 11 - Runlength encoded black and white images.
+
+						bool decoded;
+
+						if (convert) {
+							decoded = decompressRLEConverted(resultImage.bytes, input, storedFormat, outputFormat, header.imageSpec.width, header.imageSpec.height, flipVertically, flipHorizontally, threadCount, rowListener, storedRegion);
+						} else {
+							decoded = decompressRLEPixels(resultImage.bytes, input, bytesPerPixel, header.imageSpec.width, header.imageSpec.height, flipVertically, flipHorizontally, threadCount, rowListener, storedRegion);
+						}
+
+						if (!decoded) {
+							// Error while reading compressed image data
+							resultImage.error = GWTGA_IO_ERROR;
+							return resultImage;
+						}
+
+				}  else if (header.ImageType == 1 || header.ImageType == 9 ) {
+
+					// 1  -  Uncompressed, color-mapped images
+					// 9  -  Runlength encoded color-mapped images
+
+					if (header.imageSpec.bitsPerPixel != 8 && header.imageSpec.bitsPerPixel != 16 && header.imageSpec.bitsPerPixel != 24) {
+						// Unsupported color map entry length
+						resultImage.error = GWTGA_UNSUPPORTED_PIXEL_DEPTH;
+						return resultImage;
+					}
+
+					if (header.colorMapType != 1 || colorMap == NULL) {
+						// Color map not present in file
+						resultImage.error = GWTGA_INVALID_DATA;
+						return resultImage;
+					}
+
+					size_t bytesPerIndex = header.imageSpec.bitsPerPixel / 8;
+
+					// Palette is converted once, indices then resolve directly to pixels of requested format
+					std::vector<char> convertedColorMap;
+					recordStage(GWTGA_STAGE_COLOR_MAP);
+
+					if (convert) {
+						convertedColorMap.resize(header.colorMapSpec.colorMapLength * bytesPerPixel);
+						convertPixels(&convertedColorMap[0], colorMap, storedFormat, outputFormat, header.colorMapSpec.colorMapLength);
+						colorMap = &convertedColorMap[0];
+					}
+
+					// 8-bit indices into palette with at most 4 bytes per entry are expanded through 256 entry table
+					TGAColorTable colorTable;
+					bool useColorTable = (bytesPerIndex == 1 && bytesPerPixel <= 4);
+
+					if (useColorTable) {
+						buildColorTable(colorTable, colorMap, header.colorMapSpec.colorMapLength, bytesPerPixel);
+					}
+
+					recordStage(GWTGA_STAGE_PIXELS);
+
+					if (header.ImageType == 1) {
+
+						// 1  -  Uncompressed, color-mapped images, rows above region and columns around it are skipped
+						size_t rowGap = (info.width - fileRegion.width) * bytesPerIndex;
+
+						input.skip((fileRegion.y * info.width + fileRegion.x) * bytesPerIndex);
+						recordBytesRead(pixelsNumber * bytesPerIndex);
+
+						for (size_t y = 0; y < resultImage.height; y++) {
+
+							if (y > 0) {
+								input.skip(rowGap);
+							}
+
+							const char* indices = input.fetch(resultImage.width * bytesPerIndex);
+
+							if (!indices) {
+								resultImage.error = GWTGA_IO_ERROR;
+								return resultImage;
+							}
+
+							char* row = &resultImage.bytes[(flipVertically ? resultImage.height - 1 - y : y) * resultImage.width * bytesPerPixel];
+
+							if (useColorTable) {
+								fetchPixelsColorTable(row, indices, bytesPerIndex, (char*) colorTable.entries, bytesPerPixel, resultImage.width);
+							} else {
+								fetchPixelsColorMap(row, indices, bytesPerIndex, colorMap, bytesPerPixel, resultImage.width);
+							}
+
+							if (flipHorizontally) {
+								reversePixels(row, resultImage.width, bytesPerPixel);
+							}
+
+							if (rowListener) {
+								rowListener->rowsDecoded(y + 1);
+							}
+						}
+
+					} else if (header.ImageType == 9) {
+
+						// 9  -  Runlength encoded color-mapped images
+						bool decoded;
+
+						if (useColorTable) {
+							decoded = decompressRLEColorTable(resultImage.bytes, input, colorTable, bytesPerPixel, header.imageSpec.width, header.imageSpec.height, flipVertically, flipHorizontally, threadCount, rowListener, storedRegion);
+						} else {
+							// Wide indices are rare, their kernel takes pixel sizes at runtime
+							decoded = decompressRLE<Input, fetchPixelColorMap, fetchPixelsColorMap, 0, 0>(resultImage.bytes, input, colorMap, bytesPerIndex, bytesPerPixel, header.imageSpec.width, header.imageSpec.height, flipVertically, flipHorizontally, threadCount, rowListener, storedRegion);
+						}
+
+						if (!decoded) {
+							// Error while reading compressed image data
+							resultImage.error = GWTGA_IO_ERROR;
+							return resultImage;
+						}
+					}
+				}
+
+				// Parallel decoding does not report rows, remaining levels are filtered after it
+				if (rowListener) {
+					rowListener->rowsDecoded(resultImage.height);
+				}
+
+				return resultImage;
+			}
+
+
+			template<size_t tempMemorySize>
+			char* TGALoaderListener<tempMemorySize>::operator()(const unsigned int &bitsPerPixel, const unsigned int &width, const unsigned int &height, TGAMemoryType mType) {						
+
+				// Image with mip chain may take more than 4 GB
+				size_t size = (size_t) width * height * (bitsPerPixel / 8);
+
+				if (mType == GWTGA_COLOR_PALETTE_TEMPORARY && size <= tempMemorySize) {
+					return tempMemory;
+				} else if (mType == GWTGA_IMAGE_DATA) {
+					return new char[size];
+				} else {
+					colorMapMemory = new char[size];
+					return colorMapMemory;
+				}
+			}
+
+			template<size_t tempMemorySize>
+			TGALoaderListener<tempMemorySize>::TGALoaderListener(bool persistentColorMapMemory) {
+				this->persistentColorMapMemory = persistentColorMapMemory;
+				this->colorMapMemory = NULL;
+			}
+
+			template<size_t tempMemorySize>
+			TGALoaderListener<tempMemorySize>::~TGALoaderListener() {
+				if (!persistentColorMapMemory && colorMapMemory != NULL) {
+					delete[] colorMapMemory;
+					colorMapMemory = NULL;
+				}
+			}
+
+			void fetchPixelUncompressed(char* target, const char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel) { 
+				memcpy(target, input, bytesPerInputPixel);
+			}
+
+			void fetchPixelColorMap(char* target, const char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel) { 
+				memcpy(target, (void*) &colorMap[readColorIndex(input, bytesPerInputPixel) * bytesPerOutputPixel], bytesPerOutputPixel);
+			}
+
+			void fetchPixelsUncompressed(char* target, const char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel, size_t count) { 
+				memcpy(target, input, bytesPerInputPixel * count);
+			}
+
+			void fetchPixelsColorMap(char* target, const char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel, size_t count) { 
+
+				for (size_t i = 0; i < count * bytesPerOutputPixel; i += bytesPerOutputPixel) {
+					memcpy((void*) &target[i], (void*) &colorMap[readColorIndex(input, bytesPerInputPixel) * bytesPerOutputPixel], bytesPerOutputPixel);
+					input += bytesPerInputPixel;
+				}
+			}
+
+			void buildColorTable(TGAColorTable &table, const char* colorMap, size_t colorMapLength, size_t bytesPerEntry) {
+
+				// Indices missing in the palette resolve to zero instead of reading behind it
+				memset(table.entries, 0, sizeof(table.entries));
+
+				if (colorMapLength > 256) {
+					colorMapLength = 256;
+				}
+
+				for (size_t i = 0; i < colorMapLength; i++) {
+					memcpy(&table.entries[i], &colorMap[i * bytesPerEntry], bytesPerEntry);
+				}
+			}
+
+			void fetchPixelColorTable(char* target, const char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel) { 
+				memcpy(target, &((const uint32_t*) colorMap)[*(const uint8_t*) input], bytesPerOutputPixel);
+			}
+
+			void fetchPixelsColorTable(char* target, const char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel, size_t count) { 
+
+				const uint8_t* indices = (const uint8_t*) input;
+				const uint32_t* entries = (const uint32_t*) colorMap;
+
+				switch (bytesPerOutputPixel) {
+				case 1:
+					expandColorTable<1>(target, indices, entries, count);
+					break;
+				case 2:
+					expandColorTable<2>(target, indices, entries, count);
+					break;
+				case 3:
+					expandColorTable<3>(target, indices, entries, count);
+					break;
+				case 4:
+					expandColorTable<4>(target, indices, entries, count);
+					break;
+				}
+			}
+
+			template<size_t bytesPerEntry>
+			void expandColorTable(char* target, const uint8_t* indices, const uint32_t* entries, size_t count) {
+
+				// Table lookups with plain loads and stores, AVX2 gathers measured slower than this on 24 and 32-bit palettes
+				size_t i = 0;
+
+				if (bytesPerEntry == 3) {
+					// Overlapping 4 byte stores, next pixel overwrites the extra byte
+					for (; i + 1 < count; i++) {
+						memcpy(&target[i * 3], &entries[indices[i]], 4);
+					}
+				}
+
+				for (; i < count; i++) {
+					memcpy(&target[i * bytesPerEntry], &entries[indices[i]], bytesPerEntry);
+				}
+			}
+
+			// Expands 5-bit channel to 8 bits, so that 31 maps to 255
+			inline uint8_t expandChannel5(unsigned int value) {
+				return (uint8_t) ((value << 3) | (value >> 2));
+			}
+
+			template<TGAFormat format>
+			inline TGAColor readColor(const uint8_t* pixel) {
+
+				TGAColor color;
+
+				// Format is known at compile time, only one case is left
+				switch (format) {
+				case LUMINANCE_U8:
+					color.r = color.g = color.b = pixel[0];
+					color.a = 255;
+					break;
+				case LUMINANCE_ALPHA_U16:
+					color.r = color.g = color.b = pixel[0];
+					color.a = pixel[1];
+					break;
+				case BGR555_U16:
+				case BGRA5551_U16: {
+					unsigned int value = pixel[0] | (pixel[1] << 8);
+					color.b = expandChannel5(value & 0x1F);
+					color.g = expandChannel5((value >> 5) & 0x1F);
+					color.r = expandChannel5((value >> 10) & 0x1F);
+					color.a = (format == BGR555_U16 || (value & 0x8000) != 0) ? 255 : 0;
+					break;
+				}
+				case BGR_U24:
+					color.b = pixel[0];
+					color.g = pixel[1];
+					color.r = pixel[2];
+					color.a = 255;
+					break;
+				case BGRA_U32:
+					color.b = pixel[0];
+					color.g = pixel[1];
+					color.r = pixel[2];
+					color.a = pixel[3];
+					break;
+				case RGB_U24:
+					color.r = pixel[0];
+					color.g = pixel[1];
+					color.b = pixel[2];
+					color.a = 255;
+					break;
+				case RGBA_U32:
+					color.r = pixel[0];
+					color.g = pixel[1];
+					color.b = pixel[2];
+					color.a = pixel[3];
+					break;
+				default:
+					color.r = color.g = color.b = color.a = 0;
+					break;
+				}
+
+				return color;
+			}
+
+			template<TGAFormat format>
+			inline void writeColor(uint8_t* pixel, const TGAColor &color) {
+
+				switch (format) {
+				case BGR_U24:
+					pixel[0] = color.b;
+					pixel[1] = color.g;
+					pixel[2] = color.r;
+					break;
+				case BGRA_U32:
+					pixel[0] = color.b;
+					pixel[1] = color.g;
+					pixel[2] = color.r;
+					pixel[3] = color.a;
+					break;
+				case RGB_U24:
+					pixel[0] = color.r;
+					pixel[1] = color.g;
+					pixel[2] = color.b;
+					break;
+				case RGBA_U32:
+					pixel[0] = color.r;
+					pixel[1] = color.g;
+					pixel[2] = color.b;
+					pixel[3] = color.a;
+					break;
+				default:
+					break;
+				}
+			}
+
+			void convertPixels(char* target, const char* input, TGAFormat inputFormat, TGAFormat outputFormat, size_t count) {
+
+				switch (inputFormat) {
+				case LUMINANCE_U8:
+					convertPixels<LUMINANCE_U8>(target, input, outputFormat, count);
+					break;
+				case LUMINANCE_ALPHA_U16:
+					convertPixels<LUMINANCE_ALPHA_U16>(target, input, outputFormat, count);
+					break;
+				case BGR555_U16:
+					convertPixels<BGR555_U16>(target, input, outputFormat, count);
+					break;
+				case BGRA5551_U16:
+					convertPixels<BGRA5551_U16>(target, input, outputFormat, count);
+					break;
+				case BGR_U24:
+					convertPixels<BGR_U24>(target, input, outputFormat, count);
+					break;
+				case BGRA_U32:
+					convertPixels<BGRA_U32>(target, input, outputFormat, count);
+					break;
+				default:
+					break;
+				}
+			}
+
+			template<TGAFormat inputFormat>
+			void convertPixels(char* target, const char* input, TGAFormat outputFormat, size_t count) {
+
+				switch (outputFormat) {
+				case RGBA_U32:
+					convertPixels<inputFormat, RGBA_U32>(target, input, count);
+					break;
+				case RGB_U24:
+					convertPixels<inputFormat, RGB_U24>(target, input, count);
+					break;
+				case BGRA_U32:
+					convertPixels<inputFormat, BGRA_U32>(target, input, count);
+					break;
+				default:
+					break;
+				}
+			}
+
+			template<TGAFormat inputFormat, TGAFormat outputFormat>
+			void convertPixels(char* target, const char* input, size_t count) {
+
+				const size_t inputPixelSize = getFormatSize(inputFormat);
+				const size_t outputPixelSize = getFormatSize(outputFormat);
+
+				if (inputFormat == outputFormat) {
+					// Same layout, nothing to convert
+					memcpy(target, input, count * inputPixelSize);
+					return;
+				}
+
+				size_t i = 0;
+
+#if defined(GWTGA_SSE2)
+				if (inputFormat == BGRA_U32 && outputFormat == RGBA_U32) {
+					// Swap red and blue bytes of 4 pixels at once
+					const __m128i greenAlpha = _mm_set1_epi32((int) 0xFF00FF00);
+					const __m128i lowByte = _mm_set1_epi32(0xFF);
+
+					for (; i + 4 <= count; i += 4) {
+						__m128i v = _mm_loadu_si128((const __m128i*) &input[i * 4]);
+						__m128i red = _mm_and_si128(_mm_srli_epi32(v, 16), lowByte);
+						__m128i blue = _mm_slli_epi32(_mm_and_si128(v, lowByte), 16);
+						_mm_storeu_si128((__m128i*) &target[i * 4], _mm_or_si128(_mm_and_si128(v, greenAlpha), _mm_or_si128(red, blue)));
+					}
+				}
+#endif
+
+				const uint8_t* source = (const uint8_t*) input;
+				uint8_t* destination = (uint8_t*) target;
+
+				for (; i < count; i++) {
+					writeColor<outputFormat>(&destination[i * outputPixelSize], readColor<inputFormat>(&source[i * inputPixelSize]));
+				}
+			}
+
+			template<TGAFormat inputFormat, TGAFormat outputFormat>
+			void fetchPixelConverted(char* target, const char* input, size_t, char*, size_t) {
+				convertPixels<inputFormat, outputFormat>(target, input, 1);
+			}
+
+			template<TGAFormat inputFormat, TGAFormat outputFormat>
+			void fetchPixelsConverted(char* target, const char* input, size_t, char*, size_t, size_t count) {
+				convertPixels<inputFormat, outputFormat>(target, input, count);
+			}
+
+			size_t readColorIndex(const char* input, size_t bytesPerIndex) {
+
+				const uint8_t* bytes = (const uint8_t*) input;
+
+				// Indices are little endian, assemble them byte by byte so we never read behind the index
+				switch (bytesPerIndex) {
+				case 1:
+					return bytes[0];
+				case 2:
+					return bytes[0] | (bytes[1] << 8);
+				case 3:
+					return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16);
+				default:
+					return 0;
+				}
+			}
+
+			void fillPixels(char* target, const char* pixel, size_t bytesPerPixel, size_t count) {
+
+				switch (bytesPerPixel) {
+				case 1:
+					memset(target, *pixel, count);
+					break;
+				case 2:
+					fillPixelsVector<2>(target, pixel, count);
+					break;
+				case 3:
+					fillPixelsVector<3>(target, pixel, count);
+					break;
+				case 4:
+					fillPixelsVector<4>(target, pixel, count);
+					break;
+				default:
+					for (size_t i = 0; i < count; i++) {
+						memcpy(target, pixel, bytesPerPixel);
+						target += bytesPerPixel;
+					}
+					break;
+				}
+			}
+
+#if defined(GWTGA_AVX2)
+			typedef __m256i fillVector;
+			inline fillVector loadFillVector(const char* source) { return _mm256_loadu_si256((const __m256i*) source); }
+			inline void storeFillVector(char* target, fillVector v) { _mm256_storeu_si256((__m256i*) target, v); }
+#elif defined(GWTGA_SSE2)
+			typedef __m128i fillVector;
+			inline fillVector loadFillVector(const char* source) { return _mm_loadu_si128((const __m128i*) source); }
+			inline void storeFillVector(char* target, fillVector v) { _mm_storeu_si128((__m128i*) target, v); }
+#else
+			struct fillVector { uint64_t parts[2]; };
+			inline fillVector loadFillVector(const char* source) { fillVector v; memcpy(&v, source, sizeof(v)); return v; }
+			inline void storeFillVector(char* target, fillVector v) { memcpy(target, &v, sizeof(v)); }
+#endif
+
+			template<size_t bytesPerPixel>
+			void fillPixelsVector(char* target, const char* pixel, size_t count) {
+
+				// Pattern of whole pixels spanning whole vectors - one vector for 2 and 4 byte pixels, 
+				// three vectors for 3 byte pixels (e.g. 48 bytes = 16 BGR pixels for SSE2)
+				const size_t patternVectors = bytesPerPixel == 3 ? 3 : 1;
+				const size_t patternSize = patternVectors * sizeof(fillVector);
+
+				char pattern[patternSize];
+				for (size_t i = 0; i < patternSize; i += bytesPerPixel) {
+					memcpy(&pattern[i], pixel, bytesPerPixel);
+				}
+
+				size_t size = count * bytesPerPixel;
+
+				if (size >= patternSize) {
+
+					fillVector v[patternVectors];
+					for (size_t i = 0; i < patternVectors; i++) {
+						v[i] = loadFillVector(&pattern[i * sizeof(fillVector)]);
+					}
+
+					do {
+						for (size_t i = 0; i < patternVectors; i++) {
+							storeFillVector(target + i * sizeof(fillVector), v[i]);
+						}
+
+						target += patternSize;
+						size -= patternSize;
+					} while (size >= patternSize);
+				}
+
+				// Rest of the run is prefix of the pattern
+				memcpy(target, pattern, size);
+			}
+
+			void reversePixels(char* row, size_t width, size_t bytesPerPixel) {
+
+				switch (bytesPerPixel) {
+				case 1:
+					reversePixelsVector<1>(row, width);
+					break;
+				case 2:
+					reversePixelsVector<2>(row, width);
+					break;
+				case 3:
+					reversePixelsVector<3>(row, width);
+					break;
+				case 4:
+					reversePixelsVector<4>(row, width);
+					break;
+				default:
+					reversePixelsScalar(row, row + width * bytesPerPixel, bytesPerPixel);
+					break;
+				}
+			}
+
+			void reversePixelsScalar(char* left, char* right, size_t bytesPerPixel) {
+
+				char pixel[16]; // max 16 bytes per pixel are supported (4 floats)
+
+				// right points behind the last pixel
+				while (right - left >= (ptrdiff_t) (2 * bytesPerPixel)) {
+					right -= bytesPerPixel;
+					memcpy(pixel, left, bytesPerPixel);
+					memcpy(left, right, bytesPerPixel);
+					memcpy(right, pixel, bytesPerPixel);
+					left += bytesPerPixel;
+				}
+			}
+
+#if defined(GWTGA_SSE2)
+			// Reverses order of 1, 2 or 4 byte pixels in 16 byte vector
+			template<size_t bytesPerPixel>
+			inline __m128i reverseVector(__m128i v) {
+
+				// Reverse 4 byte words
+				v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+
+				if (bytesPerPixel <= 2) {
+					// Swap 2 byte words within 4 byte words
+					v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+					v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+				}
+
+				if (bytesPerPixel == 1) {
+					// Swap bytes within 2 byte words
+					v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+				}
+
+				return v;
+			}
+#endif
+
+			template<size_t bytesPerPixel>
+			void reversePixelsVector(char* row, size_t width) {
+
+				char* left = row;
+				char* right = row + width * bytesPerPixel;
+
+#if defined(GWTGA_SSE2)
+				// Swap reversed vectors from both ends while they do not overlap, 3 byte pixels 
+				// cross vector lanes and are swapped one by one
+				while (bytesPerPixel != 3 && right - left >= 32) {
+					__m128i a = _mm_loadu_si128((const __m128i*) left);
+					__m128i b = _mm_loadu_si128((const __m128i*) (right - 16));
+
+					_mm_storeu_si128((__m128i*) left, reverseVector<bytesPerPixel>(b));
+					_mm_storeu_si128((__m128i*) (right - 16), reverseVector<bytesPerPixel>(a));
+
+					left += 16;
+					right -= 16;
+				}
+#endif
+
+				// Pixel size is known at compile time, so the copies below are inlined
+				char pixel[bytesPerPixel];
+
+				while (right - left >= (ptrdiff_t) (2 * bytesPerPixel)) {
+					right -= bytesPerPixel;
+					memcpy(pixel, left, bytesPerPixel);
+					memcpy(left, right, bytesPerPixel);
+					memcpy(right, pixel, bytesPerPixel);
+					left += bytesPerPixel;
+				}
+			}
+
+			unsigned int getMipLevelCount(size_t width, size_t height) {
+
+				unsigned int levels = 1;
+
+				while (width > 1 || height > 1) {
+					width = width > 1 ? width / 2 : 1;
+					height = height > 1 ? height / 2 : 1;
+					levels++;
+				}
+
+				return levels;
+			}
+
+			size_t getMipChainPixels(size_t width, size_t height) {
+
+				size_t pixels = width * height;
+
+				while (width > 1 || height > 1) {
+					width = width > 1 ? width / 2 : 1;
+					height = height > 1 ? height / 2 : 1;
+					pixels += width * height;
+				}
+
+				return pixels;
+			}
+
+			TGASRGBTables::TGASRGBTables() {
+
+				for (size_t i = 0; i < 256; i++) {
+					double value = i / 255.0;
+					double linear = value <= 0.04045 ? value / 12.92 : pow((value + 0.055) / 1.055, 2.4);
+					toLinear[i] = (uint16_t) (linear * 65535.0 + 0.5);
+				}
+
+				// Linear values round to nearest sRGB value, boundaries lie halfway between sRGB values
+				size_t linear = 0;
+
+				for (size_t i = 0; i < 255; i++) {
+					double value = (i + 0.5) / 255.0;
+					double boundary = (value <= 0.04045 ? value / 12.92 : pow((value + 0.055) / 1.055, 2.4)) * 65535.0;
+
+					for (; linear < 65536 && linear < boundary; linear++) {
+						fromLinear[linear] = (uint8_t) i;
+					}
+				}
+
+				for (; linear < 65536; linear++) {
+					fromLinear[linear] = 255;
+				}
+			}
+
+			const TGASRGBTables& getSRGBTables() {
+				static const TGASRGBTables tables;
+				return tables;
+			}
+
+			TGAMipChain::TGAMipChain(char* bytes, size_t width, size_t height, size_t bytesPerPixel, bool flipVertically, bool sRGB) 
+				: levelCount(getMipLevelCount(width, height)), bytesPerPixel(bytesPerPixel), flipVertically(flipVertically), sRGB(sRGB) {
+
+				for (size_t i = 0; i < levelCount; i++) {
+					levels[i].bytes = bytes;
+					levels[i].width = width;
+					levels[i].height = height;
+					levels[i].readyFront = 0;
+					levels[i].readyBack = height;
+
+					bytes += width * height * bytesPerPixel;
+					width = width > 1 ? width / 2 : 1;
+					height = height > 1 ? height / 2 : 1;
+				}
+
+				if (sRGB) {
+					getSRGBTables();
+				}
+			}
+
+			void TGAMipChain::rowsDecoded(size_t rowCount) {
+
+				// Rows of flipped image are stored from the bottom
+				if (flipVertically) {
+					levels[0].readyBack = levels[0].height - rowCount;
+				} else {
+					levels[0].readyFront = rowCount;
+				}
+
+				for (size_t i = 1; i < levelCount; i++) {
+					filterLevel(i);
+				}
+			}
+
+			void TGAMipChain::filterLevel(size_t level) {
+
+				Level &target = levels[level];
+				const Level &source = levels[level - 1];
+
+				// Odd last source row is dropped, source of height 1 is used twice
+				while (target.readyFront < target.readyBack) {
+					size_t row = target.readyFront;
+
+					if (!source.isReady(2 * row) || !source.isReady(source.clampRow(2 * row + 1))) {
+						break;
+					}
+
+					filterRow(level, row);
+					target.readyFront++;
+				}
+
+				while (target.readyFront < target.readyBack) {
+					size_t row = target.readyBack - 1;
+
+					if (!source.isReady(2 * row) || !source.isReady(source.clampRow(2 * row + 1))) {
+						break;
+					}
+
+					filterRow(level, row);
+					target.readyBack--;
+				}
+			}
+
+			void TGAMipChain::filterRow(size_t level, size_t row) {
+
+				const Level &target = levels[level];
+				const Level &source = levels[level - 1];
+
+				char* targetRow = &target.bytes[row * target.width * bytesPerPixel];
+				const char* sourceRow0 = &source.bytes[2 * row * source.width * bytesPerPixel];
+				const char* sourceRow1 = &source.bytes[source.clampRow(2 * row + 1) * source.width * bytesPerPixel];
+
+				switch (bytesPerPixel + (sRGB ? 4 : 0)) {
+				case 1:
+					filterMipRow<1, false>(targetRow, sourceRow0, sourceRow1, source.width, target.width);
+					break;
+				case 2:
+					filterMipRow<2, false>(targetRow, sourceRow0, sourceRow1, source.width, target.width);
+					break;
+				case 3:
+					filterMipRow<3, false>(targetRow, sourceRow0, sourceRow1, source.width, target.width);
+					break;
+				case 4:
+					filterMipRow<4, false>(targetRow, sourceRow0, sourceRow1, source.width, target.width);
+					break;
+				case 5:
+					filterMipRow<1, true>(targetRow, sourceRow0, sourceRow1, source.width, target.width);
+					break;
+				case 6:
+					filterMipRow<2, true>(targetRow, sourceRow0, sourceRow1, source.width, target.width);
+					break;
+				case 7:
+					filterMipRow<3, true>(targetRow, sourceRow0, sourceRow1, source.width, target.width);
+					break;
+				case 8:
+					filterMipRow<4, true>(targetRow, sourceRow0, sourceRow1, source.width, target.width);
+					break;
+				}
+			}
+
+			template<size_t bytesPerPixel, bool sRGB>
+			void filterMipRow(char* target, const char* sourceRow0, const char* sourceRow1, size_t sourceWidth, size_t targetWidth) {
+
+				// Last byte of greyscale with alpha and 32-bit pixels is alpha, which is always linear
+				const size_t alphaChannel = bytesPerPixel == 2 || bytesPerPixel == 4 ? bytesPerPixel - 1 : bytesPerPixel;
+
+				const uint8_t* row0 = (const uint8_t*) sourceRow0;
+				const uint8_t* row1 = (const uint8_t*) sourceRow1;
+				uint8_t* pixel = (uint8_t*) target;
+
+				// Source of width 1 uses its pixel twice, odd last source column is dropped
+				const size_t next = sourceWidth > 1 ? bytesPerPixel : 0;
+				const TGASRGBTables* tables = sRGB ? &getSRGBTables() : NULL;
+
+				for (size_t x = 0; x < targetWidth; x++) {
+					for (size_t i = 0; i < bytesPerPixel; i++) {
+						if (sRGB && i != alphaChannel) {
+							const uint16_t* toLinear = tables->toLinear;
+							unsigned int sum = toLinear[row0[i]] + toLinear[row0[i + next]] + toLinear[row1[i]] + toLinear[row1[i + next]];
+							pixel[i] = tables->fromLinear[(sum + 2) >> 2];
+						} else {
+							pixel[i] = (uint8_t) ((row0[i] + row0[i + next] + row1[i] + row1[i + next] + 2) >> 2);
+						}
+					}
+
+					pixel += bytesPerPixel;
+					row0 += 2 * bytesPerPixel;
+					row1 += 2 * bytesPerPixel;
+				}
+			}
+
+			template<class Input>
+			bool decompressRLEPixels(char* target, Input &input, size_t bytesPerPixel, size_t imgWidth, size_t imgHeight, bool flipVertically, bool flipHorizontally, unsigned int threadCount, ITGARowListener* rowListener, const TGARegion* region) {
+
+				switch (bytesPerPixel) {
+				case 1:
+					return decompressRLE<Input, fetchPixelUncompressed, fetchPixelsUncompressed, 1, 1>(target, input, NULL, 1, 1, imgWidth, imgHeight, flipVertically, flipHorizontally, threadCount, rowListener, region);
+				case 2:
+					return decompressRLE<Input, fetchPixelUncompressed, fetchPixelsUncompressed, 2, 2>(target, input, NULL, 2, 2, imgWidth, imgHeight, flipVertically, flipHorizontally, threadCount, rowListener, region);
+				case 3:
+					return decompressRLE<Input, fetchPixelUncompressed, fetchPixelsUncompressed, 3, 3>(target, input, NULL, 3, 3, imgWidth, imgHeight, flipVertically, flipHorizontally, threadCount, rowListener, region);
+				case 4:
+					return decompressRLE<Input, fetchPixelUncompressed, fetchPixelsUncompressed, 4, 4>(target, input, NULL, 4, 4, imgWidth, imgHeight, flipVertically, flipHorizontally, threadCount, rowListener, region);
+				default:
+					return decompressRLE<Input, fetchPixelUncompressed, fetchPixelsUncompressed, 0, 0>(target, input, NULL, bytesPerPixel, bytesPerPixel, imgWidth, imgHeight, flipVertically, flipHorizontally, threadCount, rowListener, region);
+				}
+			}
+
+			template<class Input>
+			bool decompressRLEColorTable(char* target, Input &input, TGAColorTable &colorTable, size_t bytesPerOutputPixel, size_t imgWidth, size_t imgHeight, bool flipVertically, bool flipHorizontally, unsigned int threadCount, ITGARowListener* rowListener, const TGARegion* region) {
+
+				char* entries = (char*) colorTable.entries;
+
+				switch (bytesPerOutputPixel) {
+				case 1:
+					return decompressRLE<Input, fetchPixelColorTable, fetchPixelsColorTable, 1, 1>(target, input, entries, 1, 1, imgWidth, imgHeight, flipVertically, flipHorizontally, threadCount, rowListener, region);
+				case 2:
+					return decompressRLE<Input, fetchPixelColorTable, fetchPixelsColorTable, 1, 2>(target, input, entries, 1, 2, imgWidth, imgHeight, flipVertically, flipHorizontally, threadCount, rowListener, region);
+				case 3:
+					return decompressRLE<Input, fetchPixelColorTable, fetchPixelsColorTable, 1, 3>(target, input, entries, 1, 3, imgWidth, imgHeight, flipVertically, flipHorizontally, threadCount, rowListener, region);
+				default:
+					return decompressRLE<Input, fetchPixelColorTable, fetchPixelsColorTable, 1, 4>(target, input, entries, 1, 4, imgWidth, imgHeight, flipVertically, flipHorizontally, threadCount, rowListener, region);
+				}
+			}
+
+			template<class Input>
+			bool decompressRLEConverted(char* target, Input &input, TGAFormat inputFormat, TGAFormat outputFormat, size_t imgWidth, size_t imgHeight, bool flipVertically, bool flipHorizontally, unsigned int threadCount, ITGARowListener* rowListener, const TGARegion* region) {
+
+				switch (inputFormat) {
+				case LUMINANCE_U8:
+					return decompressRLEConverted<Input, LUMINANCE_U8, 1>(target, input, outputFormat, imgWidth, imgHeight, flipVertically, flipHorizontally, threadCount, rowListener, region);
+				case LUMINANCE_ALPHA_U16:
+					return decompressRLEConverted<Input, LUMINANCE_ALPHA_U16, 2>(target, input, outputFormat, imgWidth, imgHeight, flipVertically, flipHorizontally, threadCount, rowListener, region);
+				case BGR555_U16:
+					return decompressRLEConverted<Input, BGR555_U16, 2>(target, input, outputFormat, imgWidth, imgHeight, flipVertically, flipHorizontally, threadCount, rowListener, region);
+				case BGRA5551_U16:
+					return decompressRLEConverted<Input, BGRA5551_U16, 2>(target, input, outputFormat, imgWidth, imgHeight, flipVertically, flipHorizontally, threadCount, rowListener, region);
+				case BGR_U24:
+					return decompressRLEConverted<Input, BGR_U24, 3>(target, input, outputFormat, imgWidth, imgHeight, flipVertically, flipHorizontally, threadCount, rowListener, region);
+				case BGRA_U32:
+					return decompressRLEConverted<Input, BGRA_U32, 4>(target, input, outputFormat, imgWidth, imgHeight, flipVertically, flipHorizontally, threadCount, rowListener, region);
+				default:
+					return false;
+				}
+			}
+
+			template<class Input, TGAFormat inputFormat, size_t bytesPerInputPixel>
+			bool decompressRLEConverted(char* target, Input &input, TGAFormat outputFormat, size_t imgWidth, size_t imgHeight, bool flipVertically, bool flipHorizontally, unsigned int threadCount, ITGARowListener* rowListener, const TGARegion* region) {
+
+				switch (outputFormat) {
+				case RGBA_U32:
+					return decompressRLE<Input, fetchPixelConverted<inputFormat, RGBA_U32>, fetchPixelsConverted<inputFormat, RGBA_U32>, bytesPerInputPixel, 4>(target, input, NULL, bytesPerInputPixel, 4, imgWidth, imgHeight, flipVertically, flipHorizontally, threadCount, rowListener, region);
+				case RGB_U24:
+					return decompressRLE<Input, fetchPixelConverted<inputFormat, RGB_U24>, fetchPixelsConverted<inputFormat, RGB_U24>, bytesPerInputPixel, 3>(target, input, NULL, bytesPerInputPixel, 3, imgWidth, imgHeight, flipVertically, flipHorizontally, threadCount, rowListener, region);
+				case BGRA_U32:
+					return decompressRLE<Input, fetchPixelConverted<inputFormat, BGRA_U32>, fetchPixelsConverted<inputFormat, BGRA_U32>, bytesPerInputPixel, 4>(target, input, NULL, bytesPerInputPixel, 4, imgWidth, imgHeight, flipVertically, flipHorizontally, threadCount, rowListener, region);
+				default:
+					return false;
+				}
+			}
+
+			template<class Input, fetchPixelFunc fetchPixel, fetchPixelsFunc fetchPixels, size_t bytesPerInputPixel, size_t bytesPerOutputPixel>
+			bool decompressRLE(char* target, Input &input, char* colorMap, size_t runtimeBytesPerInputPixel, size_t runtimeBytesPerOutputPixel, size_t imgWidth, size_t imgHeight, bool flipVertically, bool flipHorizontally, unsigned int threadCount, ITGARowListener* rowListener, const TGARegion* region) {
+
+				if (region != NULL) {
+					// Mip levels of region are filtered once it is decoded
+					return decompressRLERegion<fetchPixel, fetchPixels, bytesPerInputPixel, bytesPerOutputPixel>(target, input, colorMap, runtimeBytesPerInputPixel, runtimeBytesPerOutputPixel, imgWidth, imgHeight, *region, flipVertically, flipHorizontally);
+				}
+
+				if (flipVertically) {
+					if (flipHorizontally) {
+						return decompressRLEBands<fetchPixel, fetchPixels, bytesPerInputPixel, bytesPerOutputPixel, true, true>(target, input, colorMap, runtimeBytesPerInputPixel, runtimeBytesPerOutputPixel, imgWidth, imgHeight, threadCount, rowListener);
+					} else {
+						return decompressRLEBands<fetchPixel, fetchPixels, bytesPerInputPixel, bytesPerOutputPixel, true, false>(target, input, colorMap, runtimeBytesPerInputPixel, runtimeBytesPerOutputPixel, imgWidth, imgHeight, threadCount, rowListener);
+					}
+				} else {
+					if (flipHorizontally) {
+						return decompressRLEBands<fetchPixel, fetchPixels, bytesPerInputPixel, bytesPerOutputPixel, false, true>(target, input, colorMap, runtimeBytesPerInputPixel, runtimeBytesPerOutputPixel, imgWidth, imgHeight, threadCount, rowListener);
+					} else {
+						return decompressRLEBands<fetchPixel, fetchPixels, bytesPerInputPixel, bytesPerOutputPixel, false, false>(target, input, colorMap, runtimeBytesPerInputPixel, runtimeBytesPerOutputPixel, imgWidth, imgHeight, threadCount, rowListener);
+					}
+				}
+			}
+
+			template<class Input, fetchPixelFunc fetchPixel, fetchPixelsFunc fetchPixels, size_t bytesPerInputPixel, size_t bytesPerOutputPixel, bool flipVertically, bool flipHorizontally>
+			bool decompressRLEKernel(char* target, Input &input, char* colorMap, size_t runtimeBytesPerInputPixel, size_t runtimeBytesPerOutputPixel, size_t imgWidth, size_t imgHeight, const TGARLEBand &band) {
+
+				// Compile time pixel sizes turn the memcpys below into plain loads and stores
+				const size_t inputPixelSize = bytesPerInputPixel ? bytesPerInputPixel : runtimeBytesPerInputPixel;
+				const size_t outputPixelSize = bytesPerOutputPixel ? bytesPerOutputPixel : runtimeBytesPerOutputPixel;
+
+				if (band.pixelCount == 0) {
+					return true;
+				}
+
+				// Row listener counts rows of image, not of the long row below
+				const size_t rowPixels = imgWidth;
+				size_t notifyPixels = rowPixels;
+
+				// Flipping both ways reverses the whole image, so it is decoded as one long row, same as the unflipped image
+				if (flipVertically == flipHorizontally) {
+					imgWidth *= imgHeight;
+					imgHeight = 1;
+				}
+
+				size_t rowSize = imgWidth * outputPixelSize;
+
+				// Row and column of next pixel in file order
+				size_t y = band.firstPixel / imgWidth;
+				size_t x = band.firstPixel % imgWidth;
+				char* row = &target[(flipVertically && !flipHorizontally ? imgHeight - 1 - y : y) * rowSize];
+
+				size_t remainingPixels = band.pixelCount;
+				size_t skipPixels = band.skipPixels;
+				TGAPacketCounter packets;
+
+				// Read packets until all pixels have been read
+				while (remainingPixels > 0) {
+
+					// Read packet type (RLE compressed or RAW data)
+					const char* packetHeader = input.fetch(1);
+
+					if (!packetHeader) {
+						return false;
+					}
+
+					size_t repetitionCount = (*packetHeader & 0x7F) + 1;
+					bool rlePacket = (*packetHeader & 0x80) == 0x80;
+
+					// Read repeated color value or whole RAW packet at once
+					const char* colorValues = input.fetch(inputPixelSize * (rlePacket ? 1 : repetitionCount));
+
+					if (!colorValues) {
+						return false;
+					}
+
+					bool continuedPacket = skipPixels > 0;
+
+					if (skipPixels > 0) {
+						// First packet of band starts in previous band
+						if (skipPixels >= repetitionCount) {
+							return false;
+						}
+
+						repetitionCount -= skipPixels;
+
+						if (!rlePacket) {
+							colorValues += skipPixels * inputPixelSize;
+						}
+
+						skipPixels = 0;
+					}
+
+					if (repetitionCount > remainingPixels) {
+						if (!band.clipLastPacket) {
+							// Packet does not fit into image
+							return false;
+						}
+
+						// Rest of packet belongs to next band
+						repetitionCount = remainingPixels;
+					}
+
+					remainingPixels -= repetitionCount;
+					packets.add(rlePacket, repetitionCount, continuedPacket);
+
+					// Resolve color value of RLE packet once
+					char color[16]; // max 16 bytes per pixel are supported (4 floats)
+
+					if (rlePacket) {
+						fetchPixel(color, colorValues, inputPixelSize, colorMap, outputPixelSize);
+					}
+
+					// Pixels of packet within one row stay continuous after flipping (reversed when flipping horizontally), 
+					// emit each row span at once
+					while (repetitionCount > 0) {
+
+						size_t span = imgWidth - x;
+						if (span > repetitionCount) span = repetitionCount;
+
+						char* spanTarget = &row[(flipHorizontally ? imgWidth - x - span : x) * outputPixelSize];
+
+						if (rlePacket) {
+							fillPixels(spanTarget, color, outputPixelSize, span);
+						} else {
+							fetchPixels(spanTarget, colorValues, inputPixelSize, colorMap, outputPixelSize, span);
+							colorValues += span * inputPixelSize;
+
+							if (flipHorizontally) {
+								reversePixels(spanTarget, span, outputPixelSize);
+							}
+						}
+
+						repetitionCount -= span;
+						x += span;
+
+						if (x == imgWidth) {
+							// Move to next row
+							x = 0;
+							y++;
+
+							if (y < imgHeight) {
+								row = &target[(flipVertically && !flipHorizontally ? imgHeight - 1 - y : y) * rowSize];
+							}
+						}
+					}
+
+					// Let listener process finished rows while they are still in cache
+					if (band.rowListener != NULL && band.pixelCount - remainingPixels >= notifyPixels) {
+						size_t decodedRows = (band.pixelCount - remainingPixels) / rowPixels;
+						band.rowListener->rowsDecoded(decodedRows);
+						notifyPixels = (decodedRows + 1) * rowPixels;
+					}
+				}
+
+				recordPackets(packets, packets.size(inputPixelSize));
+
+				return true;
+			}
+
+			template<fetchPixelFunc fetchPixel, fetchPixelsFunc fetchPixels, size_t bytesPerInputPixel, size_t bytesPerOutputPixel, bool flipVertically, bool flipHorizontally>
+			bool decompressRLEBands(char* target, TGAStreamInput &input, char* colorMap, size_t runtimeBytesPerInputPixel, size_t runtimeBytesPerOutputPixel, size_t imgWidth, size_t imgHeight, unsigned int, ITGARowListener* rowListener) {
+
+				// Stream can be read only in order, decode whole image on calling thread
+				return decompressRLEKernel<TGAStreamInput, fetchPixel, fetchPixels, bytesPerInputPixel, bytesPerOutputPixel, flipVertically, flipHorizontally>(target, input, colorMap, runtimeBytesPerInputPixel, runtimeBytesPerOutputPixel, imgWidth, imgHeight, TGARLEBand(imgWidth * imgHeight, rowListener));
+			}
+
+			template<fetchPixelFunc fetchPixel, fetchPixelsFunc fetchPixels, size_t bytesPerInputPixel, size_t bytesPerOutputPixel, bool flipVertically, bool flipHorizontally>
+			bool decompressRLEBands(char* target, TGAMemoryInput &input, char* colorMap, size_t runtimeBytesPerInputPixel, size_t runtimeBytesPerOutputPixel, size_t imgWidth, size_t imgHeight, unsigned int threadCount, ITGARowListener* rowListener) {
+
+				decompressRLEFunc kernel = decompressRLEKernel<TGAMemoryInput, fetchPixel, fetchPixels, bytesPerInputPixel, bytesPerOutputPixel, flipVertically, flipHorizontally>;
+
+				if (threadCount > 1 && imgWidth * imgHeight >= TGA_PARALLEL_MIN_PIXELS) {
+					return decompressRLEParallel(kernel, target, input, colorMap, runtimeBytesPerInputPixel, runtimeBytesPerOutputPixel, imgWidth, imgHeight, threadCount);
+				}
+
+				return kernel(target, input, colorMap, runtimeBytesPerInputPixel, runtimeBytesPerOutputPixel, imgWidth, imgHeight, TGARLEBand(imgWidth * imgHeight, rowListener));
+			}
+
+			template<fetchPixelFunc fetchPixel, fetchPixelsFunc fetchPixels, size_t bytesPerInputPixel, size_t bytesPerOutputPixel>
+			bool decompressRLERegion(char* target, TGAStreamInput &input, char* colorMap, size_t runtimeBytesPerInputPixel, size_t runtimeBytesPerOutputPixel, size_t imgWidth, size_t imgHeight, const TGARegion &region, bool flipVertically, bool flipHorizontally) {
+				return decompressRLERegionKernel<TGAStreamInput, fetchPixel, fetchPixels, bytesPerInputPixel, bytesPerOutputPixel>(target, input, colorMap, runtimeBytesPerInputPixel, runtimeBytesPerOutputPixel, imgWidth, imgHeight, region, 0, region.y + region.height, flipVertically, flipHorizontally);
+			}
+
+			template<fetchPixelFunc fetchPixel, fetchPixelsFunc fetchPixels, size_t bytesPerInputPixel, size_t bytesPerOutputPixel>
+			bool decompressRLERegion(char* target, TGAMemoryInput &input, char* colorMap, size_t runtimeBytesPerInputPixel, size_t runtimeBytesPerOutputPixel, size_t imgWidth, size_t imgHeight, const TGARegion &region, bool flipVertically, bool flipHorizontally) {
+
+				const char* table = findScanLineTable(input, imgHeight);
+
+				// Rows of region have to lie within pixel data, otherwise packets are walked from the first one
+				size_t dataOffset = input.position() - input.data();
+
+				for (size_t y = region.y; table != NULL && y < region.y + region.height; y++) {
+					size_t offset = readUInt32(table + 4 * y);
+
+					if (offset < dataOffset || offset >= input.size()) {
+						table = NULL;
+					}
+				}
+
+				if (table == NULL) {
+					return decompressRLERegionKernel<TGAMemoryInput, fetchPixel, fetchPixels, bytesPerInputPixel, bytesPerOutputPixel>(target, input, colorMap, runtimeBytesPerInputPixel, runtimeBytesPerOutputPixel, imgWidth, imgHeight, region, 0, region.y + region.height, flipVertically, flipHorizontally);
+				}
+
+				// Packets do not cross rows in files with scan line table, every row is decoded from its own offset
+				for (size_t y = region.y; y < region.y + region.height; y++) {
+					size_t offset = readUInt32(table + 4 * y);
+					TGAMemoryInput rowInput(input.data() + offset, input.size() - offset);
+
+					if (!decompressRLERegionKernel<TGAMemoryInput, fetchPixel, fetchPixels, bytesPerInputPixel, bytesPerOutputPixel>(target, rowInput, colorMap, runtimeBytesPerInputPixel, runtimeBytesPerOutputPixel, imgWidth, imgHeight, region, y, y + 1, flipVertically, flipHorizontally)) {
+						return false;
+					}
+				}
+
+				return true;
+			}
+
+			template<class Input, fetchPixelFunc fetchPixel, fetchPixelsFunc fetchPixels, size_t bytesPerInputPixel, size_t bytesPerOutputPixel>
+			bool decompressRLERegionKernel(char* target, Input &input, char* colorMap, size_t runtimeBytesPerInputPixel, size_t runtimeBytesPerOutputPixel, size_t imgWidth, size_t imgHeight, const TGARegion &region, size_t firstRow, size_t endRow, bool flipVertically, bool flipHorizontally) {
+
+				const size_t inputPixelSize = bytesPerInputPixel ? bytesPerInputPixel : runtimeBytesPerInputPixel;
+				const size_t outputPixelSize = bytesPerOutputPixel ? bytesPerOutputPixel : runtimeBytesPerOutputPixel;
+
+				size_t rowSize = region.width * outputPixelSize;
+				size_t regionEnd = region.x + region.width;
+
+				// Row and column of next pixel in file order, decoding stops behind the last pixel of region in the last row
+				size_t y = firstRow;
+				size_t x = 0;
+				size_t remainingPixels = (endRow - firstRow - 1) * imgWidth + regionEnd;
+				size_t imagePixels = (imgHeight - firstRow) * imgWidth;
+				TGAPacketCounter packets;
+
+				while (remainingPixels > 0) {
+
+					const char* packetHeader = input.fetch(1);
+
+					if (!packetHeader) {
+						return false;
+					}
+
+					size_t repetitionCount = (*packetHeader & 0x7F) + 1;
+					bool rlePacket = (*packetHeader & 0x80) == 0x80;
+					size_t packetSize = inputPixelSize * (rlePacket ? 1 : repetitionCount);
+
+					if (repetitionCount > imagePixels) {
+						// Packet does not fit into image
+						return false;
+					}
+
+					imagePixels -= repetitionCount;
+					remainingPixels -= repetitionCount < remainingPixels ? repetitionCount : remainingPixels;
+					packets.add(rlePacket, repetitionCount, false);
+
+					// Pixel data is read only when some row span of packet lies within region
+					const char* colorValues = NULL;
+					char color[16]; // max 16 bytes per pixel are supported (4 floats)
+					size_t packetPixel = 0;
+
+					while (repetitionCount > 0) {
+
+						size_t span = imgWidth - x;
+						if (span > repetitionCount) span = repetitionCount;
+
+						size_t first = x > region.x ? x : region.x;
+						size_t last = x + span < regionEnd ? x + span : regionEnd;
+
+						if (y >= region.y && y < region.y + region.height && first < last) {
+
+							if (colorValues == NULL) {
+								colorValues = input.fetch(packetSize);
+
+								if (!colorValues) {
+									return false;
+								}
+
+								if (rlePacket) {
+									fetchPixel(color, colorValues, inputPixelSize, colorMap, outputPixelSize);
+								}
+							}
+
+							size_t count = last - first;
+							size_t column = first - region.x;
+							char* row = &target[(flipVertically ? region.y + region.height - 1 - y : y - region.y) * rowSize];
+							char* spanTarget = &row[(flipHorizontally ? region.width - column - count : column) * outputPixelSize];
+
+							if (rlePacket) {
+								fillPixels(spanTarget, color, outputPixelSize, count);
+							} else {
+								fetchPixels(spanTarget, colorValues + (packetPixel + first - x) * inputPixelSize, inputPixelSize, colorMap, outputPixelSize, count);
+
+								if (flipHorizontally) {
+									reversePixels(spanTarget, count, outputPixelSize);
+								}
+							}
+						}
+
+						repetitionCount -= span;
+						packetPixel += span;
+						x += span;
+
+						if (x == imgWidth) {
+							x = 0;
+							y++;
+						}
+					}
+
+					if (colorValues == NULL) {
+						input.skip(packetSize);
+
+						if (input.fail()) {
+							return false;
+						}
+					}
+				}
+
+				recordPackets(packets, packets.size(inputPixelSize));
+
+				return true;
+			}
+
+			bool decompressRLEParallel(decompressRLEFunc kernel, char* target, TGAMemoryInput &input, char* colorMap, size_t bytesPerInputPixel, size_t bytesPerOutputPixel, size_t imgWidth, size_t imgHeight, unsigned int threadCount) {
+
+				TGARLEBand image(imgWidth * imgHeight, NULL);
+
+				// Few bands per thread balance the load when some parts of image compress better than others
+				size_t bandRows = (imgHeight + threadCount * 4 - 1) / (threadCount * 4);
+				size_t bandCount = (imgHeight + bandRows - 1) / bandRows;
+
+				std::vector<TGARLEBand> bands(bandCount);
+
+				for (size_t i = 0; i < bandCount; i++) {
+					size_t firstRow = i * bandRows;
+					size_t rows = imgHeight - firstRow < bandRows ? imgHeight - firstRow : bandRows;
+
+					bands[i].firstPixel = firstRow * imgWidth;
+					bands[i].pixelCount = rows * imgWidth;
+				}
+
+				// Scan line table of TGA 2.0 files points directly to rows, otherwise packets are scanned for band starts
+				bool fromScanLineTable = findScanLineBands(input, imgWidth, imgHeight, bands);
+
+				if (!fromScanLineTable && !scanRLEBands(input.position(), input.available(), bytesPerInputPixel, imgWidth * imgHeight, bands)) {
+					// Invalid data, let sequential decoding report where it ends
+					return kernel(target, input, colorMap, bytesPerInputPixel, bytesPerOutputPixel, imgWidth, imgHeight, image);
+				}
+
+				struct Batch {
+					decompressRLEFunc kernel;
+					char* target;
+					const TGAMemoryInput* input;
+					char* colorMap;
+					size_t bytesPerInputPixel;
+					size_t bytesPerOutputPixel;
+					size_t imgWidth;
+					size_t imgHeight;
+					std::vector<TGARLEBand>* bands;
+					std::atomic<bool>* failed;
+					TGAStatsContext stats;
+
+					static void run(void* context, size_t index) {
+						Batch* batch = (Batch*) context;
+						TGAStatsScope statsScope(batch->stats);
+
+						TGARLEBand &band = (*batch->bands)[index];
+						const char* bandStart = batch->input->position() + band.inputOffset;
+						TGAMemoryInput bandInput(bandStart, batch->input->available() - band.inputOffset);
+
+						if (!batch->kernel(batch->target, bandInput, batch->colorMap, batch->bytesPerInputPixel, batch->bytesPerOutputPixel, batch->imgWidth, batch->imgHeight, band)) {
+							*batch->failed = true;
+						}
+
+						band.inputEnd = band.inputOffset + (bandInput.position() - bandStart);
+					}
+				};
+
+				std::atomic<bool> failed(false);
+
+				// Threads of pool and calling thread decode bands
+				Batch batch = { kernel, target, &input, colorMap, bytesPerInputPixel, bytesPerOutputPixel, imgWidth, imgHeight, &bands, &failed, getStatsContext() };
+				runTasks(Batch::run, &batch, bandCount, threadCount);
+
+				if (fromScanLineTable) {
+					// Each band has to end where next one starts, otherwise packets cross rows or table is damaged
+					for (size_t i = 0; i + 1 < bandCount && !failed; i++) {
+						if (bands[i].inputEnd != bands[i + 1].inputOffset) {
+							failed = true;
+						}
+					}
+
+					if (failed) {
+						return kernel(target, input, colorMap, bytesPerInputPixel, bytesPerOutputPixel, imgWidth, imgHeight, image);
+					}
+				}
+
+				if (failed) {
+					return false;
+				}
+
+				// Move input behind the last packet
+				input.skip(bands.back().inputEnd);
+
+				return true;
+			}
+
+			bool scanRLEBands(const char* data, size_t size, size_t bytesPerInputPixel, size_t pixelsNumber, std::vector<TGARLEBand> &bands) {
+
+				size_t offset = 0;
+				size_t pixel = 0;
+				size_t band = 0;
+
+				// Walk packet headers only, band starts inside packet which contains its first pixel
+				while (pixel < pixelsNumber) {
+
+					if (offset >= size) {
+						return false;
 					}
 
-			}  else if (header.ImageType == 1 || header.ImageType == 9 ) {
+					unsigned char packetHeader = (unsigned char) data[offset];
+					size_t repetitionCount = (packetHeader & 0x7F) + 1;
 
-				// 1  -  Uncompressed, color-mapped images
-				// 9  -  Runlength encoded color-mapped images
+					for (; band < bands.size() && bands[band].firstPixel < pixel + repetitionCount; band++) {
+						bands[band].inputOffset = offset;
+						bands[band].skipPixels = bands[band].firstPixel - pixel;
+						bands[band].clipLastPacket = true;
+					}
 
-				if (header.imageSpec.bitsPerPixel != 8 && header.imageSpec.bitsPerPixel != 16 && header.imageSpec.bitsPerPixel != 24) {
-					// Unsupported color map entry length
-					resultImage.error = GWTGA_UNSUPPORTED_PIXEL_DEPTH;
-					return resultImage;
+					offset += 1 + bytesPerInputPixel * ((packetHeader & 0x80) ? 1 : repetitionCount);
+					pixel += repetitionCount;
 				}
 
-				if (header.colorMapType != 1 || colorMap == NULL) {
-					// Color map not present in file
-					resultImage.error = GWTGA_INVALID_DATA;
-					return resultImage;
-				}
+				// Packets have to end exactly at the end of image and fit into data
+				return pixel == pixelsNumber && offset <= size;
+			}
 
-				if (header.ImageType == 1) {
+			bool findScanLineBands(const TGAMemoryInput &input, size_t imgWidth, size_t imgHeight, std::vector<TGARLEBand> &bands) {
 
-					// 1  -  Uncompressed, color-mapped images
-					size_t stride;
-					flipFunc flipFuncType;
+				const char* file = input.data();
+				size_t fileSize = input.size();
+				size_t dataOffset = input.position() - file;
 
-					getFlipFunction(flipFuncType, stride, flipVertically, flipHorizontally, resultImage.width, resultImage.height);
+				const char* table = findScanLineTable(input, imgHeight);
 
-					for (size_t i = 0; i < resultImage.width * resultImage.height; i += stride) {
-						fetchPixelsColorMap(&resultImage.bytes[flipFuncType(i, resultImage.width, resultImage.height, bytesPerPixel)], stream, header.imageSpec.bitsPerPixel / 8, colorMap, bytesPerPixel, stride);
-					}
+				if (table == NULL) {
+					return false;
+				}
 
-				} else if (header.ImageType == 9) {
+				size_t previous = dataOffset;
 
-					bool perPixelProcessing;
-					size_t stride;
-					flipFunc flipFuncType;
+				for (size_t i = 0; i < bands.size(); i++) {
 
-					getFlipFunction(flipFuncType, stride, flipVertically, flipHorizontally, resultImage.width, resultImage.height);
+					size_t offset = readUInt32(table + 4 * (bands[i].firstPixel / imgWidth));
 
-					if (stride == resultImage.width * resultImage.height) {
-						perPixelProcessing = false;
-					} else {
-						perPixelProcessing = true;
+					// Rows have to follow each other within file
+					if (offset < previous || offset >= fileSize || (i == 0 && offset != dataOffset)) {
+						return false;
 					}
 
-					// 9  -  Runlength encoded color-mapped images
-					if (!decompressRLE<fetchPixelColorMap, fetchPixelsColorMap>(resultImage.bytes, pixelsNumber, header.imageSpec.bitsPerPixel / 8, stream, colorMap, bytesPerPixel, resultImage.width, resultImage.height, flipFuncType, perPixelProcessing)) {
-						// Error while reading compressed image data
-						resultImage.error = GWTGA_IO_ERROR;
-						return resultImage;
-					}
+					bands[i].inputOffset = offset - dataOffset;
+					bands[i].skipPixels = 0;
+					bands[i].clipLastPacket = false;
+
+					previous = offset;
 				}
+
+				return true;
 			}
 
-			return resultImage;
-		}
+			const char* findScanLineTable(const TGAMemoryInput &input, size_t imgHeight) {
 
-		TGAError SaveTga(char* fileName, const TGAImage &image) {
-			return SaveTga(fileName, image, GWTGA_OPTIONS_NONE);
-		}
+				const char* file = input.data();
+				size_t fileSize = input.size();
 
-		TGAError SaveTga(std::ostream &stream, const TGAImage &image) {
-			return SaveTga(stream, image, GWTGA_OPTIONS_NONE);
-		}
+				if (fileSize < TGA_HEADER_SIZE + TGA_FOOTER_SIZE) {
+					return NULL;
+				}
 
-		TGAError SaveTga(char* fileName, const TGAImage &image, TGAOptions options) {
+				TGAImageInfo info;
+				getFooterInfo(file + fileSize - TGA_FOOTER_SIZE, fileSize, info);
 
-			std::ofstream fileStream;
-			fileStream.open(fileName, std::ofstream::out | std::ofstream::binary);
+				if (info.extensionOffset == 0 || fileSize - info.extensionOffset < TGA_EXTENSION_SIZE || readUInt16(file + info.extensionOffset) < TGA_EXTENSION_SIZE) {
+					// No extension area
+					return NULL;
+				}
 
-			if (fileStream.fail()) {
-				return GWTGA_CANNOT_OPEN_FILE; 
+				size_t tableOffset = readUInt32(file + info.extensionOffset + TGA_EXTENSION_SCAN_LINE_OFFSET);
+
+				if (tableOffset == 0 || tableOffset > fileSize || (fileSize - tableOffset) / 4 < imgHeight) {
+					// No scan line table
+					return NULL;
+				}
+
+				return file + tableOffset;
 			}
 
-			TGAError err = SaveTga(fileStream, image, options);
+			void writeFlippedRows(TGAStreamOutput &output, const char* source, size_t imgWidth, size_t imgHeight, size_t bytesPerPixel, bool flipVertically, bool flipHorizontally) {
 
-			fileStream.close();
+				size_t rowSize = imgWidth * bytesPerPixel;
 
-			return err;
-		}
+				// Horizontally flipped row is assembled in reusable buffer
+				std::vector<char> row(flipHorizontally ? rowSize : 0);
 
-		TGAError SaveTga(std::ostream &stream, const TGAImage &image, TGAOptions options) {
+				for (size_t y = 0; y < imgHeight; y++) {
 
-			if (image.hasError()) {
-				// Input image is in error state
-				return GWTGA_INVALID_DATA;
-			}
+					const char* sourceRow = &source[(flipVertically ? imgHeight - 1 - y : y) * rowSize];
 
-			// Assert height and width and origin coords is 16-bit unsigned int
-			if (image.width > 0xFFFF || image.height > 0xFFFF || image.xOrigin > 0xFFFF || image.yOrigin > 0xFFFF) {
-				// Invalid image dimensions
-				return GWTGA_INVALID_DATA;
-			}
+					if (flipHorizontally) {
+						memcpy(&row[0], sourceRow, rowSize);
+						reversePixels(&row[0], imgWidth, bytesPerPixel);
+						sourceRow = &row[0];
+					}
 
-			// Assert height and width are non-null
-			if (image.width == 0 || image.height == 0) {
-				// Invalid image dimensions
-				return GWTGA_INVALID_DATA;
+					output.write(sourceRow, rowSize);
+				}
 			}
 
-			if ((image.bitsPerPixel & 0x07) != 0) {
-				// Bits per pixel has to be divisible by 8
-				return GWTGA_UNSUPPORTED_PIXEL_DEPTH;
-			}
+			bool compressRLE(TGAStreamOutput &output, const char* source, size_t imgWidth, size_t imgHeight, size_t bytesPerPixel, bool flipVertically, bool flipHorizontally, bool optimal, unsigned int threadCount, std::vector<size_t>* rowOffsets) {
 
-			if (image.hasColorMap() && (image.colorMap.bitsPerPixel & 0x07) != 0) {
-				// Bits per pixel has to be divisible by 8 for color map too
-				return GWTGA_UNSUPPORTED_PIXEL_DEPTH;
+				switch (bytesPerPixel) {
+				case 1:
+					return compressRLE<1>(output, source, imgWidth, imgHeight, 1, flipVertically, flipHorizontally, optimal, threadCount, rowOffsets);
+				case 2:
+					return compressRLE<2>(output, source, imgWidth, imgHeight, 2, flipVertically, flipHorizontally, optimal, threadCount, rowOffsets);
+				case 3:
+					return compressRLE<3>(output, source, imgWidth, imgHeight, 3, flipVertically, flipHorizontally, optimal, threadCount, rowOffsets);
+				case 4:
+					return compressRLE<4>(output, source, imgWidth, imgHeight, 4, flipVertically, flipHorizontally, optimal, threadCount, rowOffsets);
+				default:
+					return compressRLE<0>(output, source, imgWidth, imgHeight, bytesPerPixel, flipVertically, flipHorizontally, optimal, threadCount, rowOffsets);
+				}
 			}
 
-			// Parse options
-			bool useRLEcompression = ((options & GWTGA_COMPRESS_RLE) == GWTGA_COMPRESS_RLE);
-			bool flipVertically = ((options & GWTGA_FLIP_VERTICALLY) == GWTGA_FLIP_VERTICALLY);
-			bool flipHorizontally = ((options & GWTGA_FLIP_HORIZONTALLY) == GWTGA_FLIP_HORIZONTALLY);
+			template<size_t bytesPerPixel>
+			bool compressRLE(TGAStreamOutput &output, const char* source, size_t imgWidth, size_t imgHeight, size_t runtimeBytesPerPixel, bool flipVertically, bool flipHorizontally, bool optimal, unsigned int threadCount, std::vector<size_t>* rowOffsets) {
 
-			// Write header
-			TGAHeader header;
-			header.iDLength = 0;
-			header.colorMapType = image.hasColorMap() ? 1 : 0;
-
-			switch (image.colorType) {
-			case GWTGA_RGB:
-				if (header.colorMapType == 1) {
-					if (useRLEcompression) {
-						header.ImageType = 9; //< Runlength encoded color-mapped image
-					} else {
-						header.ImageType = 1; //< Uncompressed color-mapped image
-					}
-				} else {
-					if (useRLEcompression) {
-						header.ImageType = 10; //< Runlength encoded RGB
+				if (flipVertically) {
+					if (flipHorizontally) {
+						return compressRLEBands<bytesPerPixel, true, true>(output, source, imgWidth, imgHeight, runtimeBytesPerPixel, optimal, threadCount, rowOffsets);
 					} else {
-						header.ImageType = 2; //< Uncompressed RGB 
+						return compressRLEBands<bytesPerPixel, true, false>(output, source, imgWidth, imgHeight, runtimeBytesPerPixel, optimal, threadCount, rowOffsets);
 					}
-				}
-				break;
-			case GWTGA_GREYSCALE:
-				if (header.colorMapType == 1) {
-					// TGA does not support greyscale color mapped images
-					return GWTGA_INVALID_DATA;
 				} else {
-					if (useRLEcompression) {
-						header.ImageType = 11; //< Runlength encoded black and white image
+					if (flipHorizontally) {
+						return compressRLEBands<bytesPerPixel, false, true>(output, source, imgWidth, imgHeight, runtimeBytesPerPixel, optimal, threadCount, rowOffsets);
 					} else {
-						header.ImageType = 3; //< Uncompressed greyscale
+						return compressRLEBands<bytesPerPixel, false, false>(output, source, imgWidth, imgHeight, runtimeBytesPerPixel, optimal, threadCount, rowOffsets);
 					}
 				}
-				break;
-			default:
-				// Unknown color type provided
-				return GWTGA_INVALID_DATA;
-			}
-
-			header.colorMapSpec.colorMapEntrySize = image.colorMap.bitsPerPixel;
-			header.colorMapSpec.colorMapLength = image.colorMap.length;
-			header.colorMapSpec.firstEntryIndex = 0;
-
-			header.imageSpec.xOrigin = image.xOrigin;
-			header.imageSpec.yOrigin = image.yOrigin;
-			header.imageSpec.width = image.width;
-			header.imageSpec.height = image.height;
-			header.imageSpec.bitsPerPixel = image.bitsPerPixel;
-
-			switch (image.origin) {
-			case GWTGA_BOTTOM_LEFT:
-				header.imageSpec.imgDescriptor = 0x00;
-				break;
-			case GWTGA_BOTTOM_RIGHT:
-				header.imageSpec.imgDescriptor = 0x10;
-				break;
-			case GWTGA_TOP_LEFT:
-				header.imageSpec.imgDescriptor = 0x20;
-				break;
-			case GWTGA_TOP_RIGHT:
-				header.imageSpec.imgDescriptor = 0x30;
-				break;
-			default:
-				// Unknown origin provided
-				return GWTGA_INVALID_DATA;
 			}
 
-			// Store "attribute bites per pixel" to LSB
-			header.imageSpec.imgDescriptor |= image.attributeBitsPerPixel & 0x0F;
+			template<size_t bytesPerPixel, bool flipVertically, bool flipHorizontally>
+			bool compressRLEBands(TGAStreamOutput &output, const char* source, size_t imgWidth, size_t imgHeight, size_t runtimeBytesPerPixel, bool optimal, unsigned int threadCount, std::vector<size_t>* rowOffsets) {
 
-			// Write TGA header
-			stream.write((char*)&header.iDLength, sizeof(header.iDLength));
-			stream.write((char*)&header.colorMapType, sizeof(header.colorMapType));
-			stream.write((char*)&header.ImageType, sizeof(header.ImageType));
-			stream.write((char*)&header.colorMapSpec.firstEntryIndex, sizeof(header.colorMapSpec.firstEntryIndex));
-			stream.write((char*)&header.colorMapSpec.colorMapLength, sizeof(header.colorMapSpec.colorMapLength));
-			stream.write((char*)&header.colorMapSpec.colorMapEntrySize, sizeof(header.colorMapSpec.colorMapEntrySize));
-			stream.write((char*)&header.imageSpec.xOrigin, sizeof(header.imageSpec.xOrigin));
-			stream.write((char*)&header.imageSpec.yOrigin, sizeof(header.imageSpec.yOrigin));
-			stream.write((char*)&header.imageSpec.width, sizeof(header.imageSpec.width));
-			stream.write((char*)&header.imageSpec.height, sizeof(header.imageSpec.height));
-			stream.write((char*)&header.imageSpec.bitsPerPixel, sizeof(header.imageSpec.bitsPerPixel));
-			stream.write((char*)&header.imageSpec.imgDescriptor, sizeof(header.imageSpec.imgDescriptor));
-
-			// Write color map
-			if (image.hasColorMap()) {
-				stream.write(image.colorMap.bytes, image.colorMap.length * (image.colorMap.bitsPerPixel / 8));
-			}
+				if (rowOffsets) {
+					rowOffsets->resize(imgHeight + 1);
+				}
 
-			unsigned char bytesPerPixel = image.bitsPerPixel / 8;
+				if (threadCount > 1 && imgWidth * imgHeight >= TGA_PARALLEL_MIN_PIXELS) {
+					compressRLEFunc compressRows = optimal ? compressRLERows<TGAMemoryOutput, bytesPerPixel, flipVertically, flipHorizontally, true> : compressRLERows<TGAMemoryOutput, bytesPerPixel, flipVertically, flipHorizontally, false>;
+					return compressRLEParallel(compressRows, output, source, imgWidth, imgHeight, runtimeBytesPerPixel, threadCount, rowOffsets);
+				}
 
-			// Write pixel data
-			if (!flipVertically && !flipHorizontally) {
+				// Output already holds header and color map, row offsets are relative to pixel data
+				size_t pixelDataOffset = output.size();
 
-				if (useRLEcompression) {
-					if (!compressRLE(stream, image.bytes, image.width, image.height, bytesPerPixel)) {
-						return GWTGA_IO_ERROR;
-					}
+				if (optimal) {
+					compressRLERows<TGAStreamOutput, bytesPerPixel, flipVertically, flipHorizontally, true>(output, source, imgWidth, imgHeight, runtimeBytesPerPixel, 0, imgHeight, rowOffsets ? &(*rowOffsets)[0] : NULL);
 				} else {
-					// NO PROCESSING
-					stream.write(image.bytes, image.width * image.height * bytesPerPixel);
+					compressRLERows<TGAStreamOutput, bytesPerPixel, flipVertically, flipHorizontally, false>(output, source, imgWidth, imgHeight, runtimeBytesPerPixel, 0, imgHeight, rowOffsets ? &(*rowOffsets)[0] : NULL);
 				}
-			} else if (useRLEcompression) {
-				size_t stride;
-				flipFunc flipFuncType;
 
-				getFlipFunction(flipFuncType, stride, flipVertically, flipHorizontally, image.width, image.height);
+				if (rowOffsets) {
+					for (size_t y = 0; y < imgHeight; y++) {
+						(*rowOffsets)[y] -= pixelDataOffset;
+					}
 
-				if (!compressRLE(stream, image.bytes, image.width, image.height, bytesPerPixel, flipFuncType)) {
-					return GWTGA_IO_ERROR;
+					(*rowOffsets)[imgHeight] = output.size() - pixelDataOffset;
 				}
-			} else if (flipVertically) {
-				if (!flipHorizontally) {
-					// PROCESSING - Vertical Flip
-					int stride = image.width * bytesPerPixel;
-					processToStream<processPassThrough, fetchXPlusY>(stream, image.bytes, image.width, image.height, 0, 1, 1, (image.height - 1) * stride, -stride, -stride, stride);
 
-				} else {
-					// PROCESSING - Vertical and horizontal Flip
-					int strideX = bytesPerPixel;
-					int strideY = image.width * bytesPerPixel;
-					processToStream<processPassThrough, fetchXPlusY>(stream, image.bytes, image.width, image.height, (image.height - 1) * strideY, -strideY, -strideY, (image.width - 1) * strideX, -strideX, -strideX , strideX);
+				return !output.fail();
+			}
 
+			template<class Output, size_t bytesPerPixel, bool flipVertically, bool flipHorizontally, bool optimal>
+			void compressRLERows(Output &output, const char* source, size_t imgWidth, size_t imgHeight, size_t runtimeBytesPerPixel, size_t firstRow, size_t rowCount, size_t* rowOffsets) {
+
+				if (!rowOffsets) {
+					// Packets may continue from row to row
+					if (optimal) {
+						compressRLEOptimalKernel<Output, bytesPerPixel, flipVertically, flipHorizontally>(output, source, imgWidth, imgHeight, runtimeBytesPerPixel, firstRow * imgWidth, rowCount * imgWidth);
+					} else {
+						compressRLEKernel<Output, bytesPerPixel, flipVertically, flipHorizontally>(output, source, imgWidth, imgHeight, runtimeBytesPerPixel, firstRow * imgWidth, rowCount * imgWidth);
+					}
+					return;
 				}
-			} else if (flipHorizontally) {
-				// PROCESSING - Horizontal Flip
-				int strideX = bytesPerPixel;
-				int strideY = image.width * bytesPerPixel;
-				processToStream<processPassThrough, fetchXPlusY>(stream, image.bytes, image.width, image.height, 0, strideY, (image.height) * strideY, (image.width - 1) * strideX, -strideX, -strideX , strideX);
 
-			} else {
-				// TODO
-			}
+				// Every row starts with new packet, so it can be found through scan line table
+				for (size_t y = firstRow; y < firstRow + rowCount; y++) {
+					rowOffsets[y - firstRow] = output.size();
 
-			if (stream.fail()) {
-				return GWTGA_IO_ERROR;
+					if (optimal) {
+						compressRLEOptimalKernel<Output, bytesPerPixel, flipVertically, flipHorizontally>(output, source, imgWidth, imgHeight, runtimeBytesPerPixel, y * imgWidth, imgWidth);
+					} else {
+						compressRLEKernel<Output, bytesPerPixel, flipVertically, flipHorizontally>(output, source, imgWidth, imgHeight, runtimeBytesPerPixel, y * imgWidth, imgWidth);
+					}
+				}
 			}
 
-			return GWTGA_NONE;
-		}
+			bool compressRLEParallel(compressRLEFunc compressRows, TGAStreamOutput &output, const char* source, size_t imgWidth, size_t imgHeight, size_t bytesPerPixel, unsigned int threadCount, std::vector<size_t>* rowOffsets) {
 
-		namespace details {
+				// Few bands per thread balance the load when some parts of image compress better than others
+				size_t bandRows = (imgHeight + threadCount * 4 - 1) / (threadCount * 4);
+				size_t bandCount = (imgHeight + bandRows - 1) / bandRows;
 
-			template<size_t tempMemorySize>
-			char* TGALoaderListener<tempMemorySize>::operator()(const unsigned int &bitsPerPixel, const unsigned int &width, const unsigned int &height, TGAMemoryType mType) {						
+				// Packets never cross bands, each band is compressed to its own buffer
+				std::vector<TGAMemoryOutput> bands(bandCount);
 
-				if (mType == GWTGA_COLOR_PALETTE_TEMPORARY && width * height * (bitsPerPixel / 8) <= tempMemorySize) {
-					return tempMemory;
-				} else if (mType == GWTGA_IMAGE_DATA) {
-					return new char[(bitsPerPixel / 8) * (height * width)];
-				} else {
-					colorMapMemory = new char[(bitsPerPixel / 8) * (height * width)];
-					return colorMapMemory;
-				}
-			}
+				struct Batch {
+					compressRLEFunc compressRows;
+					const char* source;
+					size_t imgWidth;
+					size_t imgHeight;
+					size_t bytesPerPixel;
+					size_t bandRows;
+					std::vector<TGAMemoryOutput>* bands;
+					std::vector<size_t>* rowOffsets;
+					TGAStatsContext stats;
 
-			template<size_t tempMemorySize>
-			TGALoaderListener<tempMemorySize>::TGALoaderListener(bool persistentColorMapMemory) {
-				this->persistentColorMapMemory = persistentColorMapMemory;
-				this->colorMapMemory = NULL;
-			}
+					static void run(void* context, size_t index) {
+						Batch* batch = (Batch*) context;
+						TGAStatsScope statsScope(batch->stats);
 
-			template<size_t tempMemorySize>
-			TGALoaderListener<tempMemorySize>::~TGALoaderListener() {
-				if (!persistentColorMapMemory && colorMapMemory != NULL) {
-					delete[] colorMapMemory;
-					colorMapMemory = NULL;
-				}
-			}
+						size_t firstRow = index * batch->bandRows;
+						size_t rows = batch->imgHeight - firstRow < batch->bandRows ? batch->imgHeight - firstRow : batch->bandRows;
+
+						batch->compressRows((*batch->bands)[index], batch->source, batch->imgWidth, batch->imgHeight, batch->bytesPerPixel, firstRow, rows, 
+							batch->rowOffsets ? &(*batch->rowOffsets)[firstRow] : NULL);
+					}
+				};
 
-			void getFlipFunction(flipFunc &flipFuncType, size_t &stride, bool flipVertically, bool flipHorizontally, size_t width, size_t height) {
+				// Threads of pool and calling thread compress bands
+				Batch batch = { compressRows, source, imgWidth, imgHeight, bytesPerPixel, bandRows, &bands, rowOffsets, getStatsContext() };
+				runTasks(Batch::run, &batch, bandCount, threadCount);
 
-				if (!flipVertically && !flipHorizontally) {
-					// NO PROCESSING
-					flipFuncType = flipFuncPass;
-					stride = width * height;
+				// Concatenate bands in order, row offsets are relative to their band until now
+				size_t bandOffset = 0;
 
-				} else if (flipVertically) {
-					if (!flipHorizontally) {
-						// PROCESSING - Vertical Flip
-						flipFuncType = flipFuncVertical;
-						stride = width;
+				for (size_t i = 0; i < bandCount; i++) {
 
-					} else {
-						// PROCESSING - Vertical and horizontal Flip
-						flipFuncType = flipFuncHorizontalAndVertical;
-						stride = 1;
+					if (rowOffsets) {
+						for (size_t y = i * bandRows; y < imgHeight && y < (i + 1) * bandRows; y++) {
+							(*rowOffsets)[y] += bandOffset;
+						}
 					}
-				} else if (flipHorizontally) {
-					// PROCESSING - Horizontal Flip
-					flipFuncType = flipFuncHorizontal;
-					stride = 1;
-				} 
-			}
 
-			void fetchPixelUncompressed(char* target, char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel) { 
-				memcpy(target, input, bytesPerInputPixel);
-			}
+					const std::vector<char> &bytes = bands[i].data();
 
-			void fetchPixelColorMap(char* target, char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel) { 
-				size_t colorIdx = 0;
-				// Read color index (TODO: make sure this works on little/big endian machines)
-				switch (bytesPerInputPixel) {
-				case 1:
-					colorIdx = *((uint8_t*) input);
-					break;
-				case 2:
-					colorIdx = *((uint16_t*) input);
-					break;
-				case 3:
-					colorIdx = *((uint32_t*) input) & 0x00FFFFFF;
-					break;
+					if (!bytes.empty()) {
+						output.write(&bytes[0], bytes.size());
+					}
+
+					bandOffset += bytes.size();
+				}
+
+				if (rowOffsets) {
+					(*rowOffsets)[imgHeight] = bandOffset;
 				}
-				memcpy(target, (void*) &colorMap[colorIdx * bytesPerOutputPixel], bytesPerOutputPixel);
+
+				return !output.fail();
 			}
 
-			bool fetchPixelsUncompressed(char* target, std::istream &stream, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel, size_t count) { 
-				stream.read(target, bytesPerInputPixel * count);
+			template<size_t bytesPerPixel, bool flipVertically, bool flipHorizontally>
+			TGAPixelCursor<bytesPerPixel, flipVertically, flipHorizontally>::TGAPixelCursor(const char* image, size_t width, size_t height, size_t runtimeBytesPerPixel, size_t firstPixel) {
 
-				if (stream.fail()) {
-					return false;
+				this->image = image;
+				this->pixelSize = bytesPerPixel ? bytesPerPixel : runtimeBytesPerPixel;
+
+				// Flipping both ways reverses the whole image, so it is walked as one long row, same as the unflipped image
+				if (flipVertically == flipHorizontally) {
+					width *= height;
+					height = 1;
 				}
 
-				return true;
-			}
+				size_t y = firstPixel / width;
 
-			bool fetchPixelsColorMap(char* target, std::istream &stream, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel, size_t count) { 
+				this->width = width;
+				this->rowSize = width * pixelSize;
+				this->x = firstPixel % width;
 
-				size_t colorIdx = 0;
+				// Offsets are unsigned, stepping before the first row wraps around but such offset is never dereferenced
+				this->rowOffset = (flipVertically && !flipHorizontally ? height - 1 - y : y) * rowSize;
+				this->offset = rowOffset + (flipHorizontally ? rowSize - (x + 1) * pixelSize : x * pixelSize);
+			}
 
-				for (size_t i = 0; i < count * bytesPerOutputPixel; i += bytesPerOutputPixel) {
+			template<size_t bytesPerPixel, bool flipVertically, bool flipHorizontally>
+			void TGAPixelCursor<bytesPerPixel, flipVertically, flipHorizontally>::advance(size_t count) {
 
-					// Read color index (TODO: make sure this works on little/big endian machines)
-					stream.read((char*) &colorIdx, bytesPerInputPixel);
+				x += count;
 
-					if (stream.fail()) {
-						return false;
+				if (x < width) {
+					if (flipHorizontally) {
+						offset -= count * size();
+					} else {
+						offset += count * size();
 					}
+					return;
+				}
 
-					memcpy((void*) &target[i], (void*) &colorMap[colorIdx * bytesPerOutputPixel], bytesPerOutputPixel);
+				// Move to following rows
+				size_t rows = x / width;
+				x %= width;
+
+				if (flipVertically && !flipHorizontally) {
+					rowOffset -= rows * rowSize;
+				} else {
+					rowOffset += rows * rowSize;
 				}
 
-				return true;
+				offset = rowOffset + (flipHorizontally ? rowSize - (x + 1) * size() : x * size());
 			}
 
-			size_t flipFuncPass(size_t i, size_t width, size_t height, size_t bpp) {
-				return i * bpp;
-			}
+			template<size_t bytesPerPixel, bool flipVertically, bool flipHorizontally>
+			void TGAPixelCursor<bytesPerPixel, flipVertically, flipHorizontally>::read(char* target, size_t count) {
 
-			size_t flipFuncHorizontal(size_t i, size_t width, size_t height, size_t bpp) {
+				while (count > 0) {
+					size_t spanCount = span() < count ? span() : count;
 
-				size_t rowNum = i / width;
-				size_t colNum = i % width;
+					if (flipHorizontally) {
+						const char* source = pixel();
+						for (size_t i = 0; i < spanCount; i++) {
+							memcpy(target, source, size());
+							target += size();
+							source -= size();
+						}
+					} else {
+						memcpy(target, pixel(), spanCount * size());
+						target += spanCount * size();
+					}
 
-				return ((rowNum) * width  +(width - 1 - colNum)) * bpp;
+					advance(spanCount);
+					count -= spanCount;
+				}
 			}
 
-			size_t flipFuncVertical(size_t i, size_t width, size_t height, size_t bpp) {
+			template<size_t bytesPerPixel, bool flipVertically, bool flipHorizontally>
+			size_t TGAPixelCursor<bytesPerPixel, flipVertically, flipHorizontally>::countRepeated(size_t maxCount) const {
 
-				size_t rowNum = i / width;
-				size_t colNum = i % width;
+				// Packets usually end within current row
+				if (maxCount <= span()) return countRepeatedPixels<bytesPerPixel, flipHorizontally>(pixel(), size(), maxCount);
 
-				return ((height - 1 - rowNum) * width  +colNum) * bpp;
-			}
+				TGAPixelCursor cursor = *this;
+				size_t count = 0;
 
-			size_t flipFuncHorizontalAndVertical(size_t i, size_t width, size_t height, size_t bpp) {
-				return (( width * height - 1) - i) * bpp;
-			}
+				while (true) {
+					size_t spanCount = cursor.span() < maxCount - count ? cursor.span() : maxCount - count;
 
-			template<fetchPixelFunc fetchPixel, fetchPixelsFunc fetchPixels>
-			bool decompressRLE(char* target, size_t pixelsNumber, size_t bytesPerInputPixel, std::istream &stream, char* colorMap, size_t bytesPerOutputPixel, size_t imgWidth, size_t imgHeight, flipFunc flip, bool perPixelProcessing) {
+					// Run continues in the next row only if its first pixel is still the same
+					if (count > 0 && memcmp(cursor.pixel(), pixel(), size()) != 0) return count;
 
-				// number of pixels read so far
-				size_t readPixels = 0;
+					size_t repeated = countRepeatedPixels<bytesPerPixel, flipHorizontally>(cursor.pixel(), size(), spanCount);
+					count += repeated;
 
-				// buffer for pixel (on stack)
-				char colorValues[16]; // max 16 bytes per pixel are supported (4 floats)
-				uint8_t packetHeader;
-				uint8_t repetitionCount;
+					if (repeated < spanCount || count == maxCount) return count;
 
-				// Read packets until all pixels have been read
-				while (readPixels < pixelsNumber) {
+					cursor.advance(spanCount);
+				}
+			}
 
-					// Read packet type (RLE compressed or RAW data)
-					stream.read((char*)&packetHeader, sizeof(packetHeader));
+			template<size_t bytesPerPixel, bool flipVertically, bool flipHorizontally>
+			size_t TGAPixelCursor<bytesPerPixel, flipVertically, flipHorizontally>::countDifferent(size_t maxCount) const {
 
-					if (stream.fail()) {
-						return false;
-					}
+				// Packets usually end within current row
+				if (maxCount <= span()) return countDifferentPixels<bytesPerPixel, flipHorizontally>(pixel(), size(), maxCount);
 
-					repetitionCount = (packetHeader & 0x7F) + 1;
+				TGAPixelCursor cursor = *this;
+				size_t count = 0;
 
-					if ((packetHeader & 0x80) == 0x80) {
-						// RLE packet
+				while (true) {
+					size_t spanCount = cursor.span() < maxCount - count ? cursor.span() : maxCount - count;
 
-						// Read repeated color value
-						stream.read(colorValues, bytesPerInputPixel);
+					size_t different = countDifferentPixels<bytesPerPixel, flipHorizontally>(cursor.pixel(), size(), spanCount);
+					count += different;
 
-						if (stream.fail()) {
-							return false;
-						}
+					if (different < spanCount || count == maxCount) return count;
 
-						// Emit repetitionCount times given color value
-						for (int i = 0; i < repetitionCount; i++) {
-							// TODO: Check if this is inlined
-							fetchPixel(&target[flip(readPixels, imgWidth, imgHeight, bytesPerOutputPixel)], colorValues, bytesPerInputPixel, colorMap, bytesPerOutputPixel);
-							readPixels++;
-						}
+					// Last pixel of row still has to be compared with first pixel of the next row
+					const char* last = flipHorizontally ? cursor.pixel() - (spanCount - 1) * size() : cursor.pixel() + (spanCount - 1) * size();
+					cursor.advance(spanCount);
 
-					} else {
-						// RAW packet
-
-						if (perPixelProcessing) {
-							// Emit repetitionCount times upcoming color value
-							for (int i = 0; i < repetitionCount; i++) {
-								stream.read(colorValues, bytesPerInputPixel);
-								fetchPixel(&target[flip(readPixels, imgWidth, imgHeight, bytesPerOutputPixel)], colorValues, bytesPerInputPixel, colorMap, bytesPerOutputPixel);
-								readPixels++;
-							}
-						} else {
-							// Emit repetitionCount times upcoming color values
-							// TODO: Check if this is inlined
-							if (!fetchPixels(&target[flip(readPixels, imgWidth, imgHeight, bytesPerOutputPixel)], stream, bytesPerInputPixel, colorMap, bytesPerOutputPixel, repetitionCount)) {
-								return false;
-							}
-							readPixels += repetitionCount;
-						}
-					}
+					if (memcmp(last, cursor.pixel(), size()) == 0) return count - 1;
 				}
+			}
 
-				return true;
+#if defined(GWTGA_AVX2)
+			const size_t compareVectorSize = 32;
+
+			// Bit per byte of vector, set where bytes of a and b are equal
+			inline uint32_t compareVectors(const char* a, const char* b) {
+				return (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) a), _mm256_loadu_si256((const __m256i*) b)));
 			}
+#elif defined(GWTGA_SSE2)
+			const size_t compareVectorSize = 16;
 
-			char* fetchXPlusY(char* source, unsigned int x, unsigned int y, unsigned int imgWidth, unsigned int imgHeight) {
-				return source + x + y; 
+			// Bit per byte of vector, set where bytes of a and b are equal
+			inline uint32_t compareVectors(const char* a, const char* b) {
+				return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) a), _mm_loadu_si128((const __m128i*) b)));
+			}
+#endif
+
+#if defined(GWTGA_SSE2)
+			const uint32_t compareVectorMask = compareVectorSize == 32 ? 0xFFFFFFFF : 0xFFFF;
+
+			inline unsigned int lowestSetBit(uint32_t mask) {
+#if defined(_MSC_VER)
+				unsigned long index;
+				_BitScanForward(&index, mask);
+				return index;
+#else
+				return __builtin_ctz(mask);
+#endif
 			}
 
-			char* processPassThrough(char* target, char* source) {
-				return source;
+			inline unsigned int highestSetBit(uint32_t mask) {
+#if defined(_MSC_VER)
+				unsigned long index;
+				_BitScanReverse(&index, mask);
+				return index;
+#else
+				return 31 - __builtin_clz(mask);
+#endif
 			}
+#endif
 
-			template<processFunc process, fetchFunc fetch>
-			void processToStream(std::ostream &stream, char* source, unsigned int imgWidth, unsigned int imgHeight, int beginX, int strideX, int endX, int beginY, int strideY, int endY, size_t resultSize) {
+			template<size_t bytesPerPixel, bool reverse>
+			size_t countRepeatedPixels(const char* pixels, size_t runtimeBytesPerPixel, size_t count) {
 
-				if (beginX == endX || beginY == endY) return;
+				const size_t pixelSize = bytesPerPixel ? bytesPerPixel : runtimeBytesPerPixel;
 
-				char buffer[4]; //< TODO assert it is more than max result size;
+				// Pixels of run are all equal exactly when every byte equals the byte one pixel further, so bytes are compared
+				// with copy of span shifted by one pixel regardless of pixel size
+				const char* span = reverse ? pixels - (count - 1) * pixelSize : pixels;
+				size_t compared = (count - 1) * pixelSize;
 
-				int x = beginX;
-				do {
-					// outer loop
-					int y = beginY;
-					do {
-						// inner loop
-						stream.write(process(buffer, fetch(source, x, y, imgWidth, imgHeight)), resultSize);
+				// Most of RAW packets start here, so the second pixel is checked before setting up vectors
+				if (count < 2 || memcmp(pixels, reverse ? pixels - pixelSize : pixels + pixelSize, pixelSize) != 0) return 1;
 
-						y+= strideY;
-					} while (y != endY);
+				if (!reverse) {
+					size_t i = 0;
+#if defined(GWTGA_SSE2)
+					for (; i + compareVectorSize <= compared; i += compareVectorSize) {
+						uint32_t different = ~compareVectors(&span[i], &span[i + pixelSize]) & compareVectorMask;
+						if (different) return (i + lowestSetBit(different)) / pixelSize + 1;
+					}
+#endif
+					for (; i < compared; i++) {
+						if (span[i] != span[i + pixelSize]) return i / pixelSize + 1;
+					}
+				} else {
+					size_t end = compared;
+#if defined(GWTGA_SSE2)
+					for (; end >= compareVectorSize; end -= compareVectorSize) {
+						size_t i = end - compareVectorSize;
+						uint32_t different = ~compareVectors(&span[i], &span[i + pixelSize]) & compareVectorMask;
+						if (different) return count - 1 - (i + highestSetBit(different)) / pixelSize;
+					}
+#endif
+					while (end > 0) {
+						end--;
+						if (span[end] != span[end + pixelSize]) return count - 1 - end / pixelSize;
+					}
+				}
 
-					x += strideX;
-				} while (x != endX);
+				return count;
 			}
 
-			template<processFunc process, fetchFunc fetch>
-			void processToArray(std::istream &stream, char* target, unsigned int imgWidth, unsigned int imgHeight, int beginX, int strideX, int endX, int beginY, int strideY, int endY, size_t resultSize) {
+			template<size_t bytesPerPixel, bool reverse>
+			size_t countDifferentPixels(const char* pixels, size_t runtimeBytesPerPixel, size_t count) {
 
-				if (beginX == endX || beginY == endY) return;
+				const size_t pixelSize = bytesPerPixel ? bytesPerPixel : runtimeBytesPerPixel;
 
-				char buffer[4]; //< TODO assert it is more than max result size;
+				if (count < 2) return count;
 
-				int x = beginX;
-				do {
-					// outer loop
-					int y = beginY;
-					do {
+				// Pairs of subsequent pixels are indexed by the lower one in memory, pair is equal when all its bytes are
+				const char* span = reverse ? pixels - (count - 1) * pixelSize : pixels;
+				size_t pairs = count - 1;
+				size_t pair = reverse ? pairs : 0;
 
-						// inner loop
-						stream.read(process(buffer, fetch(target, x, y, imgWidth, imgHeight)), resultSize);
-						y+= strideY;
-					} while (y != endY);
+#if defined(GWTGA_SSE2)
+				if (bytesPerPixel >= 1 && bytesPerPixel <= 4) {
 
-					x += strideX;
-				} while (x != endX);
-			}
+					// Vector step covers whole pixels (15 or 30 bytes for 3 byte pixels), lowest byte of every pixel in the step 
+					// is marked and keeps its mark only if all bytes of the pixel compare equal
+					const size_t stepPixels = compareVectorSize / pixelSize;
+					uint32_t pixelMask = 0;
+					for (size_t i = 0; i < stepPixels; i++) {
+						pixelMask |= 1u << (i * pixelSize);
+					}
 
+					// Vectors must not read behind the last pixel of span
+					const size_t vectorPixels = (compareVectorSize + pixelSize - 1) / pixelSize;
 
-			bool cmpPixels(char* pa, char* pb, char bytesPerPixel) {
+					if (!reverse) {
+						for (; pair + vectorPixels <= pairs; pair += stepPixels) {
+							uint32_t equal = compareVectors(&span[pair * pixelSize], &span[(pair + 1) * pixelSize]);
+							for (size_t i = 1; i < pixelSize; i++) {
+								equal &= equal >> 1;
+							}
+							equal &= pixelMask;
+							if (equal) return pair + lowestSetBit(equal) / pixelSize;
+						}
+					} else {
+						// Pairs behind the last vector are checked one by one first
+						size_t vectorEnd = pairs >= vectorPixels ? pairs - vectorPixels + stepPixels : 0;
+						while (pair > vectorEnd) {
+							pair--;
+							if (memcmp(&span[pair * pixelSize], &span[(pair + 1) * pixelSize], pixelSize) == 0) return pairs - 1 - pair;
+						}
 
-				uint32_t colorA;
-				uint32_t colorB;
+						for (; pair >= stepPixels; pair -= stepPixels) {
+							size_t first = pair - stepPixels;
+							uint32_t equal = compareVectors(&span[first * pixelSize], &span[(first + 1) * pixelSize]);
+							for (size_t i = 1; i < pixelSize; i++) {
+								equal &= equal >> 1;
+							}
+							equal &= pixelMask;
+							if (equal) return pairs - 1 - (first + highestSetBit(equal) / pixelSize);
+						}
+					}
+				}
+#endif
 
-				// Read color index (TODO: make sure this works on little/big endian machines)
-				switch (bytesPerPixel) {
-				case 1:
-					colorA = *((uint8_t*) pa);
-					colorB = *((uint8_t*) pb);
-					break;
-				case 2:
-					colorA = *((uint16_t*) pa);
-					colorB = *((uint16_t*) pb);
-					break;
-				case 3:
-					// TODO: Segfault - accesses behind array boundary
-					colorA = *pa + (*(pa+1) << 8) + (*(pa+2) << 16);
-					colorB = *pb + (*(pb+1) << 8) + (*(pb+2) << 16);
-					break;
-				default:
-					// TODO: Error
-					break;
+				if (!reverse) {
+					for (; pair < pairs; pair++) {
+						if (memcmp(&span[pair * pixelSize], &span[(pair + 1) * pixelSize], pixelSize) == 0) return pair;
+					}
+				} else {
+					while (pair > 0) {
+						pair--;
+						if (memcmp(&span[pair * pixelSize], &span[(pair + 1) * pixelSize], pixelSize) == 0) return pairs - 1 - pair;
+					}
 				}
 
-				return colorA == colorB;
+				return count;
 			}
 
-			bool compressRLE(std::ostream &stream, char* source, size_t imgWidth, size_t imgHeight, size_t bytesPerInputPixel, flipFunc flipFuncType) {
+			template<class Output, size_t bytesPerPixel, bool flipVertically, bool flipHorizontally>
+			void compressRLEKernel(Output &output, const char* source, size_t imgWidth, size_t imgHeight, size_t runtimeBytesPerPixel, size_t firstPixel, size_t pixelCount) {
 
-				size_t current = 0;
-				size_t nextDifferent = 0;
-				size_t pixelCount = imgWidth * imgHeight;
-				char packetHeader = 0;
+				typedef TGAPixelCursor<bytesPerPixel, flipVertically, flipHorizontally> Cursor;
 
-				// find longest sequence of same values
-				while (nextDifferent < pixelCount) {
+				// Compile time pixel size turns the memcmps below into plain compares
+				const size_t pixelSize = bytesPerPixel ? bytesPerPixel : runtimeBytesPerPixel;
 
-					size_t repetitionCount = 0;
+				Cursor current(source, imgWidth, imgHeight, pixelSize, firstPixel);
 
-					while (cmpPixels(&source[flipFuncType(current, imgWidth, imgHeight, bytesPerInputPixel)], 
-						&source[flipFuncType(nextDifferent, imgWidth, imgHeight, bytesPerInputPixel)], bytesPerInputPixel)) { 
+				size_t index = 0;
+				char packetHeader = 0;
+				TGAPacketCounter packets;
 
-							nextDifferent++;
-							repetitionCount++;
+				while (index < pixelCount) {
 
-							if (repetitionCount == 128 || nextDifferent == pixelCount) break; // TODO: Do we need to split packets on row end?
-					}
+					size_t maxCount = pixelCount - index < 128 ? pixelCount - index : 128;
 
 					// if at least 2 subsequent values are equal, emit RLE packet
-					if (repetitionCount > 1) {
+					size_t repetitionCount = current.countRepeated(maxCount);
+					bool rlePacket = repetitionCount > 1;
+
+					if (rlePacket) {
 
 						packetHeader = 0x80 + (repetitionCount - 1); // & 0x7F - cannot be more than 127
 
-						stream.write(&packetHeader, sizeof(packetHeader));
+						output.write(&packetHeader, sizeof(packetHeader));
 
 						// emit repeated value
-						stream.write(&source[flipFuncType(current, imgWidth, imgHeight, bytesPerInputPixel)], sizeof(char) * bytesPerInputPixel);
-
-					} else {
-						// otherwise emit RAW packet
+						output.write(current.pixel(), sizeof(char) * pixelSize);
 
-						// find longest sequence of non-repeating values
-						while (true) {
-							if (repetitionCount == 128 || nextDifferent + 1 >= pixelCount) break; // TODO: Do we need to split packets on row end?
-							if (cmpPixels(&source[flipFuncType(nextDifferent, imgWidth, imgHeight, bytesPerInputPixel)], 
-								&source[flipFuncType(nextDifferent + 1, imgWidth, imgHeight, bytesPerInputPixel)], bytesPerInputPixel)) break; 
+						current.advance(repetitionCount);
 
-							nextDifferent++;
-							repetitionCount++;
-						}
+					} else {
+						// otherwise emit RAW packet of values up to the next run
+						repetitionCount = current.countDifferent(maxCount);
 
 						packetHeader = (repetitionCount - 1); // & 0x7F - cannot be more than 127
 
-						stream.write(&packetHeader, sizeof(packetHeader));
+						output.write(&packetHeader, sizeof(packetHeader));
 
 						// emit RAW values
-						for (size_t i = 0; i < repetitionCount; i++) {
-							stream.write(&source[flipFuncType(current + i, imgWidth, imgHeight, bytesPerInputPixel)], sizeof(char) * bytesPerInputPixel);
+						if (!flipVertically && !flipHorizontally) {
+							output.write(current.pixel(), sizeof(char) * repetitionCount * pixelSize);
+							current.advance(repetitionCount);
+						} else if (pixelSize <= 16) {
+							// Gather flipped pixels of packet and write them at once
+							char packet[128 * 16];
+
+							current.read(packet, repetitionCount);
+							output.write(packet, repetitionCount * pixelSize);
+						} else {
+							for (size_t i = 0; i < repetitionCount; i++) {
+								output.write(current.pixel(), sizeof(char) * pixelSize);
+								current.advance();
+							}
 						}
-
 					}
 
-					current = nextDifferent;
+					packets.add(rlePacket, repetitionCount, false);
+					index += repetitionCount;
 				}
-				// TODO: If image is 1 pixel long, encode this one pixel somehow
 
-				if (stream.fail()) {
-					return false;
-				}
-				return true;
+				// Written bytes are counted by SaveTga
+				recordPackets(packets, 0);
 			}
 
-			// Faster version without flipping
-			bool compressRLE(std::ostream &stream, char* source, size_t imgWidth, size_t imgHeight, size_t bytesPerInputPixel) {
+			template<class Output, size_t bytesPerPixel, bool flipVertically, bool flipHorizontally>
+			void compressRLEOptimalKernel(Output &output, const char* source, size_t imgWidth, size_t imgHeight, size_t runtimeBytesPerPixel, size_t firstPixel, size_t pixelCount) {
 
-				size_t current = 0;
-				size_t nextDifferent = 0;
-				size_t pixelCount = imgWidth * imgHeight * bytesPerInputPixel;
-				char packetHeader = 0;
+				typedef TGAPixelCursor<bytesPerPixel, flipVertically, flipHorizontally> Cursor;
 
-				// find longest sequence of same values
-				while (nextDifferent < pixelCount) {
+				const size_t pixelSize = bytesPerPixel ? bytesPerPixel : runtimeBytesPerPixel;
 
-					size_t repetitionCount = 0;
+				Cursor current(source, imgWidth, imgHeight, pixelSize, firstPixel);
+				TGARLEPlan plan;
+				std::vector<char> segment;
+				TGAPacketCounter packets;
 
-					while (cmpPixels(&source[current], &source[nextDifferent], bytesPerInputPixel)) { 
+				for (size_t index = 0; index < pixelCount; ) {
 
-						nextDifferent+=bytesPerInputPixel;
-						repetitionCount++;
+					size_t count = pixelCount - index < TGA_OPTIMAL_RLE_SEGMENT ? pixelCount - index : TGA_OPTIMAL_RLE_SEGMENT;
+					const char* pixels;
 
-						if (repetitionCount == 128 || nextDifferent == pixelCount) break; // TODO: Do we need to split packets on row end?
+					// Pixels of image which is not flipped are in file order already, flipped ones are gathered first
+					if (!flipVertically && !flipHorizontally) {
+						pixels = current.pixel();
+						current.advance(count);
+					} else {
+						segment.resize(count * pixelSize);
+						current.read(&segment[0], count);
+						pixels = &segment[0];
 					}
 
-					// if at least 2 subsequent values are equal, emit RLE packet
-					if (repetitionCount > 1) {
+					planOptimalRLEPackets<bytesPerPixel>(pixels, pixelSize, count, plan);
 
-						packetHeader = 0x80 + (repetitionCount - 1); // & 0x7F - cannot be more than 127
+					for (size_t i = 0; i < plan.packetHeaders.size(); i++) {
+						char packetHeader = plan.packetHeaders[i];
+						size_t repetitionCount = (packetHeader & 0x7F) + 1;
+						bool rlePacket = (packetHeader & 0x80) == 0x80;
 
-						stream.write(&packetHeader, sizeof(packetHeader));
+						// RLE packet repeats its first pixel, RAW packet holds all of them
+						output.write(&packetHeader, sizeof(packetHeader));
+						output.write(pixels, pixelSize * (rlePacket ? 1 : repetitionCount));
 
-						// emit repeated value
-						stream.write(&source[current], sizeof(char) * bytesPerInputPixel);
+						pixels += repetitionCount * pixelSize;
+						packets.add(rlePacket, repetitionCount, false);
+					}
 
-					} else {
-						// otherwise emit RAW packet
+					index += count;
+				}
 
-						// find longest sequence of non-repeating values
-						while (true) {
-							if (repetitionCount == 128 || nextDifferent+bytesPerInputPixel >= pixelCount) break; // TODO: Do we need to split packets on row end?
-							if (cmpPixels(&source[nextDifferent], &source[nextDifferent + bytesPerInputPixel], bytesPerInputPixel)) break; 
+				recordPackets(packets, 0);
+			}
 
-							nextDifferent+=bytesPerInputPixel;
-							repetitionCount++;
-						}
+			template<size_t bytesPerPixel>
+			void planOptimalRLEPackets(const char* pixels, size_t runtimeBytesPerPixel, size_t count, TGARLEPlan &plan) {
 
-						packetHeader = (repetitionCount - 1); // & 0x7F - cannot be more than 127
+				const size_t pixelSize = bytesPerPixel ? bytesPerPixel : runtimeBytesPerPixel;
 
-						stream.write(&packetHeader, sizeof(packetHeader));
+				plan.cost.resize(count + 1);
+				plan.lastPacket.resize(count + 1);
+				plan.window.resize(count + 1);
 
-						// emit RAW values
-						stream.write(&source[current], sizeof(char) * repetitionCount * bytesPerInputPixel);
+				uint32_t* cost = &plan.cost[0];
+				char* lastPacket = &plan.lastPacket[0];
+				uint32_t* window = &plan.window[0];
+
+				// Least size of first j pixels ends with the packet which is the cheapest to append:
+				// - RLE packet starting where run of pixel j - 1 starts (size only grows with pixel count, so the longest packet wins)
+				// - RAW packet from i costs 1 + (j - i) * pixelSize, i with the least cost[i] - i * pixelSize among the last 128
+				//   starts is kept at head of window, whose values grow from head to tail
+				size_t head = 0;
+				size_t tail = 0;
+				size_t runStart = 0;
+
+				cost[0] = 0;
+
+				for (size_t j = 1; j <= count; j++) {
+					size_t i = j - 1;
+
+					// Values are offset by count * pixelSize to stay unsigned
+					uint32_t value = cost[i] + (uint32_t) ((count - i) * pixelSize);
+
+					while (tail > head && cost[window[tail - 1]] + (count - window[tail - 1]) * pixelSize >= value) {
+						tail--;
+					}
+
+					window[tail++] = (uint32_t) i;
+
+					if (window[head] + 128 < j) {
+						head++;
+					}
+
+					if (i > 0 && memcmp(&pixels[i * pixelSize], &pixels[(i - 1) * pixelSize], pixelSize) != 0) {
+						runStart = i;
 					}
 
-					current = nextDifferent;
+					size_t rawStart = window[head];
+					uint32_t rawCost = cost[rawStart] + 1 + (uint32_t) ((j - rawStart) * pixelSize);
+
+					size_t rleStart = runStart + 128 < j ? j - 128 : runStart;
+					uint32_t rleCost = cost[rleStart] + 1 + (uint32_t) pixelSize;
+
+					if (j - rleStart > 1 && rleCost <= rawCost) {
+						cost[j] = rleCost;
+						lastPacket[j] = (char) (0x80 | (j - rleStart - 1));
+					} else {
+						cost[j] = rawCost;
+						lastPacket[j] = (char) (j - rawStart - 1);
+					}
 				}
-				// TODO: If image is 1 pixel long, encode this one pixel somehow
 
-				if (stream.fail()) {
-					return false;
+				// Walk back from the last pixel
+				plan.packetHeaders.clear();
+
+				for (size_t j = count; j > 0; j -= (lastPacket[j] & 0x7F) + 1) {
+					plan.packetHeaders.push_back(lastPacket[j]);
 				}
-				return true;
+
+				std::reverse(plan.packetHeaders.begin(), plan.packetHeaders.end());
 			}
 		}
 	} 
@@ -12,6 +12,7 @@
 #pragma once
 
 #include <iostream>
+#include <vector>
 #include <stdint.h>
 
 namespace gw {          
@@ -39,7 +40,26 @@ namespace gw {
 			GWTGA_RETURN_COLOR_MAP = 1,
 			GWTGA_FLIP_VERTICALLY = 2,
 			GWTGA_FLIP_HORIZONTALLY = 4,
-			GWTGA_COMPRESS_RLE = 8
+			GWTGA_COMPRESS_RLE = 8,
+			GWTGA_PARALLEL_DECODE = 16, //< Decode large RLE images on multiple threads (only images loaded from file, mapping or memory)
+			GWTGA_PARALLEL_ENCODE = 32, //< Compress large RLE images on multiple threads, packets do not cross bands of rows
+			GWTGA_SCAN_LINE_TABLE = 64, //< Save RLE image with TGA 2.0 scan line table (packets do not cross rows), so it can be decoded in parallel
+
+			// Output formats of LoadTga, pixels are converted while decoding. Greyscale, 16, 24 and 32-bit images and color mapped
+			// images with such palettes can be converted. Color indices returned with GWTGA_RETURN_COLOR_MAP are not converted.
+			GWTGA_OUTPUT_RGBA8 = 128, //< 1 byte per channel, RGBA order
+			GWTGA_OUTPUT_RGB8 = 256, //< 1 byte per channel, RGB order, alpha is dropped
+			GWTGA_OUTPUT_BGRA8 = 512, //< 1 byte per channel, BGRA order (layout of 32-bit TGA)
+
+			// Mip chain down to 1x1 is box filtered while rows are decoded and returned behind the image in the same allocation, 
+			// see TGAImage::mipOffset. Every byte of pixel is filtered as one channel, so packed 16-bit pixels have to be converted
+			// with GWTGA_OUTPUT_* option.
+			GWTGA_GENERATE_MIPMAPS = 1024,
+			GWTGA_MIPMAPS_SRGB = 2048, //< Generate mip chain filtered in linear space, color channels are sRGB encoded (alpha is linear)
+
+			// Save RLE image (implies GWTGA_COMPRESS_RLE) with packets chosen for the smallest output instead of greedily, a few 
+			// times slower to encode. Short runs are kept in RAW packets when that is smaller, mostly with 8 and 16-bit pixels.
+			GWTGA_COMPRESS_RLE_OPTIMAL = 4096
 		};
 
 		enum TGAColorType {
@@ -58,6 +78,10 @@ namespace gw {
 		public: 
 			virtual ~ITGALoaderListener() {}
 			virtual char* operator()(const unsigned int &bitsPerPixel, const unsigned int &width, const unsigned int &height, TGAMemoryType mType) = 0; 
+
+			// Called when memory returned by listener is not needed anymore: temporary color map after loading, memory of 
+			// image owned by TGAImagePtr when it is released
+			virtual void release(char*, TGAMemoryType) {}
 		}; 
 
 		struct TGAColorMap {
@@ -69,9 +93,85 @@ namespace gw {
 			unsigned char bitsPerPixel;
 		};
 
+		// Read-only memory mapping of a TGA file. Images loaded from a mapping may reference 
+		// mapped memory directly, such images are valid only as long as the mapping is open.
+		class TGAFileMapping {
+		public:
+			TGAFileMapping();
+			~TGAFileMapping();
+
+			TGAError open(char* fileName);
+			void close();
+
+			bool isOpen() const { return address != NULL; }
+			const char* data() const { return address; }
+			size_t size() const { return length; }
+
+			// Returns true when pointer references mapped memory (e.g. pixels of image loaded without copying)
+			bool contains(const char* pointer) const { return address != NULL && pointer >= address && pointer < address + length; }
+
+		private:
+			TGAFileMapping(const TGAFileMapping&);
+			TGAFileMapping& operator=(const TGAFileMapping&);
+
+			const char* address;
+			size_t length;
+#ifdef _WIN32
+			void* fileHandle;
+			void* mappingHandle;
+#endif
+		};
+
+		// Image metadata, read by ProbeTga without allocating memory or decoding pixel data
+		struct TGAImageInfo {
+
+			TGAImageInfo() : width(0), height(0), bitsPerPixel(0), attributeBitsPerPixel(0), origin(GWTGA_UNDEFINED), xOrigin(0), yOrigin(0), colorType(GWTGA_UNKNOWN), 
+				imageType(0), rleCompressed(false), colorMapFirstEntry(0), colorMapLength(0), colorMapBitsPerPixel(0), colorMapOffset(0), pixelDataOffset(0), 
+				hasFooter(false), extensionOffset(0), developerAreaOffset(0), error(GWTGA_NONE) {}
+
+			unsigned int	width;
+			unsigned int	height;
+			unsigned char	bitsPerPixel; //< Bits per pixel as stored in file (size of color index for color mapped images)
+
+			unsigned char	attributeBitsPerPixel;
+
+			TGAImageOrigin	origin;
+			unsigned int	xOrigin;
+			unsigned int	yOrigin;
+
+			TGAColorType	colorType;
+			unsigned char	imageType; //< TGA image type (1 - 3 uncompressed, 9 - 11 RLE compressed)
+			bool			rleCompressed;
+
+			unsigned int	colorMapFirstEntry;
+			unsigned int	colorMapLength;
+			unsigned char	colorMapBitsPerPixel;
+
+			size_t			colorMapOffset; //< Offset of color map from beginning of file
+			size_t			pixelDataOffset; //< Offset of pixel data from beginning of file
+
+			bool			hasFooter; //< TGA 2.0 footer found, it can be found only when size of file is known
+			size_t			extensionOffset; //< Offset of extension area, 0 when not present
+			size_t			developerAreaOffset; //< Offset of developer area, 0 when not present
+
+			TGAError		error;
+
+			bool hasError() const { return error != GWTGA_NONE; }
+			bool hasColorMap() const { return colorMapLength != 0; }
+
+			// Bits per pixel of image returned by LoadTga with given options
+			unsigned char decodedBitsPerPixel(TGAOptions options) const;
+
+			// Size of pixel data returned by LoadTga with given options
+			size_t decodedSize(TGAOptions options) const;
+
+			// Size of color map stored in file
+			size_t colorMapSize() const { return colorMapLength * (colorMapBitsPerPixel / 8); }
+		};
+
 		struct TGAImage {
 
-			TGAImage() :bytes(NULL), width(0), height(0), bitsPerPixel(0), attributeBitsPerPixel(0), origin(GWTGA_UNDEFINED), xOrigin(0), yOrigin(0), error(GWTGA_NONE), colorType(GWTGA_UNKNOWN) {}
+			TGAImage() :bytes(NULL), width(0), height(0), bitsPerPixel(0), attributeBitsPerPixel(0), origin(GWTGA_UNDEFINED), xOrigin(0), yOrigin(0), error(GWTGA_NONE), colorType(GWTGA_UNKNOWN), mipLevels(1) {}
 
 			char*			bytes;
 
@@ -90,8 +190,47 @@ namespace gw {
 
 			TGAColorMap		colorMap;
 
+			unsigned int	mipLevels; //< Number of mip levels stored in bytes, 1 unless GWTGA_GENERATE_MIPMAPS was used
+
 			bool hasError() const { return error != GWTGA_NONE; }
 			bool hasColorMap() const { return colorMap.bytes != NULL && colorMap.length != 0 && colorMap.bitsPerPixel != 0; }
+
+			// Levels follow each other in bytes from the largest one (level 0 is the image itself)
+			unsigned int mipWidth(unsigned int level) const { return (width >> level) > 0 ? width >> level : 1; }
+			unsigned int mipHeight(unsigned int level) const { return (height >> level) > 0 ? height >> level : 1; }
+			size_t mipOffset(unsigned int level) const;
+		};
+
+		// Owns memory of loaded image, e.g. TGAImagePtr image(LoadTga(fileName, &pool), &pool). Pixels and color map are given 
+		// back to the listener which allocated them (see ITGALoaderListener::release), or deleted with delete[] when owner is 
+		// NULL (default listener). Owner has to outlive the image. Image can only be moved, so its memory is never copied. 
+		// Pixels borrowed from file mapping or memory buffer must not be owned.
+		class TGAImagePtr {
+		public:
+			TGAImagePtr() : owner(NULL) {}
+			explicit TGAImagePtr(const TGAImage &image) : image(image), owner(NULL) {}
+			TGAImagePtr(const TGAImage &image, ITGALoaderListener* owner) : image(image), owner(owner) {}
+			TGAImagePtr(TGAImagePtr &&other);
+			~TGAImagePtr() { reset(); }
+
+			TGAImagePtr& operator=(TGAImagePtr &&other);
+
+			const TGAImage& operator*() const { return image; }
+			const TGAImage* operator->() const { return &image; }
+			const TGAImage& get() const { return image; }
+
+			// Gives up ownership, memory of returned image has to be released by caller
+			TGAImage release();
+
+			// Releases memory and leaves empty image
+			void reset();
+
+		private:
+			TGAImagePtr(const TGAImagePtr&);
+			TGAImagePtr& operator=(const TGAImagePtr&);
+
+			TGAImage image;
+			ITGALoaderListener* owner;
 		};
 
 		// -------------------------------------------------------------------------------------
@@ -110,6 +249,298 @@ namespace gw {
 		TGAImage LoadTga(char* fileName, ITGALoaderListener* listener, TGAOptions options);
 		TGAImage LoadTga(std::istream &stream, ITGALoaderListener* listener, TGAOptions options);
 
+		// Uncompressed images which are not flipped are not copied - pixels of returned image point directly 
+		// into the (read-only) mapping and no image memory is requested from the listener. Use mapping.contains(image.bytes) 
+		// to find out whether the pixels were copied. Other images are decoded from the mapping into memory provided by listener.
+		TGAImage LoadTga(const TGAFileMapping &mapping);
+		TGAImage LoadTga(const TGAFileMapping &mapping, ITGALoaderListener* listener);
+		TGAImage LoadTga(const TGAFileMapping &mapping, TGAOptions options);
+		TGAImage LoadTga(const TGAFileMapping &mapping, ITGALoaderListener* listener, TGAOptions options);
+
+		// Decode image from TGA file stored in memory buffer (size bytes long)
+		TGAImage LoadTga(const void* data, size_t size);
+		TGAImage LoadTga(const void* data, size_t size, ITGALoaderListener* listener);
+		TGAImage LoadTga(const void* data, size_t size, TGAOptions options);
+		TGAImage LoadTga(const void* data, size_t size, ITGALoaderListener* listener, TGAOptions options);
+
+		// Number of threads used with GWTGA_PARALLEL_DECODE, GWTGA_PARALLEL_ENCODE and by LoadTgaBatch, 0 (default) uses all hardware threads
+		void SetTgaThreadCount(unsigned int threadCount);
+
+		// -------------------------------------------------------------------------------------
+		//  Region load overloads
+		// -------------------------------------------------------------------------------------
+
+		// Decode only width x height pixels at x, y - coordinates of image returned by LoadTga with the same options (after flipping).
+		// Memory is requested only for the region. Rows and columns outside of region are skipped without reading, RLE packets 
+		// outside of region are only walked through. Rows of RLE images saved with scan line table are found directly when
+		// loading from file, mapping or memory. Region outside of image returns GWTGA_INVALID_DATA.
+		TGAImage LoadTgaRegion(char* fileName, unsigned int x, unsigned int y, unsigned int width, unsigned int height);
+		TGAImage LoadTgaRegion(char* fileName, unsigned int x, unsigned int y, unsigned int width, unsigned int height, TGAOptions options);
+		TGAImage LoadTgaRegion(char* fileName, unsigned int x, unsigned int y, unsigned int width, unsigned int height, ITGALoaderListener* listener, TGAOptions options);
+
+		TGAImage LoadTgaRegion(std::istream &stream, unsigned int x, unsigned int y, unsigned int width, unsigned int height);
+		TGAImage LoadTgaRegion(std::istream &stream, unsigned int x, unsigned int y, unsigned int width, unsigned int height, TGAOptions options);
+		TGAImage LoadTgaRegion(std::istream &stream, unsigned int x, unsigned int y, unsigned int width, unsigned int height, ITGALoaderListener* listener, TGAOptions options);
+
+		// Full-width regions of uncompressed images which are not flipped reference the mapping, same as LoadTga
+		TGAImage LoadTgaRegion(const TGAFileMapping &mapping, unsigned int x, unsigned int y, unsigned int width, unsigned int height);
+		TGAImage LoadTgaRegion(const TGAFileMapping &mapping, unsigned int x, unsigned int y, unsigned int width, unsigned int height, TGAOptions options);
+		TGAImage LoadTgaRegion(const TGAFileMapping &mapping, unsigned int x, unsigned int y, unsigned int width, unsigned int height, ITGALoaderListener* listener, TGAOptions options);
+
+		TGAImage LoadTgaRegion(const void* data, size_t size, unsigned int x, unsigned int y, unsigned int width, unsigned int height);
+		TGAImage LoadTgaRegion(const void* data, size_t size, unsigned int x, unsigned int y, unsigned int width, unsigned int height, TGAOptions options);
+		TGAImage LoadTgaRegion(const void* data, size_t size, unsigned int x, unsigned int y, unsigned int width, unsigned int height, ITGALoaderListener* listener, TGAOptions options);
+
+		// -------------------------------------------------------------------------------------
+		//  Probe overloads
+		// -------------------------------------------------------------------------------------
+
+		TGAImageInfo ProbeTga(char* fileName);
+		TGAImageInfo ProbeTga(const void* data, size_t size);
+
+		// Stream position is restored after probing, footer is read only from seekable streams
+		TGAImageInfo ProbeTga(std::istream &stream);
+
+		// Probe count files in parallel and store their metadata to results. When threadCount is 0, all hardware threads are used
+		void ProbeTga(char** fileNames, size_t count, TGAImageInfo* results, unsigned int threadCount);
+
+		// -------------------------------------------------------------------------------------
+		//  Validation
+		// -------------------------------------------------------------------------------------
+
+		// Issue found by ValidateTga
+		enum TGAValidationIssue {
+			GWTGA_VALID = 0,
+			GWTGA_UNREADABLE,               //< File cannot be opened
+			GWTGA_TRUNCATED_HEADER,
+			GWTGA_UNSUPPORTED_IMAGE_TYPE,   //< Image type is not 1, 2, 3, 9, 10 or 11
+			GWTGA_BAD_PIXEL_DEPTH,          //< Size of pixel, color index or color map entry is not supported
+			GWTGA_MISSING_COLOR_MAP,        //< Color mapped image without color map
+			GWTGA_TRUNCATED_COLOR_MAP,      //< Image ID or color map continues behind end of file
+			GWTGA_TRUNCATED_PIXEL_DATA,     //< Row or RLE packet continues behind end of file
+			GWTGA_PACKET_OVERRUN,           //< RLE packet continues behind last pixel of image
+			GWTGA_COLOR_INDEX_OUT_OF_RANGE, //< Color index does not point into color map
+			GWTGA_BAD_FOOTER,               //< Extension or developer area lies outside of file or overlaps image data
+			GWTGA_BAD_SCAN_LINE_TABLE       //< Scan line table lies outside of file or does not point to beginnings of rows
+		};
+
+		struct TGAValidation {
+
+			TGAValidation() : issue(GWTGA_VALID), error(GWTGA_NONE), offset(0) {}
+
+			TGAValidationIssue	issue;
+			TGAError			error; //< Error code of issue, same as LoadTga returns for issues it detects
+			size_t				offset; //< Offset of invalid header field, packet, color index or cut short part of file from beginning of file
+
+			bool hasError() const { return issue != GWTGA_VALID; }
+		};
+
+		// Walks header, color map, pixel data (every RLE packet and color index) and TGA 2.0 footer without decoding any
+		// pixels and stops at the first issue. Files which pass are decoded by LoadTga without reading outside of file,
+		// image or color map.
+		TGAValidation ValidateTga(char* fileName);
+		TGAValidation ValidateTga(const TGAFileMapping &mapping);
+		TGAValidation ValidateTga(const void* data, size_t size);
+
+		// Stream position is restored after validation, footer is checked only in seekable streams
+		TGAValidation ValidateTga(std::istream &stream);
+
+		// -------------------------------------------------------------------------------------
+		//  Stats
+		// -------------------------------------------------------------------------------------
+
+		// Counters and stage times of LoadTga, LoadTgaRegion, LoadTgaBatch and SaveTga calls, see SetTgaStats. They are
+		// collected only when the library is built with GWTGA_STATS defined, otherwise loading and saving has no overhead.
+		struct TGAStats {
+
+			TGAStats() : images(0), bytesRead(0), bytesWritten(0), rlePackets(0), rawPackets(0), rlePixels(0), rawPixels(0),
+				headerSeconds(0.0), colorMapSeconds(0.0), pixelSeconds(0.0), footerSeconds(0.0), ioSeconds(0.0) {}
+
+			uint64_t	images; //< Number of loaded and saved images
+			uint64_t	bytesRead; //< Header, image ID, color map and pixel data consumed by decoder
+			uint64_t	bytesWritten;
+
+			// Packets decoded or encoded and pixels they cover
+			uint64_t	rlePackets;
+			uint64_t	rawPackets;
+			uint64_t	rlePixels;
+			uint64_t	rawPixels;
+
+			// Flipping, conversions and mip filtering are done while pixels are decoded or encoded, so they count to pixel stage
+			double		headerSeconds; //< Header and image ID
+			double		colorMapSeconds; //< Reading or writing color map and expanding it for decoding
+			double		pixelSeconds;
+			double		footerSeconds; //< Scan line table and footer written by SaveTga
+			double		ioSeconds; //< Waiting for std::istream or std::ostream, part of stage times (reads of mapped files are not measured)
+
+			double averageRunLength() const { return rlePackets > 0 ? (double) rlePixels / rlePackets : 0.0; }
+			double totalSeconds() const { return headerSeconds + colorMapSeconds + pixelSeconds + footerSeconds; }
+		};
+
+		// Stats of loads and saves made by calling thread (including work they do on other threads) are added to stats until
+		// NULL is set. Stats may be shared by several threads, read them when their loads and saves are over. Loads of
+		// LoadTgaBatch are added to stats of thread which called it.
+		void SetTgaStats(TGAStats* stats);
+
+		// -------------------------------------------------------------------------------------
+		//  Pooled memory
+		// -------------------------------------------------------------------------------------
+
+		namespace details {
+			class TGAMemoryPool;
+		}
+
+		// Loader listener which reuses memory of released images instead of allocating it for every load. Memory is 64-byte 
+		// aligned and taken from free lists of size classes (4 per power of two). Blocks of at least hugePageThreshold bytes 
+		// are backed by huge pages on Linux (0 turns it off). Released memory is kept until there is more than maxCachedBytes
+		// of it (0 means no limit). Listener is thread safe, so one listener can be shared by LoadTgaBatch.
+		class TGAPoolListener : public ITGALoaderListener {
+		public:
+			static const size_t alignment = 64;
+
+			TGAPoolListener();
+			TGAPoolListener(size_t maxCachedBytes, size_t hugePageThreshold);
+
+			// Cached memory is freed, memory still used by images has to be released before
+			~TGAPoolListener();
+
+			char* operator()(const unsigned int &bitsPerPixel, const unsigned int &width, const unsigned int &height, TGAMemoryType mType);
+
+			// Returns memory allocated by this listener to the pool, NULL is ignored
+			void release(char* memory, TGAMemoryType mType);
+
+			// Returns pixels and color map of image loaded with this listener to the pool and clears the pointers
+			void release(TGAImage &image);
+
+			// Frees all cached memory
+			void trim();
+
+			size_t cachedBytes() const;
+
+		private:
+			TGAPoolListener(const TGAPoolListener&);
+			TGAPoolListener& operator=(const TGAPoolListener&);
+
+			details::TGAMemoryPool* pool;
+		};
+
+		// -------------------------------------------------------------------------------------
+		//  Batch loading
+		// -------------------------------------------------------------------------------------
+
+		// Receives events of LoadTgaBatch, methods are called from worker threads concurrently
+		class ITGABatchListener {
+		public:
+			virtual ~ITGABatchListener() {}
+
+			// Listener providing memory for image of file at index, must stay valid until the file is loaded. 
+			// Images are allocated with new[] when NULL is returned.
+			virtual ITGALoaderListener* createListener(size_t) { return NULL; }
+
+			// Called as soon as file at index is loaded, check image.error
+			virtual void loaded(size_t, const TGAImage&) {}
+		};
+
+		// Load count files on threads of a pool kept between calls (see SetTgaThreadCount) and store images to results in 
+		// order of fileNames, errors of single files are stored to TGAImage::error. Results may be NULL when images are taken 
+		// from listener. Files are decoded in parallel, so GWTGA_PARALLEL_DECODE is ignored. Files are read ahead while 
+		// others are decoded (see SetTgaQueueDepth). Must not be called from listener.
+		void LoadTgaBatch(char** fileNames, size_t count, TGAImage* results, TGAOptions options);
+		void LoadTgaBatch(char** fileNames, size_t count, TGAImage* results, ITGABatchListener* listener, TGAOptions options);
+
+		// Number of files LoadTgaBatch reads ahead of decoding on Linux, reads are submitted to io_uring with single system 
+		// call (or done with preadv when io_uring is not available). Files are mapped one at a time when 0 is set. Default 
+		// is 16.
+		void SetTgaQueueDepth(unsigned int queueDepth);
+
+		// -------------------------------------------------------------------------------------
+		//  Incremental reading
+		// -------------------------------------------------------------------------------------
+
+		namespace details {
+			class TGAStreamInput;
+			class TGAMemoryInput;
+			struct TGAColorTable;
+		}
+
+		// Decodes image a few rows at a time into caller's buffer, memory use does not depend on size of image. Rows are returned 
+		// in the order they are stored in file (see origin of info()), GWTGA_FLIP_VERTICALLY is ignored. Supported options are 
+		// GWTGA_FLIP_HORIZONTALLY, GWTGA_RETURN_COLOR_MAP and GWTGA_OUTPUT_*.
+		class TGAReader {
+		public:
+			TGAReader();
+			~TGAReader();
+
+			// Header and color map are read when opening. Stream has to stay open until the reader is closed, data of memory 
+			// buffer is not copied.
+			TGAError open(char* fileName, TGAOptions options);
+			TGAError open(std::istream &stream, TGAOptions options);
+			TGAError open(const void* data, size_t size, TGAOptions options);
+			void close();
+
+			bool isOpen() const { return streamInput != NULL || memoryInput != NULL; }
+
+			const TGAImageInfo& info() const { return imageInfo; }
+
+			// Color map of color indices returned with GWTGA_RETURN_COLOR_MAP, valid until the reader is closed
+			TGAColorMap colorMap() const;
+
+			// Layout of returned rows
+			unsigned char bitsPerPixel() const { return outputBitsPerPixel; }
+			size_t rowSize() const { return (size_t) imageInfo.width * (outputBitsPerPixel / 8); }
+
+			// Decodes up to rowCount next rows to target (rowSize() bytes each) and returns number of decoded rows, 
+			// less than rowCount at the end of image or on error
+			unsigned int readRows(char* target, unsigned int rowCount);
+
+			unsigned int rowsRead() const { return nextRow; }
+			bool finished() const { return nextRow == imageInfo.height; }
+			TGAError error() const { return readError; }
+
+		private:
+			TGAReader(const TGAReader&);
+			TGAReader& operator=(const TGAReader&);
+
+			template<class Input>
+			TGAError start(Input &input, TGAOptions options);
+
+			template<class Input>
+			bool readRow(Input &input, char* target);
+
+			TGAFileMapping mapping;
+			std::ifstream* fileStream;
+			details::TGAStreamInput* streamInput;
+			details::TGAMemoryInput* memoryInput;
+
+			TGAImageInfo imageInfo;
+			TGAError readError;
+			unsigned int nextRow;
+			unsigned char outputBitsPerPixel;
+			bool flipHorizontally;
+			bool returnColorMap;
+
+			// Rows are decoded to pixels of stored format (or entries of color map) and converted afterwards when needed
+			size_t inputPixelSize;
+			size_t decodedPixelSize;
+			int storedFormat; //< details::TGAFormat
+			int outputFormat; //< details::TGAFormat
+			bool convert;
+
+			std::vector<char> colorMapBytes;
+			details::TGAColorTable* colorTable;
+			std::vector<char> rowBuffer;
+
+			// Picked when opening, colorMapData is passed to them (entries of color table or color map)
+			void (*fetchPixel)(char* target, const char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel);
+			void (*fetchPixels)(char* target, const char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel, size_t count);
+			char* colorMapData;
+
+			// RLE packet may continue in next row
+			size_t packetRemaining;
+			bool rlePacket;
+			char packetColor[16];
+		};
+
 		// -------------------------------------------------------------------------------------
 		//  Save overloads
 		// -------------------------------------------------------------------------------------
@@ -123,6 +554,72 @@ namespace gw {
 		TGAError SaveTga(char* fileName, const TGAImage &image);
 		TGAError SaveTga(std::ostream &stream, const TGAImage &image);
 
+		// -------------------------------------------------------------------------------------
+		//  Incremental writing
+		// -------------------------------------------------------------------------------------
+
+		namespace details {
+			class TGAStreamOutput;
+		}
+
+		// Encodes image a few rows at a time from caller's buffer, memory use does not depend on size of image. Rows are passed 
+		// in the order they are stored in file (see origin of layout), GWTGA_FLIP_VERTICALLY is not supported. Supported options 
+		// are GWTGA_COMPRESS_RLE, GWTGA_COMPRESS_RLE_OPTIMAL, GWTGA_SCAN_LINE_TABLE, GWTGA_PARALLEL_ENCODE and 
+		// GWTGA_FLIP_HORIZONTALLY.
+		class TGAWriter {
+		public:
+			TGAWriter();
+			~TGAWriter(); //< Closes writer, see close()
+
+			// Header and color map are written when opening, pixels of layout are not accessed. Stream has to stay open until 
+			// the writer is closed. Writer stays closed when opening fails (file is removed again), see error().
+			TGAError open(char* fileName, const TGAImage &layout, TGAOptions options);
+			TGAError open(std::ostream &stream, const TGAImage &layout, TGAOptions options);
+
+			// Writes scan line table and footer and flushes the stream. Returns GWTGA_INVALID_DATA when not all rows were written,
+			// such file is truncated.
+			TGAError close();
+
+			bool isOpen() const { return output != NULL; }
+
+			// Layout of passed rows
+			size_t rowSize() const { return (size_t) width * bytesPerPixel; }
+
+			// Encodes rowCount next rows from source (rowSize() bytes each). RLE packets do not continue from one call to the next, 
+			// pass more rows at once for better compression.
+			TGAError writeRows(const char* source, unsigned int rowCount);
+
+			unsigned int rowsWritten() const { return nextRow; }
+			bool finished() const { return output != NULL && nextRow == height; }
+			TGAError error() const { return writeError; }
+
+		private:
+			TGAWriter(const TGAWriter&);
+			TGAWriter& operator=(const TGAWriter&);
+
+			TGAError start(const TGAImage &layout, TGAOptions options);
+
+			std::ofstream* fileStream;
+			std::ostream* stream;
+			details::TGAStreamOutput* output;
+
+			TGAError writeError;
+			unsigned int width;
+			unsigned int height;
+			unsigned int nextRow;
+			unsigned char bytesPerPixel;
+			unsigned char attributeBitsPerPixel;
+			bool useRLEcompression;
+			bool useOptimalRLE;
+			bool useScanLineTable;
+			bool flipHorizontally;
+			unsigned int threadCount;
+
+			// Offsets of rows within pixel data for scan line table, followed by size of pixel data
+			size_t pixelDataOffset;
+			std::vector<size_t> rowOffsets;
+		};
+
 		namespace details {
 			struct TGAColorMapSpec {
 				uint16_t firstEntryIndex;
@@ -166,21 +663,52 @@ namespace gw {
 			};
 
 			struct TGAFooter {
-				uint16_t extensionOffset; 
-				uint16_t devAreaOffset; 
+				uint32_t extensionOffset; 
+				uint32_t devAreaOffset; 
 				char signature[16];
 				uint8_t dot;
 				uint8_t null;
 			};
 
-			// Pixel format of TGA image, names correspond to OpenGL pixel format
-			//enum TGAFormat {
-			//	LUMINANCE_U8, //< 1 byte greyscale value per pixel
-			//	BGRA5551_U16, //< 5-bit BGR + 1-byte alpha
-			//	BGR_U24,      //< 1 byte per color channel (BGR)
-			//	BGRA_U32,     //< 1 byte per color channel (BGRA)
-			//	BGR_F96       //< 1 32-bit float per color channel (BGR)
-			//};
+			const size_t TGA_HEADER_SIZE = 18;
+			const size_t TGA_FOOTER_SIZE = 26;
+			const size_t TGA_EXTENSION_SIZE = 495;
+			const size_t TGA_EXTENSION_SCAN_LINE_OFFSET = 490; //< Position of scanLineOffset within extension area
+
+			void parseHeader(const char* bytes, TGAHeader &header);
+			bool parseFooter(const char* bytes, TGAFooter &footer); //< Returns false when TGA 2.0 signature is missing
+			void getImageInfo(const TGAHeader &header, TGAImageInfo &info);
+
+			// Size of image ID, color map and pixel data behind header, TGAStreamInput::noLimit for RLE images
+			size_t getImageDataSize(const TGAHeader &header);
+			void getFooterInfo(const char* bytes, size_t fileSize, TGAImageInfo &info);
+
+			uint16_t readUInt16(const char* bytes);
+			uint32_t readUInt32(const char* bytes);
+			void writeUInt16(char* bytes, uint16_t value);
+			void writeUInt32(char* bytes, uint32_t value);
+
+			// Pixel format of TGA image, names correspond to OpenGL pixel format. RGB formats are not stored in TGA files,
+			// pixels are converted to them while decoding.
+			enum TGAFormat {
+				UNKNOWN_FORMAT,
+				LUMINANCE_U8,        //< 1 byte greyscale value per pixel
+				LUMINANCE_ALPHA_U16, //< 1 byte greyscale value + 1 byte alpha
+				BGR555_U16,          //< 5-bit BGR, top bit is not used
+				BGRA5551_U16,        //< 5-bit BGR + 1-bit alpha
+				BGR_U24,             //< 1 byte per color channel (BGR)
+				BGRA_U32,            //< 1 byte per color channel (BGRA)
+				RGB_U24,             //< 1 byte per color channel (RGB)
+				RGBA_U32             //< 1 byte per color channel (RGBA)
+			};
+
+			// Format of pixels (or color map entries) stored in file, UNKNOWN_FORMAT when they cannot be converted
+			TGAFormat getStoredFormat(TGAColorType colorType, size_t bitsPerPixel, size_t attributeBitsPerPixel);
+
+			// Format requested by GWTGA_OUTPUT_* option, UNKNOWN_FORMAT when pixels are returned as stored
+			TGAFormat getOutputFormat(TGAOptions options);
+
+			size_t getFormatSize(TGAFormat format);
 
 			template<size_t tempMemorySize = 768>
 			class TGALoaderListener : public ITGALoaderListener {
@@ -195,49 +723,551 @@ namespace gw {
 				bool persistentColorMapMemory;
 			};
 
+			// Gives temporary color map back to listener when loading is over
+			struct TGATemporaryMemory {
+				TGATemporaryMemory(ITGALoaderListener* listener) : listener(listener), memory(NULL) {}
+				~TGATemporaryMemory() { if (memory) listener->release(memory, GWTGA_COLOR_PALETTE_TEMPORARY); }
+
+				ITGALoaderListener* listener;
+				char* memory;
+			};
+
+			// -------------------------------------------------------------------------------------
+			//  Input sources
+			// -------------------------------------------------------------------------------------
+
+			// Reads TGA data from std::istream through refillable block of blockSize bytes, 
+			// the stream is touched only when the block runs out of data
+			class TGAStreamInput {
+			public:
+				static const size_t blockSize = 64 * 1024;
+				static const size_t noLimit = (size_t) -1;
+
+				TGAStreamInput(std::istream &stream);
+
+				// Returns data read ahead but not consumed back to the stream, failbit of stream is left set when it cannot 
+				// seek back (e.g. pipe), data read ahead is lost then
+				~TGAStreamInput();
+
+				// Stream is not read ahead behind next size bytes (end of header or uncompressed image), so non-seekable
+				// streams stay positioned right behind the image
+				void limit(size_t size);
+
+				void read(char* target, size_t size);
+				void skip(size_t size);
+				bool fail() const { return failed; }
+
+				// Returns pointer to next size bytes (inside the block), NULL on failure
+				const char* fetch(size_t size);
+
+				// Stream data cannot be referenced in place
+				const char* borrow(size_t) { return NULL; }
+
+			private:
+				TGAStreamInput& operator=(const TGAStreamInput&);
+
+				// Moves unconsumed data to the beginning of the block and reads until at least size bytes are available
+				bool refill(size_t size);
+
+				std::istream &stream;
+				std::vector<char> block;
+				size_t current;
+				size_t end;
+				size_t readLimit; //< Bytes which may be read from stream behind end of block
+				bool failed;
+			};
+
+			// Reads TGA data from memory block (e.g. memory mapped file)
+			class TGAMemoryInput {
+			public:
+				TGAMemoryInput(const char* data, size_t size) : begin(data), current(data), end(data + size), failed(false) {}
+
+				void read(char* target, size_t size);
+				void skip(size_t size);
+				bool fail() const { return failed; }
+
+				// Nothing is read ahead from memory
+				void limit(size_t) {}
+
+				// Returns pointer to next size bytes and moves past them, NULL when there is not enough data
+				const char* borrow(size_t size);
+				const char* fetch(size_t size) { return borrow(size); }
+
+				// Whole data and current position, parts of data can be decoded in parallel through other inputs
+				const char* data() const { return begin; }
+				size_t size() const { return end - begin; }
+				const char* position() const { return current; }
+				size_t available() const { return end - current; }
+
+			private:
+				const char* begin;
+				const char* current;
+				const char* end;
+				bool failed;
+			};
+
+			// -------------------------------------------------------------------------------------
+			//  Mip chain
+			// -------------------------------------------------------------------------------------
+
+			// Notified about rows of image as they are decoded
+			class ITGARowListener {
+			public:
+				virtual ~ITGARowListener() {}
+				// First rowCount rows of image (in file order) are decoded
+				virtual void rowsDecoded(size_t rowCount) = 0;
+			};
+
+			// TGA image is at most 65535 pixels wide
+			const size_t TGA_MAX_MIP_LEVELS = 17;
+
+			unsigned int getMipLevelCount(size_t width, size_t height);
+
+			// Number of pixels of all levels
+			size_t getMipChainPixels(size_t width, size_t height);
+
+			// sRGB encoded values and their linear values in 16-bit fixed point
+			struct TGASRGBTables {
+				TGASRGBTables();
+
+				uint16_t toLinear[256];
+				uint8_t fromLinear[65536];
+			};
+
+			// Built on first use
+			const TGASRGBTables& getSRGBTables();
+
+			// Box filters mip levels stored behind image as rows of image are decoded. Row of level is filtered as soon 
+			// as both of its source rows are ready, while they are still in cache. Rows are decoded from the top of image, or 
+			// from the bottom when flipping vertically.
+			class TGAMipChain : public ITGARowListener {
+			public:
+				TGAMipChain(char* bytes, size_t width, size_t height, size_t bytesPerPixel, bool flipVertically, bool sRGB);
+
+				void rowsDecoded(size_t rowCount);
+
+			private:
+				struct Level {
+					char* bytes;
+					size_t width;
+					size_t height;
+					size_t readyFront; //< Rows [0, readyFront) are ready
+					size_t readyBack; //< Rows [readyBack, height) are ready
+
+					bool isReady(size_t row) const { return row < readyFront || row >= readyBack; }
+					size_t clampRow(size_t row) const { return row < height ? row : height - 1; }
+				};
+
+				// Filters rows of level whose source rows in previous level are ready
+				void filterLevel(size_t level);
+				void filterRow(size_t level, size_t row);
+
+				Level levels[TGA_MAX_MIP_LEVELS];
+				size_t levelCount;
+				size_t bytesPerPixel;
+				bool flipVertically;
+				bool sRGB;
+			};
+
+			// Averages 2x2 blocks of source rows, sources narrower than 2 pixels repeat their pixel
+			template<size_t bytesPerPixel, bool sRGB>
+			void filterMipRow(char* target, const char* sourceRow0, const char* sourceRow1, size_t sourceWidth, size_t targetWidth);
+
+			// -------------------------------------------------------------------------------------
+			//  Output sinks
+			// -------------------------------------------------------------------------------------
+
+			// Writes to std::ostream through block of blockSize bytes, the stream is touched only when the block is full
+			class TGAStreamOutput {
+			public:
+				static const size_t blockSize = 64 * 1024;
+
+				TGAStreamOutput(std::ostream &stream);
+
+				// Writes what is left in the block
+				~TGAStreamOutput();
+
+				void write(const char* data, size_t size);
+				void flush();
+
+				// Check after flush, data in the block has not reached the stream yet
+				bool fail() const { return stream.fail(); }
+
+				// Number of bytes written so far
+				size_t size() const { return written; }
+
+			private:
+				TGAStreamOutput& operator=(const TGAStreamOutput&);
+
+				std::ostream &stream;
+				std::vector<char> block;
+				size_t used;
+				size_t written;
+			};
+
+			// Collects written data in memory (e.g. band of image compressed on other thread)
+			class TGAMemoryOutput {
+			public:
+				void write(const char* data, size_t size);
+				bool fail() const { return false; }
+				size_t size() const { return bytes.size(); }
+
+				const std::vector<char>& data() const { return bytes; }
+
+			private:
+				std::vector<char> bytes;
+			};
+
+			// Rectangle of image
+			struct TGARegion {
+				TGARegion(size_t x, size_t y, size_t width, size_t height) : x(x), y(y), width(width), height(height) {}
+
+				size_t x;
+				size_t y;
+				size_t width;
+				size_t height;
+			};
+
+			// Region is given in coordinates of returned image, whole image is decoded when it is NULL
+			template<class Input>
+			TGAImage loadTga(Input &input, ITGALoaderListener* listener, TGAOptions options, bool borrowPixels, const TGARegion* region);
+
+			// Thread count set by SetTgaThreadCount, resolved to number of hardware threads when not set
+			unsigned int getThreadCount();
+
+			typedef void(*taskFunc)(void* context, size_t index);
+
+			// Queue depth set by SetTgaQueueDepth
+			unsigned int getQueueDepth();
+
+			class TGAFileQueue;
+
+			// Reads whole files of batch to memory ahead of decoding, up to queueDepth files are being read or wait for 
+			// decoding at once. Returns NULL when reading ahead is not supported on the system or queueDepth is 0.
+			TGAFileQueue* openFileQueue(char** fileNames, size_t count, unsigned int queueDepth);
+			void closeFileQueue(TGAFileQueue* queue);
+
+			// Waits until file at index is read and decodes it from memory, every file of queue is loaded once
+			TGAImage loadQueuedFile(TGAFileQueue* queue, size_t index, ITGALoaderListener* listener, TGAOptions options);
+
+			// Runs task for indices 0..count-1 on up to threadCount threads (calling thread included) and waits for all of 
+			// them. Threads are kept in a pool between calls, indices are split to a queue per thread and idle threads 
+			// steal from queues of others. Calls from different threads are serialized, task which calls runTasks runs the
+			// nested tasks on its own thread.
+			void runTasks(taskFunc task, void* context, size_t count, unsigned int threadCount);
+
+			// Asks OS to read file to cache in background, so it is ready when loaded
+			void prefetchFile(char* fileName);
+			void prefetchMapping(const TGAFileMapping &mapping);
+
+			// -------------------------------------------------------------------------------------
+			//  Validation
+			// -------------------------------------------------------------------------------------
+
+			// Random access to validated file, footer and areas it points to are read through it
+			class ITGABlockReader {
+			public:
+				virtual ~ITGABlockReader() {}
+				// Returns size bytes at offset from beginning of file (valid until next read), NULL when they are not in file
+				virtual const char* read(size_t offset, size_t size) = 0;
+			};
+
+			class TGAMemoryBlockReader : public ITGABlockReader {
+			public:
+				TGAMemoryBlockReader(const char* data, size_t size) : data(data), dataSize(size) {}
+				const char* read(size_t offset, size_t size);
+
+			private:
+				const char* data;
+				size_t dataSize;
+			};
+
+			// Offsets are relative to start, stream is positioned back to start after every read
+			class TGAStreamBlockReader : public ITGABlockReader {
+			public:
+				TGAStreamBlockReader(std::istream &stream, std::streampos start) : stream(stream), start(start) {}
+				const char* read(size_t offset, size_t size);
+
+			private:
+				TGAStreamBlockReader& operator=(const TGAStreamBlockReader&);
+
+				std::istream &stream;
+				std::streampos start;
+				std::vector<char> buffer;
+			};
+
+			// Areas of file referenced by TGA 2.0 footer, offsets are 0 when area is not present
+			struct TGAFooterAreas {
+
+				TGAFooterAreas() : footerOffset(0), extensionOffset(0), developerAreaOffset(0), scanLineTableOffset(0) {}
+
+				size_t footerOffset;
+				size_t extensionOffset;
+				size_t developerAreaOffset;
+				size_t scanLineTableOffset;
+				std::vector<uint32_t> scanLineTable; //< Offsets of rows, empty without scan line table
+			};
+
+			void setValidationIssue(TGAValidation &result, TGAValidationIssue issue, size_t offset);
+
+			// Footer is checked before pixel data, so that rows can be checked against scan line table, its issues are
+			// reported only when the rest of file is valid
+			template<class Input>
+			TGAValidation validateTga(Input &input, ITGABlockReader* reader, size_t fileSize);
+
+			// Checks fields of header which do not depend on the rest of file
+			void validateHeader(const TGAHeader &header, const TGAImageInfo &info, TGAValidation &result);
+
+			// Walks header, image ID, color map and pixel data, returns offset behind pixel data
+			template<class Input>
+			size_t validateImage(Input &input, const TGAFooterAreas &areas, TGAValidation &result);
+
+			// Areas have to lie within file, overlaps with pixel data are found by validateAreas when end of pixel data is known
+			void validateFooter(ITGABlockReader &reader, size_t fileSize, TGAFooterAreas &areas, TGAValidation &result);
+			void validateAreas(const TGAFooterAreas &areas, size_t pixelDataEnd, TGAValidation &result);
+
+			// Returns position of first color index which does not point into color map, count when all of them do
+			size_t findInvalidColorIndex(const char* indices, size_t count, size_t bytesPerIndex, size_t colorMapLength);
+
 			// -------------------------------------------------------------------------------------
 			//  Pixel data reading 
 			// -------------------------------------------------------------------------------------
-			typedef size_t(*flipFunc)(size_t i, size_t width, size_t height, size_t bpp);
-			void getFlipFunction(flipFunc &flipFuncType, size_t &stride, bool flipVertically, bool flipHorizontally, size_t width, size_t height);
+			typedef void(*fetchPixelFunc)(char* target, const char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel);
+			typedef void(*fetchPixelsFunc)(char* target, const char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel, size_t count);
+
+			void fetchPixelUncompressed(char* target, const char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel);
+			void fetchPixelColorMap(char* target, const char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel);
+
+			void fetchPixelsUncompressed(char* target, const char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel, size_t count);
+			void fetchPixelsColorMap(char* target, const char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel, size_t count);
+
+			size_t readColorIndex(const char* input, size_t bytesPerIndex);
+
+			// Palette for 8-bit indices with at most 4 bytes per entry, every entry is padded to 4 bytes
+			struct TGAColorTable {
+				uint32_t entries[256];
+			};
+
+			void buildColorTable(TGAColorTable &table, const char* colorMap, size_t colorMapLength, size_t bytesPerEntry);
+
+			// Same as color map fetching, but colorMap points to TGAColorTable entries
+			void fetchPixelColorTable(char* target, const char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel);
+			void fetchPixelsColorTable(char* target, const char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel, size_t count);
+
+			template<size_t bytesPerEntry>
+			void expandColorTable(char* target, const uint8_t* indices, const uint32_t* entries, size_t count);
+
+			// Color channels of one pixel, conversions between formats go through it
+			struct TGAColor {
+				uint8_t r;
+				uint8_t g;
+				uint8_t b;
+				uint8_t a;
+			};
+
+			template<TGAFormat format>
+			TGAColor readColor(const uint8_t* pixel);
+
+			template<TGAFormat format>
+			void writeColor(uint8_t* pixel, const TGAColor &color);
+
+			// Converts count pixels from input format to output format (one of RGB_U24, RGBA_U32 and BGRA_U32)
+			void convertPixels(char* target, const char* input, TGAFormat inputFormat, TGAFormat outputFormat, size_t count);
+
+			template<TGAFormat inputFormat>
+			void convertPixels(char* target, const char* input, TGAFormat outputFormat, size_t count);
+
+			template<TGAFormat inputFormat, TGAFormat outputFormat>
+			void convertPixels(char* target, const char* input, size_t count);
+
+			// Fetching with conversion, decoding kernels convert pixels as they are decoded
+			template<TGAFormat inputFormat, TGAFormat outputFormat>
+			void fetchPixelConverted(char* target, const char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel);
+
+			template<TGAFormat inputFormat, TGAFormat outputFormat>
+			void fetchPixelsConverted(char* target, const char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel, size_t count);
+
+			// Writes count copies of pixel to target (vectorized for 1 - 4 byte pixels)
+			void fillPixels(char* target, const char* pixel, size_t bytesPerPixel, size_t count);
 
-			typedef void(*fetchPixelFunc)(char* target, char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel);
-			typedef bool(*fetchPixelsFunc)(char* target, std::istream &stream, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel, size_t count);
+			template<size_t bytesPerPixel>
+			void fillPixelsVector(char* target, const char* pixel, size_t count);
 
-			void fetchPixelUncompressed(char* target, char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel);
-			void fetchPixelColorMap(char* target, char* input, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel);
+			// Part of RLE image decoded at once - pixelCount pixels (in file order) starting with firstPixel. Input of band starts 
+			// with packet which contains firstPixel, skipPixels pixels of that packet belong to previous band.
+			struct TGARLEBand {
 
-			bool fetchPixelsUncompressed(char* target, std::istream &stream, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel, size_t count);
-			bool fetchPixelsColorMap(char* target, std::istream &stream, size_t bytesPerInputPixel, char* colorMap, size_t bytesPerOutputPixel, size_t count);
+				TGARLEBand() : firstPixel(0), pixelCount(0), skipPixels(0), clipLastPacket(false), inputOffset(0), inputEnd(0), rowListener(NULL) {}
+				TGARLEBand(size_t pixelCount, ITGARowListener* rowListener) : firstPixel(0), pixelCount(pixelCount), skipPixels(0), clipLastPacket(false), inputOffset(0), inputEnd(0), rowListener(rowListener) {}
 
-			template<fetchPixelFunc, fetchPixelsFunc>
-			bool decompressRLE(char* target, size_t pixelsNumber, size_t bytesPerInputPixel, std::istream &stream, char* colorMap, size_t bytesPerOutputPixel, size_t imgWidth, size_t imgHeight, flipFunc flip, bool perPixelProcessing);
+				size_t firstPixel;
+				size_t pixelCount;
+				size_t skipPixels;
+				bool clipLastPacket; //< Last packet may continue in next band
+
+				size_t inputOffset; //< Offset of first packet from position of input
+				size_t inputEnd; //< Offset behind last packet, set when band is decoded
+
+				ITGARowListener* rowListener; //< Notified about decoded rows, set only for band covering whole image
+			};
+
+			// Images with fewer pixels are not worth splitting to threads
+			const size_t TGA_PARALLEL_MIN_PIXELS = 1024 * 1024;
+
+			// RLE decoding kernels are specialized for pixel sizes and flip mode, one is picked after the header is parsed. 
+			// Pixel size 0 means the size is passed at runtime (uncommon pixel sizes). Region (in file coordinates - rows and 
+			// columns as stored) is decoded by region kernel, imgWidth and imgHeight are always size of the whole image.
+			template<class Input>
+			bool decompressRLEPixels(char* target, Input &input, size_t bytesPerPixel, size_t imgWidth, size_t imgHeight, bool flipVertically, bool flipHorizontally, unsigned int threadCount, ITGARowListener* rowListener, const TGARegion* region);
+
+			template<class Input>
+			bool decompressRLEColorTable(char* target, Input &input, TGAColorTable &colorTable, size_t bytesPerOutputPixel, size_t imgWidth, size_t imgHeight, bool flipVertically, bool flipHorizontally, unsigned int threadCount, ITGARowListener* rowListener, const TGARegion* region);
+
+			template<class Input>
+			bool decompressRLEConverted(char* target, Input &input, TGAFormat inputFormat, TGAFormat outputFormat, size_t imgWidth, size_t imgHeight, bool flipVertically, bool flipHorizontally, unsigned int threadCount, ITGARowListener* rowListener, const TGARegion* region);
+
+			template<class Input, TGAFormat inputFormat, size_t bytesPerInputPixel>
+			bool decompressRLEConverted(char* target, Input &input, TGAFormat outputFormat, size_t imgWidth, size_t imgHeight, bool flipVertically, bool flipHorizontally, unsigned int threadCount, ITGARowListener* rowListener, const TGARegion* region);
+
+			template<class Input, fetchPixelFunc fetchPixel, fetchPixelsFunc fetchPixels, size_t bytesPerInputPixel, size_t bytesPerOutputPixel>
+			bool decompressRLE(char* target, Input &input, char* colorMap, size_t runtimeBytesPerInputPixel, size_t runtimeBytesPerOutputPixel, size_t imgWidth, size_t imgHeight, bool flipVertically, bool flipHorizontally, unsigned int threadCount, ITGARowListener* rowListener, const TGARegion* region);
+
+			template<class Input, fetchPixelFunc fetchPixel, fetchPixelsFunc fetchPixels, size_t bytesPerInputPixel, size_t bytesPerOutputPixel, bool flipVertically, bool flipHorizontally>
+			bool decompressRLEKernel(char* target, Input &input, char* colorMap, size_t runtimeBytesPerInputPixel, size_t runtimeBytesPerOutputPixel, size_t imgWidth, size_t imgHeight, const TGARLEBand &band);
+
+			// Memory input is split to bands decoded in parallel, stream input is decoded on calling thread
+			template<fetchPixelFunc fetchPixel, fetchPixelsFunc fetchPixels, size_t bytesPerInputPixel, size_t bytesPerOutputPixel, bool flipVertically, bool flipHorizontally>
+			bool decompressRLEBands(char* target, TGAStreamInput &input, char* colorMap, size_t runtimeBytesPerInputPixel, size_t runtimeBytesPerOutputPixel, size_t imgWidth, size_t imgHeight, unsigned int threadCount, ITGARowListener* rowListener);
+
+			template<fetchPixelFunc fetchPixel, fetchPixelsFunc fetchPixels, size_t bytesPerInputPixel, size_t bytesPerOutputPixel, bool flipVertically, bool flipHorizontally>
+			bool decompressRLEBands(char* target, TGAMemoryInput &input, char* colorMap, size_t runtimeBytesPerInputPixel, size_t runtimeBytesPerOutputPixel, size_t imgWidth, size_t imgHeight, unsigned int threadCount, ITGARowListener* rowListener);
+
+			// Decodes region only, memory input with scan line table is decoded row by row from offsets in the table
+			template<fetchPixelFunc fetchPixel, fetchPixelsFunc fetchPixels, size_t bytesPerInputPixel, size_t bytesPerOutputPixel>
+			bool decompressRLERegion(char* target, TGAStreamInput &input, char* colorMap, size_t runtimeBytesPerInputPixel, size_t runtimeBytesPerOutputPixel, size_t imgWidth, size_t imgHeight, const TGARegion &region, bool flipVertically, bool flipHorizontally);
+
+			template<fetchPixelFunc fetchPixel, fetchPixelsFunc fetchPixels, size_t bytesPerInputPixel, size_t bytesPerOutputPixel>
+			bool decompressRLERegion(char* target, TGAMemoryInput &input, char* colorMap, size_t runtimeBytesPerInputPixel, size_t runtimeBytesPerOutputPixel, size_t imgWidth, size_t imgHeight, const TGARegion &region, bool flipVertically, bool flipHorizontally);
+
+			// Decodes rows [firstRow, endRow) of image from input which starts with the first packet of firstRow, only pixels 
+			// within region are written to target (region sized). Data of packets outside of region is skipped.
+			template<class Input, fetchPixelFunc fetchPixel, fetchPixelsFunc fetchPixels, size_t bytesPerInputPixel, size_t bytesPerOutputPixel>
+			bool decompressRLERegionKernel(char* target, Input &input, char* colorMap, size_t runtimeBytesPerInputPixel, size_t runtimeBytesPerOutputPixel, size_t imgWidth, size_t imgHeight, const TGARegion &region, size_t firstRow, size_t endRow, bool flipVertically, bool flipHorizontally);
+
+			typedef bool(*decompressRLEFunc)(char* target, TGAMemoryInput &input, char* colorMap, size_t bytesPerInputPixel, size_t bytesPerOutputPixel, size_t imgWidth, size_t imgHeight, const TGARLEBand &band);
+
+			bool decompressRLEParallel(decompressRLEFunc kernel, char* target, TGAMemoryInput &input, char* colorMap, size_t bytesPerInputPixel, size_t bytesPerOutputPixel, size_t imgWidth, size_t imgHeight, unsigned int threadCount);
+
+			// Finds input offsets of bands by walking packet headers, returns false when packets do not match image size
+			bool scanRLEBands(const char* data, size_t size, size_t bytesPerInputPixel, size_t pixelsNumber, std::vector<TGARLEBand> &bands);
+
+			// Finds input offsets of bands in scan line table of TGA 2.0 file, returns false when there is no usable table
+			bool findScanLineBands(const TGAMemoryInput &input, size_t imgWidth, size_t imgHeight, std::vector<TGARLEBand> &bands);
+
+			// Scan line table (imgHeight file offsets of rows) of TGA 2.0 file stored in input, NULL when there is none
+			const char* findScanLineTable(const TGAMemoryInput &input, size_t imgHeight);
 
 			// -------------------------------------------------------------------------------------
 			//  Image processing
 			// -------------------------------------------------------------------------------------
 
-			size_t flipFuncPass(size_t i, size_t width, size_t height, size_t bpp);
-			size_t flipFuncVertical(size_t i, size_t width, size_t height, size_t bpp);
-			size_t flipFuncHorizontal(size_t i, size_t width, size_t height, size_t bpp);
-			size_t flipFuncHorizontalAndVertical(size_t i, size_t width, size_t height, size_t bpp);
+			// Reverses order of pixels in row in place
+			void reversePixels(char* row, size_t width, size_t bytesPerPixel);
+			void reversePixelsScalar(char* left, char* right, size_t bytesPerPixel);
 
-			typedef char*(*fetchFunc)(char* source, unsigned int x, unsigned int y, unsigned int imgWidth, unsigned int imgHeight);
-			typedef char*(*processFunc)(char* target, char* source);
+			template<size_t bytesPerPixel>
+			void reversePixelsVector(char* row, size_t width);
+
+			// Writes uncompressed image rows in file order for given flip mode
+			void writeFlippedRows(TGAStreamOutput &output, const char* source, size_t imgWidth, size_t imgHeight, size_t bytesPerPixel, bool flipVertically, bool flipHorizontally);
+
+			// Number of pixels at the beginning of span which are equal to the first one, count at most. Pixels of span follow 
+			// each other in memory, when reverse is set the span starts with pixel at the highest address.
+			template<size_t bytesPerPixel, bool reverse>
+			size_t countRepeatedPixels(const char* pixels, size_t runtimeBytesPerPixel, size_t count);
+
+			// Number of pixels at the beginning of span which differ from the next one, count if no two subsequent pixels are equal
+			template<size_t bytesPerPixel, bool reverse>
+			size_t countDifferentPixels(const char* pixels, size_t runtimeBytesPerPixel, size_t count);
+
+			// Walks pixels of image in the order they are written to file for given flip mode
+			template<size_t bytesPerPixel, bool flipVertically, bool flipHorizontally>
+			class TGAPixelCursor {
+			public:
+				TGAPixelCursor(const char* image, size_t width, size_t height, size_t runtimeBytesPerPixel, size_t firstPixel);
+
+				const char* pixel() const { return &image[offset]; }
+				void advance(size_t count = 1);
+				// Copies count pixels to target in file order and advances behind them
+				void read(char* target, size_t count);
+
+				// Number of pixels starting with current one which are equal to it, maxCount at most
+				size_t countRepeated(size_t maxCount) const;
+				// Number of pixels starting with current one which differ from the next pixel, maxCount at most
+				size_t countDifferent(size_t maxCount) const;
+
+			private:
+				size_t size() const { return bytesPerPixel ? bytesPerPixel : pixelSize; }
+				// Pixels left in current row, pixels of row follow each other in memory (backwards for horizontal flip)
+				size_t span() const { return width - x; }
+
+				const char* image;
+				size_t pixelSize;
+				size_t width;
+				size_t rowSize;
+				size_t x;
+				size_t rowOffset;
+				size_t offset;
+			};
+
+			// RLE encoding kernels are specialized for pixel size and flip mode the same way as decoding kernels. When rowOffsets 
+			// is not NULL, packets do not cross rows and offset of every row within compressed data is stored there, followed by 
+			// size of compressed data. Packets are picked greedily, or for the smallest size when optimal is set.
+			bool compressRLE(TGAStreamOutput &output, const char* source, size_t imgWidth, size_t imgHeight, size_t bytesPerPixel, bool flipVertically, bool flipHorizontally, bool optimal, unsigned int threadCount, std::vector<size_t>* rowOffsets);
+
+			template<size_t bytesPerPixel>
+			bool compressRLE(TGAStreamOutput &output, const char* source, size_t imgWidth, size_t imgHeight, size_t runtimeBytesPerPixel, bool flipVertically, bool flipHorizontally, bool optimal, unsigned int threadCount, std::vector<size_t>* rowOffsets);
+
+			template<size_t bytesPerPixel, bool flipVertically, bool flipHorizontally>
+			bool compressRLEBands(TGAStreamOutput &output, const char* source, size_t imgWidth, size_t imgHeight, size_t runtimeBytesPerPixel, bool optimal, unsigned int threadCount, std::vector<size_t>* rowOffsets);
+
+			// Compresses rowCount rows (in file order) starting with firstRow, rowOffsets (if not NULL) receives offsets of these rows
+			template<class Output, size_t bytesPerPixel, bool flipVertically, bool flipHorizontally, bool optimal>
+			void compressRLERows(Output &output, const char* source, size_t imgWidth, size_t imgHeight, size_t runtimeBytesPerPixel, size_t firstRow, size_t rowCount, size_t* rowOffsets);
+
+			// Compresses pixelCount pixels (in file order) starting with firstPixel, last packet ends with the last pixel
+			template<class Output, size_t bytesPerPixel, bool flipVertically, bool flipHorizontally>
+			void compressRLEKernel(Output &output, const char* source, size_t imgWidth, size_t imgHeight, size_t runtimeBytesPerPixel, size_t firstPixel, size_t pixelCount);
+
+			// Same as compressRLEKernel, but packets of every segment of TGA_OPTIMAL_RLE_SEGMENT pixels take the least bytes
+			template<class Output, size_t bytesPerPixel, bool flipVertically, bool flipHorizontally>
+			void compressRLEOptimalKernel(Output &output, const char* source, size_t imgWidth, size_t imgHeight, size_t runtimeBytesPerPixel, size_t firstPixel, size_t pixelCount);
+
+			// Pixels planned for the smallest size at once, packets end at segment boundaries
+			const size_t TGA_OPTIMAL_RLE_SEGMENT = 64 * 1024;
+
+			// Packets of one segment, working memory is kept from segment to segment
+			struct TGARLEPlan {
+				std::vector<char> packetHeaders; //< Headers of packets in file order
+				std::vector<uint32_t> cost; //< Least size of first pixels of segment
+				std::vector<char> lastPacket; //< Header of the last packet of such encoding
+				std::vector<uint32_t> window; //< Starts of RAW packets worth considering
+			};
 
-			template<processFunc process, fetchFunc fetch>
-			void processToStream(std::ostream &stream, char* source, unsigned int imgWidth, unsigned int imgHeight, int beginX, int strideX, int endX, int beginY, int strideY, int endY, size_t resultSize);
+			// Plans packets which encode count pixels (following each other in memory) in the least bytes
+			template<size_t bytesPerPixel>
+			void planOptimalRLEPackets(const char* pixels, size_t runtimeBytesPerPixel, size_t count, TGARLEPlan &plan);
 
-			template<processFunc process, fetchFunc fetch>
-			void processToArray(std::istream &stream, char* target, unsigned int imgWidth, unsigned int imgHeight, int beginX, int strideX, int endX, int beginY, int strideY, int endY, size_t resultSize);
+			typedef void(*compressRLEFunc)(TGAMemoryOutput &output, const char* source, size_t imgWidth, size_t imgHeight, size_t bytesPerPixel, size_t firstRow, size_t rowCount, size_t* rowOffsets);
 
-			char* fetchXPlusY(char* source, unsigned int x, unsigned int y, unsigned int imgWidth, unsigned int imgHeight);
-			char* processPassThrough(char* target, char* source);
+			bool compressRLEParallel(compressRLEFunc compressRows, TGAStreamOutput &output, const char* source, size_t imgWidth, size_t imgHeight, size_t bytesPerPixel, unsigned int threadCount, std::vector<size_t>* rowOffsets);
 
-			bool cmpPixels(char* pa, char* pb, char bytesPerPixel);
+			// Checks layout of image and writes header and color map, pixels of image are not accessed
+			TGAError writeHeader(TGAStreamOutput &output, const TGAImage &image, bool useRLEcompression);
 
-			bool compressRLE(std::ostream &stream, char* source, size_t imgWidth, size_t imgHeight, size_t bytesPerInputPixel);
-			bool compressRLE(std::ostream &stream, char* source, size_t imgWidth, size_t imgHeight, size_t bytesPerInputPixel, flipFunc flipFuncType);
+			// Writes TGA 2.0 extension area with scan line table and footer behind pixel data. Row offsets are relative to pixel 
+			// data, the last one is size of pixel data.
+			bool writeScanLineTable(TGAStreamOutput &output, size_t pixelDataOffset, const std::vector<size_t> &rowOffsets, unsigned char attributeBitsPerPixel);
 		}
 	} 
 }
\ No newline at end of file